@@ -55,6 +55,7 @@ static void version(struct apk_out *out, const char *prefix)
 }
 
 #define GLOBAL_OPTIONS(OPT) \
+	OPT(OPT_GLOBAL_alloc_stats,		"alloc-stats") \
 	OPT(OPT_GLOBAL_allow_untrusted,		"allow-untrusted") \
 	OPT(OPT_GLOBAL_arch,			APK_OPT_ARG "arch") \
 	OPT(OPT_GLOBAL_cache_dir,		APK_OPT_ARG "cache-dir") \
@@ -83,12 +84,17 @@ static void version(struct apk_out *out, const char *prefix)
 	OPT(OPT_GLOBAL_repositories_file,	APK_OPT_ARG "repositories-file") \
 	OPT(OPT_GLOBAL_repository,		APK_OPT_ARG APK_OPT_SH("X") "repository") \
 	OPT(OPT_GLOBAL_root,			APK_OPT_ARG APK_OPT_SH("p") "root") \
+	OPT(OPT_GLOBAL_solver_stats,		"solver-stats") \
+	OPT(OPT_GLOBAL_solver_stats_file,	APK_OPT_ARG "solver-stats-file") \
+	OPT(OPT_GLOBAL_timings,			"timings") \
+	OPT(OPT_GLOBAL_timings_file,		APK_OPT_ARG "timings-file") \
 	OPT(OPT_GLOBAL_update_cache,		APK_OPT_SH("U") "update-cache") \
 	OPT(OPT_GLOBAL_verbose,			APK_OPT_SH("v") "verbose") \
 	OPT(OPT_GLOBAL_version,			APK_OPT_SH("V") "version") \
 	OPT(OPT_GLOBAL_wait,			APK_OPT_ARG "wait") \
 
 #define TEST_OPTIONS(OPT) \
+	OPT(OPT_GLOBAL_test_cpus,		APK_OPT_ARG "test-cpus") \
 	OPT(OPT_GLOBAL_test_instdb,		APK_OPT_ARG "test-instdb") \
 	OPT(OPT_GLOBAL_test_repo,		APK_OPT_ARG "test-repo") \
 	OPT(OPT_GLOBAL_test_world,		APK_OPT_ARG "test-world")
@@ -171,6 +177,21 @@ static int option_parse_global(void *ctx, struct apk_ctx *ac, int opt, const cha
 	case OPT_GLOBAL_allow_untrusted:
 		ac->flags |= APK_ALLOW_UNTRUSTED;
 		break;
+	case OPT_GLOBAL_alloc_stats:
+		ac->flags |= APK_ALLOC_STATS;
+		break;
+	case OPT_GLOBAL_timings:
+		ac->flags |= APK_TIMINGS;
+		break;
+	case OPT_GLOBAL_timings_file:
+		ac->timings_file = optarg;
+		break;
+	case OPT_GLOBAL_solver_stats:
+		ac->flags |= APK_SOLVER_STATS;
+		break;
+	case OPT_GLOBAL_solver_stats_file:
+		ac->solver_stats_file = optarg;
+		break;
 	case OPT_GLOBAL_purge:
 		ac->flags |= APK_PURGE;
 		break;
@@ -204,6 +225,9 @@ static int option_parse_global(void *ctx, struct apk_ctx *ac, int opt, const cha
 		puts(APK_DEFAULT_ARCH);
 		return -ESHUTDOWN;
 #ifdef TEST_MODE
+	case OPT_GLOBAL_test_cpus:
+		ac->num_cpus = max(atoi(optarg), 1);
+		break;
 	case OPT_GLOBAL_test_repo:
 		*apk_string_array_add(&test_repos) = (char*) optarg;
 		break;
@@ -301,7 +325,7 @@ static struct apk_applet *deduce_applet(int argc, char **argv)
 	return NULL;
 }
 
-static int parse_options(int argc, char **argv, struct apk_applet *applet, void *ctx, struct apk_ctx *ac)
+int apk_applet_parse_options(int argc, char **argv, struct apk_applet *applet, void *ctx, struct apk_ctx *ac)
 {
 	struct apk_out *out = &ac->out;
 	const struct apk_option_group *default_optgroups[] = { &optgroup_global, NULL };
@@ -445,7 +469,7 @@ int main(int argc, char **argv)
 	setup_automatic_flags(&ctx);
 	fetchConnectionCacheInit(32, 4);
 
-	r = parse_options(argc, argv, applet, applet_ctx, &ctx);
+	r = apk_applet_parse_options(argc, argv, applet, applet_ctx, &ctx);
 	if (r != 0) goto err;
 
 	if (applet == NULL) {
@@ -456,6 +480,10 @@ int main(int argc, char **argv)
 		return usage(out, NULL);
 	}
 
+#ifndef TEST_MODE
+	if (apk_serve_request(&ctx, applet, argc, argv, &r)) goto err;
+#endif
+
 	argc -= optind;
 	argv += optind;
 	if (argc >= 1 && strcmp(argv[0], applet->name) == 0) {
@@ -493,7 +521,9 @@ int main(int argc, char **argv)
 		apk_blob_pull_deps(&b, &db, &db.world);
 	}
 	if (test_installed_db != NULL) {
+		int timing = apk_timing_begin(&ctx, "index", test_installed_db);
 		apk_db_index_read(&db, apk_istream_from_file(AT_FDCWD, test_installed_db), -1);
+		apk_timing_end(&ctx, timing, 0);
 	}
 	for (int i = 0; i < test_repos->num; i++) {
 		apk_blob_t spec = APK_BLOB_STR(test_repos->item[i]), name, tag;
@@ -512,7 +542,9 @@ int main(int argc, char **argv)
 			name = spec;
 		}
 
+		int timing = apk_timing_begin(&ctx, "index", name.ptr);
 		r = apk_db_index_read(&db, apk_istream_from_file(AT_FDCWD, name.ptr), repo);
+		apk_timing_end(&ctx, timing, 0);
 		if (r != 0) {
 			apk_err(out, "Failed to open repository " BLOB_FMT " : %s", BLOB_PRINTF(name), apk_error_str(r));
 			goto err;
@@ -531,3 +531,103 @@ const struct adb_object_schema schema_idb = {
 		ADB_FIELD(ADBI_IDB_PACKAGES,	"packages",	schema_package_adb_array),
 	},
 };
+
+/* Installed database snapshot. The entries map one-to-one to the
+ * text installed database and keep its ordering, so no sorting. */
+const struct adb_object_schema schema_idbs_acl = {
+	.kind = ADB_KIND_OBJECT,
+	.num_fields = ADBI_IDBS_ACL_MAX,
+	.fields = {
+		ADB_FIELD(ADBI_IDBS_ACL_MODE,	"mode",		scalar_oct),
+		ADB_FIELD(ADBI_IDBS_ACL_UID,	"uid",		scalar_int),
+		ADB_FIELD(ADBI_IDBS_ACL_GID,	"gid",		scalar_int),
+		ADB_FIELD(ADBI_IDBS_ACL_XATTR_HASH,"xattr-hash",	scalar_hexblob),
+	},
+};
+
+const struct adb_object_schema schema_idbs_file = {
+	.kind = ADB_KIND_OBJECT,
+	.num_fields = ADBI_IDBS_FI_MAX,
+	.fields = {
+		ADB_FIELD(ADBI_IDBS_FI_NAME,	"name",		scalar_string),
+		ADB_FIELD(ADBI_IDBS_FI_ACL,	"acl",		schema_idbs_acl),
+		ADB_FIELD(ADBI_IDBS_FI_HASH,	"hash",		scalar_hexblob),
+	},
+};
+
+const struct adb_object_schema schema_idbs_file_array = {
+	.kind = ADB_KIND_ARRAY,
+	.num_fields = APK_MAX_MANIFEST_FILES,
+	.fields = ADB_ARRAY_ITEM(schema_idbs_file),
+};
+
+const struct adb_object_schema schema_idbs_dir = {
+	.kind = ADB_KIND_OBJECT,
+	.num_fields = ADBI_IDBS_DI_MAX,
+	.fields = {
+		ADB_FIELD(ADBI_IDBS_DI_NAME,	"name",		scalar_string),
+		ADB_FIELD(ADBI_IDBS_DI_ACL,	"acl",		schema_idbs_acl),
+		ADB_FIELD(ADBI_IDBS_DI_FILES,	"files",	schema_idbs_file_array),
+	},
+};
+
+const struct adb_object_schema schema_idbs_dir_array = {
+	.kind = ADB_KIND_ARRAY,
+	.num_fields = APK_MAX_MANIFEST_PATHS,
+	.fields = ADB_ARRAY_ITEM(schema_idbs_dir),
+};
+
+const struct adb_object_schema schema_idbs_package = {
+	.kind = ADB_KIND_OBJECT,
+	.num_fields = ADBI_IDBS_PKG_MAX,
+	.fields = {
+		ADB_FIELD(ADBI_IDBS_PKG_UNIQUE_ID,	"unique-id",	scalar_hexblob),
+		ADB_FIELD(ADBI_IDBS_PKG_NAME,		"name",		scalar_string),
+		ADB_FIELD(ADBI_IDBS_PKG_VERSION,	"version",	scalar_string),
+		ADB_FIELD(ADBI_IDBS_PKG_ARCH,		"arch",		scalar_string),
+		ADB_FIELD(ADBI_IDBS_PKG_FILE_SIZE,	"file-size",	scalar_int),
+		ADB_FIELD(ADBI_IDBS_PKG_INSTALLED_SIZE,	"installed-size",scalar_int),
+		ADB_FIELD(ADBI_IDBS_PKG_DESCRIPTION,	"description",	scalar_string),
+		ADB_FIELD(ADBI_IDBS_PKG_URL,		"url",		scalar_string),
+		ADB_FIELD(ADBI_IDBS_PKG_LICENSE,	"license",	scalar_string),
+		ADB_FIELD(ADBI_IDBS_PKG_ORIGIN,		"origin",	scalar_string),
+		ADB_FIELD(ADBI_IDBS_PKG_MAINTAINER,	"maintainer",	scalar_string),
+		ADB_FIELD(ADBI_IDBS_PKG_BUILD_TIME,	"build-time",	scalar_int),
+		ADB_FIELD(ADBI_IDBS_PKG_REPO_COMMIT,	"repo-commit",	scalar_string),
+		ADB_FIELD(ADBI_IDBS_PKG_PRIORITY,	"priority",	scalar_int),
+		ADB_FIELD(ADBI_IDBS_PKG_DEPENDS,	"depends",	scalar_string),
+		ADB_FIELD(ADBI_IDBS_PKG_PROVIDES,	"provides",	scalar_string),
+		ADB_FIELD(ADBI_IDBS_PKG_INSTALL_IF,	"install-if",	scalar_string),
+		ADB_FIELD(ADBI_IDBS_PKG_REPLACES,	"replaces",	scalar_string),
+		ADB_FIELD(ADBI_IDBS_PKG_REPLACES_PRIORITY,"replaces-priority",scalar_int),
+		ADB_FIELD(ADBI_IDBS_PKG_REPOSITORY_TAG,	"repository-tag",scalar_string),
+		ADB_FIELD(ADBI_IDBS_PKG_FLAGS,		"flags",	scalar_int),
+		ADB_FIELD(ADBI_IDBS_PKG_PATHS,		"paths",	schema_idbs_dir_array),
+	},
+};
+
+const struct adb_object_schema schema_idbs_package_array = {
+	.kind = ADB_KIND_ARRAY,
+	.num_fields = APK_MAX_SNAPSHOT_ENTRIES,
+	.fields = ADB_ARRAY_ITEM(schema_idbs_package),
+};
+
+const struct adb_object_schema schema_idbs = {
+	.kind = ADB_KIND_OBJECT,
+	.num_fields = ADBI_IDBS_MAX,
+	.fields = {
+		ADB_FIELD(ADBI_IDBS_STAMP,	"installed-stamp", scalar_hexblob),
+		ADB_FIELD(ADBI_IDBS_PACKAGES,	"packages",	schema_idbs_package_array),
+	},
+};
+
+const struct adb_object_schema schema_rdig = {
+	.kind = ADB_KIND_OBJECT,
+	.num_fields = ADBI_RDIG_MAX,
+	.fields = {
+		ADB_FIELD(ADBI_RDIG_INDEX_SHA256, "index-sha256", scalar_hexblob),
+		ADB_FIELD(ADBI_RDIG_DESCRIPTION, "description",	scalar_string),
+		ADB_FIELD(ADBI_RDIG_PACKAGES,	"packages",	schema_idbs_package_array),
+		ADB_FIELD(ADBI_RDIG_SIGNING_KEY, "signing-key",	scalar_hexblob),
+	},
+};
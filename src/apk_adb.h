@@ -4,6 +4,8 @@
 #define ADB_SCHEMA_INDEX	0x78646e69	// indx
 #define ADB_SCHEMA_PACKAGE	0x676b6370	// pckg
 #define ADB_SCHEMA_INSTALLED_DB	0x00626469	// idb
+#define ADB_SCHEMA_INSTALLED_SNAPSHOT 0x73626469	// idbs
+#define ADB_SCHEMA_REPOSITORY_DIGEST 0x67696472	// rdig
 
 /* Dependency */
 #define ADBI_DEP_NAME		0x01
@@ -87,6 +89,67 @@ struct adb_data_package {
 #define ADBI_IDB_PACKAGES	0x01
 #define ADBI_IDB_MAX		0x02
 
+/* Installed DB snapshot: ACL */
+#define ADBI_IDBS_ACL_MODE	0x01
+#define ADBI_IDBS_ACL_UID	0x02
+#define ADBI_IDBS_ACL_GID	0x03
+#define ADBI_IDBS_ACL_XATTR_HASH 0x04
+#define ADBI_IDBS_ACL_MAX	0x05
+
+/* Installed DB snapshot: File */
+#define ADBI_IDBS_FI_NAME	0x01
+#define ADBI_IDBS_FI_ACL	0x02
+#define ADBI_IDBS_FI_HASH	0x03
+#define ADBI_IDBS_FI_MAX	0x04
+
+/* Installed DB snapshot: Directory */
+#define ADBI_IDBS_DI_NAME	0x01
+#define ADBI_IDBS_DI_ACL	0x02
+#define ADBI_IDBS_DI_FILES	0x03
+#define ADBI_IDBS_DI_MAX	0x04
+
+/* Installed DB snapshot: Package */
+#define ADBI_IDBS_PKG_UNIQUE_ID	0x01
+#define ADBI_IDBS_PKG_NAME	0x02
+#define ADBI_IDBS_PKG_VERSION	0x03
+#define ADBI_IDBS_PKG_ARCH	0x04
+#define ADBI_IDBS_PKG_FILE_SIZE	0x05
+#define ADBI_IDBS_PKG_INSTALLED_SIZE 0x06
+#define ADBI_IDBS_PKG_DESCRIPTION 0x07
+#define ADBI_IDBS_PKG_URL	0x08
+#define ADBI_IDBS_PKG_LICENSE	0x09
+#define ADBI_IDBS_PKG_ORIGIN	0x0a
+#define ADBI_IDBS_PKG_MAINTAINER 0x0b
+#define ADBI_IDBS_PKG_BUILD_TIME 0x0c
+#define ADBI_IDBS_PKG_REPO_COMMIT 0x0d
+#define ADBI_IDBS_PKG_PRIORITY	0x0e
+#define ADBI_IDBS_PKG_DEPENDS	0x0f
+#define ADBI_IDBS_PKG_PROVIDES	0x10
+#define ADBI_IDBS_PKG_INSTALL_IF 0x11
+#define ADBI_IDBS_PKG_REPLACES	0x12
+#define ADBI_IDBS_PKG_REPLACES_PRIORITY 0x13
+#define ADBI_IDBS_PKG_REPOSITORY_TAG 0x14
+#define ADBI_IDBS_PKG_FLAGS	0x15
+#define ADBI_IDBS_PKG_PATHS	0x16
+#define ADBI_IDBS_PKG_MAX	0x17
+
+#define ADB_IDBS_FLAG_BROKEN_FILES	0x01
+#define ADB_IDBS_FLAG_BROKEN_SCRIPT	0x02
+#define ADB_IDBS_FLAG_BROKEN_XATTR	0x04
+#define ADB_IDBS_FLAG_SHA256_160	0x08
+
+/* Installed DB snapshot */
+#define ADBI_IDBS_STAMP		0x01
+#define ADBI_IDBS_PACKAGES	0x02
+#define ADBI_IDBS_MAX		0x03
+
+/* Repository index digest */
+#define ADBI_RDIG_INDEX_SHA256	0x01
+#define ADBI_RDIG_DESCRIPTION	0x02
+#define ADBI_RDIG_PACKAGES	0x03
+#define ADBI_RDIG_SIGNING_KEY	0x04
+#define ADBI_RDIG_MAX		0x05
+
 /* */
 #define APK_MAX_PKG_DEPENDENCIES	512
 #define APK_MAX_PKG_REPLACES		32
@@ -94,13 +157,18 @@ struct adb_data_package {
 #define APK_MAX_INDEX_PACKAGES		20000
 #define APK_MAX_MANIFEST_FILES		8000
 #define APK_MAX_MANIFEST_PATHS		6000
+#define APK_MAX_SNAPSHOT_ENTRIES	0xffff
 
 extern const struct adb_object_schema
 	schema_dependency, schema_dependency_array,
 	schema_pkginfo, schema_pkginfo_array,
 	schema_acl, schema_file, schema_file_array, schema_dir, schema_dir_array,
 	schema_string_array, schema_scripts, schema_package, schema_package_adb_array,
-	schema_index, schema_idb;
+	schema_index, schema_idb,
+	schema_idbs_acl, schema_idbs_file, schema_idbs_file_array,
+	schema_idbs_dir, schema_idbs_dir_array,
+	schema_idbs_package, schema_idbs_package_array, schema_idbs,
+	schema_rdig;
 
 /* */
 int apk_dep_split(apk_blob_t *b, apk_blob_t *bdep);
@@ -48,6 +48,7 @@ struct apk_applet {
 	const struct apk_option_group *optgroups[4];
 
 	unsigned int open_flags, forced_force;
+	unsigned int remote : 1;
 	int context_size;
 
 	int (*main)(void *ctx, struct apk_ctx *ac, struct apk_string_array *args);
@@ -58,6 +59,8 @@ extern const struct apk_option_group optgroup_global, optgroup_commit, optgroup_
 void apk_applet_register(struct apk_applet *);
 struct apk_applet *apk_applet_find(const char *name);
 void apk_applet_help(struct apk_applet *applet, struct apk_out *out);
+int apk_applet_parse_options(int argc, char **argv, struct apk_applet *applet, void *ctx, struct apk_ctx *ac);
+int apk_serve_request(struct apk_ctx *ac, struct apk_applet *applet, int argc, char **argv, int *result);
 
 #define APK_DEFINE_APPLET(x) \
 __attribute__((constructor)) static void __register_##x(void) { apk_applet_register(&x); }
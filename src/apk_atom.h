@@ -12,10 +12,14 @@
 
 #include "apk_hash.h"
 #include "apk_blob.h"
+#include "apk_balloc.h"
 
 extern apk_blob_t apk_atom_null;
 
+struct apk_version_key;
+
 struct apk_atom_pool {
+	struct apk_balloc ba;
 	struct apk_hash hash;
 };
 
@@ -23,6 +27,10 @@ void apk_atom_init(struct apk_atom_pool *);
 void apk_atom_free(struct apk_atom_pool *);
 apk_blob_t *apk_atom_get(struct apk_atom_pool *atoms, apk_blob_t blob, int duplicate);
 
+/* Version comparison key cached with the atom, see apk_version_compare_atom().
+ * Valid only for atoms returned by apk_atom_get(), not for apk_atom_null. */
+struct apk_version_key **apk_atom_version_key(apk_blob_t *atom);
+
 static inline apk_blob_t *apk_atomize(struct apk_atom_pool *atoms, apk_blob_t blob) {
 	return apk_atom_get(atoms, blob, 0);
 }
@@ -0,0 +1,38 @@
+/* apk_balloc.h - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef APK_BALLOC_H
+#define APK_BALLOC_H
+
+#include <stddef.h>
+#include "apk_defines.h"
+
+/* Bulk allocator for objects living as long as the allocator itself.
+ * Objects are carved out of pages, and cannot be freed individually.
+ * All memory is released at once with apk_balloc_destroy(). */
+struct apk_balloc {
+	struct hlist_head pages_head;
+	size_t page_size;
+	uintptr_t cur, end;
+
+	size_t num_allocs;
+	size_t bytes_used;
+	size_t bytes_reserved;
+};
+
+void apk_balloc_init(struct apk_balloc *ba, size_t page_size);
+void apk_balloc_destroy(struct apk_balloc *ba);
+void *apk_balloc_aligned(struct apk_balloc *ba, size_t size, size_t align);
+void *apk_balloc_aligned0(struct apk_balloc *ba, size_t size, size_t align);
+
+#define apk_balloc_new_extra(ba, type, extra) (type *) apk_balloc_aligned(ba, sizeof(type)+extra, __alignof__(type))
+#define apk_balloc_new(ba, type) (type *) apk_balloc_new_extra(ba, type, 0)
+#define apk_balloc_new0_extra(ba, type, extra) (type *) apk_balloc_aligned0(ba, sizeof(type)+extra, __alignof__(type))
+#define apk_balloc_new0(ba, type) (type *) apk_balloc_new0_extra(ba, type, 0)
+
+#endif
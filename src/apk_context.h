@@ -30,6 +30,9 @@
 #define APK_NO_CHROOT			BIT(11)
 #define APK_NO_LOGFILE			BIT(12)
 #define APK_PRESERVE_ENV		BIT(13)
+#define APK_ALLOC_STATS			BIT(14)
+#define APK_TIMINGS			BIT(15)
+#define APK_SOLVER_STATS		BIT(16)
 
 #define APK_FORCE_OVERWRITE		BIT(0)
 #define APK_FORCE_OLD_APK		BIT(1)
@@ -48,6 +51,7 @@
 #define APK_OPENF_NO_INSTALLED_REPO	0x0200
 #define APK_OPENF_CACHE_WRITE		0x0400
 #define APK_OPENF_NO_AUTOUPDATE		0x0800
+#define APK_OPENF_LAZY_FILES		0x1000
 
 #define APK_OPENF_NO_REPOS	(APK_OPENF_NO_SYS_REPOS |	\
 				 APK_OPENF_NO_INSTALLED_REPO)
@@ -57,8 +61,28 @@
 
 struct apk_database;
 
+/* A span of the run recorded with --timings. Times are in nanoseconds
+ * of the monotonic clock, relative to the start of the run. */
+struct apk_timing {
+	const char *phase;
+	char *name;
+	uint64_t start, duration;
+	uint64_t bytes;
+};
+APK_ARRAY(apk_timing_array, struct apk_timing);
+
+/* Solver counters recorded with --solver-stats, summed over all solves
+ * of the run. Times are in nanoseconds. */
+struct apk_solver_stats {
+	unsigned long solves, restarts;
+	unsigned long names_discovered, max_dep_chain;
+	unsigned long reconsider_name, compare_providers, select_package;
+	unsigned long dirty_queued, dirty_requeued, disqualify_package;
+	uint64_t discover_ns, apply_ns, resolve_ns, changeset_ns;
+};
+
 struct apk_ctx {
-	unsigned int flags, force, lock_wait;
+	unsigned int flags, force, lock_wait, num_cpus;
 	struct apk_out out;
 	struct apk_progress progress;
 	unsigned int cache_max_age;
@@ -69,7 +93,12 @@ struct apk_ctx {
 	const char *cache_dir;
 	const char *repositories_file;
 	const char *uvol;
+	const char *timings_file;
+	const char *solver_stats_file;
 	struct apk_string_array *repository_list;
+	struct apk_timing_array *timings;
+	uint64_t timings_origin;
+	struct apk_solver_stats solver_stats;
 
 	struct apk_trust trust;
 	struct apk_id_cache id_cache;
@@ -86,6 +115,12 @@ int apk_ctx_prepare(struct apk_ctx *ac);
 struct apk_trust *apk_ctx_get_trust(struct apk_ctx *ac);
 struct apk_id_cache *apk_ctx_get_id_cache(struct apk_ctx *ac);
 
+uint64_t apk_time_ns(void);
+int apk_timing_begin(struct apk_ctx *ac, const char *phase, const char *name);
+void apk_timing_end(struct apk_ctx *ac, int id, uint64_t bytes);
+void apk_timing_add(struct apk_ctx *ac, const char *phase, const char *name,
+		    uint64_t start, uint64_t end, uint64_t bytes);
+
 static inline int apk_ctx_fd_root(struct apk_ctx *ac) { return ac->root_fd; }
 static inline int apk_ctx_fd_dest(struct apk_ctx *ac) { return ac->dest_fd; }
 static inline time_t apk_ctx_since(struct apk_ctx *ac, time_t since) {
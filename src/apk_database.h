@@ -13,6 +13,7 @@
 #include "apk_version.h"
 #include "apk_hash.h"
 #include "apk_atom.h"
+#include "apk_balloc.h"
 #include "apk_package.h"
 #include "apk_io.h"
 #include "apk_context.h"
@@ -31,7 +32,7 @@ struct apk_db_acl {
 };
 
 struct apk_db_file {
-	struct hlist_node hash_node;
+	apk_hash_node hash_node;
 	struct hlist_node diri_files_list;
 
 	struct apk_db_dir_instance *diri;
@@ -50,11 +51,17 @@ enum apk_protect_mode {
 	APK_PROTECT_ALL,
 };
 
+/* Protected paths are compiled into a tree of path components. Each
+ * directory records the nodes its children are matched against. */
 struct apk_protected_path {
-	char *relative_pattern;
+	struct apk_protected_path *next, *children;
+	unsigned int rule;
 	unsigned protect_mode : 3;
+	unsigned has_protected : 1;
+	unsigned wildcard : 1;
+	char component[];
 };
-APK_ARRAY(apk_protected_path_array, struct apk_protected_path);
+APK_ARRAY(apk_protected_path_array, struct apk_protected_path *);
 
 struct apk_db_dir {
 	apk_hash_node hash_node;
@@ -113,6 +120,7 @@ struct apk_repository {
 	const char *url;
 	struct apk_checksum csum;
 	apk_blob_t description;
+	apk_blob_t index;
 };
 
 #define APK_REPOSITORY_CACHED		0
@@ -126,6 +134,20 @@ struct apk_repository_tag {
 	apk_blob_t tag, plain_name;
 };
 
+/* The installed database journal is compacted when it grows past
+ * 1/APK_DB_JOURNAL_RATIO of the installed database size */
+#define APK_DB_JOURNAL_RATIO		4
+#define APK_DB_JOURNAL_MIN_COMPACT	(64*1024)
+
+struct apk_repository_loader;
+
+struct apk_db_file_stamp {
+	uint64_t size;
+	uint64_t mtime_sec;
+	uint64_t mtime_nsec;
+	uint64_t ino;
+};
+
 struct apk_database {
 	struct apk_ctx *ctx;
 	int root_fd, lock_fd, cache_fd;
@@ -146,13 +168,18 @@ struct apk_database {
 	int open_complete : 1;
 	int compat_newfeatures : 1;
 	int compat_notinstallable : 1;
+	int scripts_dirty : 1;
+	int rdepends_valid : 1;
 
 	struct apk_dependency_array *world;
 	struct apk_id_cache *id_cache;
-	struct apk_protected_path_array *protected_paths;
+	struct apk_protected_path *protected_paths;
+	unsigned int num_protected_rules;
 	struct apk_repository repos[APK_MAX_REPOS];
 	struct apk_repository_tag repo_tags[APK_MAX_TAGS];
+	struct apk_repository_loader *repo_loader;
 	struct apk_atom_pool atoms;
+	struct apk_balloc ba_dirs, ba_diris, ba_files;
 
 	struct {
 		struct apk_hash names;
@@ -170,6 +197,14 @@ struct apk_database {
 			unsigned packages;
 			size_t bytes;
 		} stats;
+		struct {
+			struct apk_db_file_stamp base;
+			struct apk_package_array *removed;
+			off_t size;
+			unsigned base_loaded : 1;
+		} journal;
+		struct apk_istream *lazy_fdb;
+		struct apk_istream *scriptdb;
 	} installed;
 };
 
@@ -186,12 +221,14 @@ struct apk_db_dir *apk_db_dir_ref(struct apk_db_dir *dir);
 void apk_db_dir_unref(struct apk_database *db, struct apk_db_dir *dir, int allow_rmdir);
 struct apk_db_dir *apk_db_dir_get(struct apk_database *db, apk_blob_t name);
 struct apk_db_dir *apk_db_dir_query(struct apk_database *db, apk_blob_t name);
+int apk_db_dir_protect_mode(struct apk_db_dir *dir, const char *name);
 struct apk_db_file *apk_db_file_query(struct apk_database *db,
 				      apk_blob_t dir, apk_blob_t name);
 
 void apk_db_init(struct apk_database *db);
 int apk_db_open(struct apk_database *db, struct apk_ctx *ctx);
 void apk_db_close(struct apk_database *db);
+int apk_db_state_stamp(struct apk_database *db, struct apk_digest *d);
 int apk_db_write_config(struct apk_database *db);
 int apk_db_permanent(struct apk_database *db);
 int apk_db_check_world(struct apk_database *db, struct apk_dependency_array *world);
@@ -205,6 +242,8 @@ static inline time_t apk_db_url_since(struct apk_database *db, time_t since) {
 struct apk_package *apk_db_pkg_add(struct apk_database *db, struct apk_package *pkg);
 struct apk_package *apk_db_get_pkg(struct apk_database *db, struct apk_checksum *csum);
 struct apk_package *apk_db_get_file_owner(struct apk_database *db, apk_blob_t filename);
+void apk_db_ipkg_load_files(struct apk_database *db, struct apk_installed_package *ipkg);
+void apk_db_calc_rdepends(struct apk_database *db);
 
 int apk_db_index_read(struct apk_database *db, struct apk_istream *is, int repo);
 int apk_db_index_read_file(struct apk_database *db, const char *file, int repo);
@@ -215,6 +254,7 @@ struct apk_repository *apk_db_select_repo(struct apk_database *db,
 					  struct apk_package *pkg);
 
 int apk_repo_format_cache_index(apk_blob_t to, struct apk_repository *repo);
+int apk_repo_format_cache_digest(apk_blob_t to, struct apk_repository *repo);
 int apk_repo_format_item(struct apk_database *db, struct apk_repository *repo, struct apk_package *pkg,
 			 int *fd, char *buf, size_t len);
 
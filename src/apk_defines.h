@@ -66,6 +66,7 @@ enum {
 	APKE_UVOL_ERROR,
 	APKE_UVOL_ROOT,
 	APKE_REMOTE_IO,
+	APKE_DELTA_FORMAT,
 };
 
 static inline void *ERR_PTR(long error) { return (void*) error; }
@@ -142,6 +143,7 @@ static inline int IS_ERR(const void *ptr) { return (unsigned long)ptr >= (unsign
 #endif
 
 #define APK_MAX_REPOS		32	/* see struct apk_package */
+#define APK_MAX_INDEX_LOADERS	8
 #define APK_MAX_TAGS		16	/* see solver; unsigned short */
 #define APK_CACHE_CSUM_BYTES	4
 
@@ -0,0 +1,41 @@
+/* apk_delta.h - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef APK_DELTA_H
+#define APK_DELTA_H
+
+#include "apk_io.h"
+
+/* A delta rebuilds a file from a previous version of it. It is a header
+ * followed by operations copying a range of the base file or carrying
+ * literal data. All integers are little endian. */
+#define APK_DELTA_MAGIC		0x544c4441	/* ADLT */
+#define APK_DELTA_VERSION	1
+
+#define APK_DELTA_OP_COPY	1
+#define APK_DELTA_OP_DATA	2
+
+struct apk_delta_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t target_size;
+	uint8_t base_sha256[32];
+	uint8_t target_sha256[32];
+};
+
+struct apk_delta_op {
+	uint32_t type;
+	uint32_t len;
+	uint64_t offset;
+};
+
+int apk_delta_format_name(apk_blob_t to, apk_blob_t base);
+int apk_delta_create(apk_blob_t base, apk_blob_t target, struct apk_ostream *os);
+int apk_delta_apply(apk_blob_t base, struct apk_istream *is, apk_blob_t *target);
+
+#endif
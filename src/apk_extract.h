@@ -31,11 +31,13 @@ struct apk_extract_ctx {
 	struct apk_ctx *ac;
 	const struct apk_extract_ops *ops;
 	struct apk_checksum *identity;
+	struct apk_pkey **signer;
 	apk_blob_t desc;
 	void *pctx;
 	unsigned generate_identity : 1;
 	unsigned is_package : 1;
 	unsigned is_index : 1;
+	unsigned pipeline : 1;
 };
 
 static inline void apk_extract_init(struct apk_extract_ctx *ectx, struct apk_ctx *ac, const struct apk_extract_ops *ops) {
@@ -51,6 +53,12 @@ static inline void apk_extract_generate_identity(struct apk_extract_ctx *ctx, st
 static inline void apk_extract_verify_identity(struct apk_extract_ctx *ctx, struct apk_checksum *id) {
 	ctx->identity = id;
 }
+static inline void apk_extract_signer(struct apk_extract_ctx *ctx, struct apk_pkey **key) {
+	ctx->signer = key;
+}
+static inline void apk_extract_pipeline(struct apk_extract_ctx *ctx) {
+	ctx->pipeline = ctx->ac->num_cpus > 1;
+}
 int apk_extract(struct apk_extract_ctx *, struct apk_istream *is);
 
 int apk_extract_v2(struct apk_extract_ctx *, struct apk_istream *is);
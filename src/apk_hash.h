@@ -30,16 +30,26 @@ struct apk_hash_ops {
 	unsigned long	(*hash_item)(apk_hash_item item);
 	int		(*compare)(apk_blob_t itemkey, apk_blob_t key);
 	int		(*compare_item)(apk_hash_item item, apk_blob_t key);
-	void		(*delete_item)(apk_hash_item item);
+	void		(*delete_item)(apk_hash_item item);	/* optional */
 };
 
-typedef struct hlist_node apk_hash_node;
+/* The full hash is stored in the node so that chains can be scanned
+ * and the table resized without touching the items' keys. */
+typedef struct apk_hash_node {
+	struct hlist_node node;
+	unsigned long hash;
+} apk_hash_node;
 APK_ARRAY(apk_hash_array, struct hlist_head);
 
+/* The bucket count is a power of two. The table grows when it has more
+ * items than buckets, and shrinks back towards the initial size when it
+ * falls below one eighth full. It is not resized during apk_hash_foreach. */
 struct apk_hash {
 	const struct apk_hash_ops *ops;
 	struct apk_hash_array *buckets;
 	int num_items;
+	unsigned int min_buckets;
+	unsigned int walking;
 };
 
 void apk_hash_init(struct apk_hash *h, const struct apk_hash_ops *ops,
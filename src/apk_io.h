@@ -219,6 +219,8 @@ static inline struct apk_istream *apk_istream_gunzip_mpart(struct apk_istream *i
 					     apk_multipart_cb cb, void *ctx) {
 	return apk_istream_zlib(is, 0, cb, ctx);
 }
+struct apk_istream *apk_istream_gunzip_pipeline(struct apk_istream *,
+						apk_multipart_cb cb, void *ctx);
 static inline struct apk_istream *apk_istream_gunzip(struct apk_istream *is) {
 	return apk_istream_zlib(is, 0, NULL, NULL);
 }
@@ -226,12 +228,15 @@ static inline struct apk_istream *apk_istream_deflate(struct apk_istream *is) {
 	return apk_istream_zlib(is, 1, NULL, NULL);
 }
 
-struct apk_ostream *apk_ostream_zlib(struct apk_ostream *, int);
+struct apk_ostream *apk_ostream_zlib(struct apk_ostream *, int, int);
 static inline struct apk_ostream *apk_ostream_gzip(struct apk_ostream *os) {
-	return apk_ostream_zlib(os, 0);
+	return apk_ostream_zlib(os, 0, 0);
+}
+static inline struct apk_ostream *apk_ostream_gzip_rsyncable(struct apk_ostream *os) {
+	return apk_ostream_zlib(os, 0, 1);
 }
 static inline struct apk_ostream *apk_ostream_deflate(struct apk_ostream *os) {
-	return apk_ostream_zlib(os, 1);
+	return apk_ostream_zlib(os, 1, 0);
 }
 
 #endif
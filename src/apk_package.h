@@ -60,8 +60,10 @@ struct apk_installed_package {
 	struct apk_string_array *triggers;
 	struct apk_string_array *pending_triggers;
 	struct apk_dependency_array *replaces;
+	apk_blob_t lazy_files;
 
 	unsigned short replaces_priority;
+	unsigned short script_mapped;
 	unsigned repository_tag : 6;
 	unsigned run_all_triggers : 1;
 	unsigned broken_files : 1;
@@ -69,6 +71,7 @@ struct apk_installed_package {
 	unsigned broken_xattr : 1;
 	unsigned v3 : 1;
 	unsigned sha256_160 : 1;
+	unsigned db_dirty : 1;
 };
 
 struct apk_package {
@@ -93,6 +96,7 @@ struct apk_package {
 	unsigned marked : 1;
 	unsigned uninstallable : 1;
 	unsigned cached_non_repository : 1;
+	unsigned borrowed_info : 1;
 	struct apk_checksum csum;
 };
 APK_ARRAY(apk_package_array, struct apk_package *);
@@ -145,6 +149,7 @@ struct apk_installed_package *apk_pkg_install(struct apk_database *db, struct ap
 void apk_pkg_uninstall(struct apk_database *db, struct apk_package *pkg);
 
 int apk_ipkg_assign_script(struct apk_installed_package *ipkg, unsigned int type, apk_blob_t blob);
+int apk_ipkg_map_script(struct apk_installed_package *ipkg, unsigned int type, apk_blob_t blob);
 int apk_ipkg_add_script(struct apk_installed_package *ipkg,
 			struct apk_istream *is,
 			unsigned int type, unsigned int size);
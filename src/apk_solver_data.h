@@ -19,7 +19,8 @@ struct apk_solver_name_state {
 	union {
 		struct {
 			struct list_head dirty_list;
-			struct list_head unresolved_list;
+			unsigned int unresolved_index;
+			unsigned int unresolved_seq;
 		};
 		struct {
 			struct apk_name *installed_name;
@@ -40,6 +41,8 @@ struct apk_solver_name_state {
 	unsigned has_options : 1;
 	unsigned reverse_deps_done : 1;
 	unsigned has_virtual_provides : 1;
+	unsigned in_cone : 1;
+	unsigned reconsidered : 1;
 };
 
 struct apk_solver_package_state {
@@ -49,6 +52,8 @@ struct apk_solver_package_state {
 	unsigned short pinning_preferred;
 	unsigned solver_flags : 6;
 	unsigned solver_flags_inheritable : 6;
+	unsigned preset_flags : 6;
+	unsigned preset_flags_inheritable : 6;
 	unsigned seen : 1;
 	unsigned pkg_available : 1;
 	unsigned pkg_selectable : 1;
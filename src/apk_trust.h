@@ -31,5 +31,6 @@ void apk_trust_init(struct apk_trust *trust);
 void apk_trust_free(struct apk_trust *trust);
 int apk_trust_load_keys(struct apk_trust *trust, int keysfd);
 struct apk_pkey *apk_trust_key_by_name(struct apk_trust *trust, const char *filename);
+struct apk_pkey *apk_trust_key_by_id(struct apk_trust *trust, const uint8_t *id);
 
 #endif
@@ -30,4 +30,9 @@ int apk_version_compare_blob_fuzzy(apk_blob_t a, apk_blob_t b, int fuzzy);
 int apk_version_compare_blob(apk_blob_t a, apk_blob_t b);
 int apk_version_compare(const char *str1, const char *str2);
 
+/* Like apk_version_compare_blob(), but for atoms from apk_atom_get(). The
+ * versions are tokenized once into a key kept with the atom. */
+int apk_version_compare_atom_fuzzy(apk_blob_t *a, apk_blob_t *b, int fuzzy);
+int apk_version_compare_atom(apk_blob_t *a, apk_blob_t *b);
+
 #endif
@@ -7,6 +7,8 @@
 static const struct adb_db_schema dbschemas[] = {
 	{ .magic = ADB_SCHEMA_INDEX,		.root = &schema_index, },
 	{ .magic = ADB_SCHEMA_INSTALLED_DB,	.root = &schema_idb, },
+	{ .magic = ADB_SCHEMA_INSTALLED_SNAPSHOT, .root = &schema_idbs, },
+	{ .magic = ADB_SCHEMA_REPOSITORY_DIGEST, .root = &schema_rdig, },
 	{ .magic = ADB_SCHEMA_PACKAGE,		.root = &schema_package },
 	{},
 };
@@ -22,9 +22,11 @@ struct add_ctx {
 	const char *virtpkg;
 	unsigned short solver_flags;
 	unsigned short extract_flags;
+	unsigned incremental : 1;
 };
 
 #define ADD_OPTIONS(OPT) \
+	OPT(OPT_ADD_incremental,	"incremental") \
 	OPT(OPT_ADD_initdb,	"initdb") \
 	OPT(OPT_ADD_latest,	APK_OPT_SH("l") "latest") \
 	OPT(OPT_ADD_no_chown,	"no-chown") \
@@ -38,6 +40,9 @@ static int option_parse_applet(void *ctx, struct apk_ctx *ac, int opt, const cha
 	struct add_ctx *actx = (struct add_ctx *) ctx;
 
 	switch (opt) {
+	case OPT_ADD_incremental:
+		actx->incremental = 1;
+		break;
 	case OPT_ADD_initdb:
 		ac->open_flags |= APK_OPENF_CREATE;
 		break;
@@ -198,7 +203,7 @@ static int add_main(void *ctx, struct apk_ctx *ac, struct apk_string_array *args
 					  actx->solver_flags);
 	}
 
-	r = apk_solver_commit(db, 0, world);
+	r = apk_solver_commit(db, actx->incremental ? APK_SOLVERF_INCREMENTAL : 0, world);
 	apk_dependency_array_free(&world);
 
 	return r;
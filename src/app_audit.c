@@ -12,7 +12,6 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <dirent.h>
-#include <fnmatch.h>
 #include <limits.h>
 #include <sys/stat.h>
 #include "apk_applet.h"
@@ -219,18 +218,7 @@ recurse_check:
 		atctx->pathlen--;
 	} else {
 		struct apk_db_file *dbf;
-		struct apk_protected_path *ppath;
-		int protect_mode = dir->protect_mode;
-
-		/* inherit file's protection mask */
-		foreach_array_item(ppath, dir->protected_paths) {
-			char *slash = strchr(ppath->relative_pattern, '/');
-			if (slash == NULL) {
-				if (fnmatch(ppath->relative_pattern, name, FNM_PATHNAME) != 0)
-					continue;
-				protect_mode = ppath->protect_mode;
-			}
-		}
+		int protect_mode = apk_db_dir_protect_mode(dir, name);
 
 		if (actx->mode == MODE_BACKUP) {
 			switch (protect_mode) {
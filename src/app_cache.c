@@ -164,6 +164,8 @@ static void cache_clean_item(struct apk_database *db, int dirfd, const char *nam
 		/* Check if this is a valid index */
 		apk_repo_format_cache_index(APK_BLOB_BUF(tmp), &db->repos[i]);
 		if (apk_blob_compare(b, APK_BLOB_STR(tmp)) == 0) return;
+		apk_repo_format_cache_digest(APK_BLOB_BUF(tmp), &db->repos[i]);
+		if (apk_blob_compare(b, APK_BLOB_STR(tmp)) == 0) return;
 	}
 
 delete:
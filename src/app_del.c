@@ -145,6 +145,7 @@ static int del_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *arg
 	struct apk_dependency *d;
 	int r = 0;
 
+	apk_db_calc_rdepends(db);
 	apk_dependency_array_copy(&ctx->world, db->world);
 	apk_name_foreach_matching(db, args, apk_foreach_genid(), delete_name, ctx);
 	if (ctx->errors) return ctx->errors;
@@ -165,8 +166,10 @@ static int del_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *arg
 			printf("\n");
 
 		r = apk_solver_commit_changeset(db, &changeset, ctx->world);
-	} else {
+	} else if (r > 0) {
 		apk_solver_print_errors(db, &changeset, ctx->world);
+	} else {
+		apk_err(&ac->out, "Unable to solve dependencies: %s", apk_error_str(r));
 	}
 	apk_change_array_free(&changeset.changes);
 	apk_dependency_array_free(&ctx->world);
@@ -239,6 +239,7 @@ static void mark_name_flags(struct apk_database *db, const char *match, struct a
 static void mark_names_recursive(struct apk_database *db, struct apk_string_array *args, void *pctx)
 {
 	struct fetch_ctx *ctx = (struct fetch_ctx *) pctx;
+	struct apk_out *out = &db->ctx->out;
 	struct apk_changeset changeset = {};
 	struct apk_change *change;
 	int r;
@@ -247,9 +248,12 @@ static void mark_names_recursive(struct apk_database *db, struct apk_string_arra
 	if (r == 0) {
 		foreach_array_item(change, changeset.changes)
 			mark_package(ctx, change->new_pkg);
-	} else {
+	} else if (r > 0) {
 		apk_solver_print_errors(db, &changeset, ctx->world);
 		ctx->errors++;
+	} else {
+		apk_err(out, "Unable to solve dependencies: %s", apk_error_str(r));
+		ctx->errors++;
 	}
 	apk_change_array_free(&changeset.changes);
 }
@@ -15,10 +15,12 @@
 
 #include "apk_applet.h"
 #include "apk_database.h"
+#include "apk_delta.h"
 #include "apk_print.h"
 #include "apk_tar.h"
 
 #define APK_INDEXF_NO_WARNINGS	0x0001
+#define APK_INDEXF_RSYNCABLE	0x0002
 
 struct counts {
 	struct apk_out *out;
@@ -26,6 +28,7 @@ struct counts {
 };
 
 struct index_ctx {
+	const char *delta_from;
 	const char *index;
 	const char *output;
 	const char *description;
@@ -35,11 +38,13 @@ struct index_ctx {
 };
 
 #define INDEX_OPTIONS(OPT) \
+	OPT(OPT_INDEX_delta_from,	APK_OPT_ARG "delta-from") \
 	OPT(OPT_INDEX_description,	APK_OPT_ARG APK_OPT_SH("d") "description") \
 	OPT(OPT_INDEX_index,		APK_OPT_ARG APK_OPT_SH("x") "index") \
 	OPT(OPT_INDEX_no_warnings,	"no-warnings") \
 	OPT(OPT_INDEX_output,		APK_OPT_ARG APK_OPT_SH("o") "output") \
-	OPT(OPT_INDEX_rewrite_arch,	APK_OPT_ARG "rewrite-arch")
+	OPT(OPT_INDEX_rewrite_arch,	APK_OPT_ARG "rewrite-arch") \
+	OPT(OPT_INDEX_rsyncable,	"rsyncable")
 
 APK_OPT_APPLET(option_desc, INDEX_OPTIONS);
 
@@ -48,6 +53,9 @@ static int option_parse_applet(void *ctx, struct apk_ctx *ac, int opt, const cha
 	struct index_ctx *ictx = (struct index_ctx *) ctx;
 
 	switch (opt) {
+	case OPT_INDEX_delta_from:
+		ictx->delta_from = optarg;
+		break;
 	case OPT_INDEX_description:
 		ictx->description = optarg;
 		break;
@@ -63,6 +71,9 @@ static int option_parse_applet(void *ctx, struct apk_ctx *ac, int opt, const cha
 	case OPT_INDEX_no_warnings:
 		ictx->index_flags |= APK_INDEXF_NO_WARNINGS;
 		break;
+	case OPT_INDEX_rsyncable:
+		ictx->index_flags |= APK_INDEXF_RSYNCABLE;
+		break;
 	default:
 		return -ENOTSUP;
 	}
@@ -105,6 +116,49 @@ static int warn_if_no_providers(apk_hash_item item, void *ctx)
 	return 0;
 }
 
+static int index_write_delta(struct apk_out *out, struct index_ctx *ictx, struct apk_string_array *args)
+{
+	apk_blob_t base, target;
+	char name[64];
+	const char *output = ictx->output;
+	int r;
+
+	if (args->num != 1) {
+		apk_err(out, "Delta generation needs exactly one new index");
+		return -EINVAL;
+	}
+
+	base = apk_blob_from_file(AT_FDCWD, ictx->delta_from);
+	if (APK_BLOB_IS_NULL(base)) {
+		apk_err(out, "%s: unable to read", ictx->delta_from);
+		return -EIO;
+	}
+	target = apk_blob_from_file(AT_FDCWD, args->item[0]);
+	if (APK_BLOB_IS_NULL(target)) {
+		apk_err(out, "%s: unable to read", args->item[0]);
+		free(base.ptr);
+		return -EIO;
+	}
+
+	if (output == NULL) {
+		r = apk_delta_format_name(APK_BLOB_BUF(name), base);
+		if (r < 0) goto err;
+		output = name;
+	}
+	r = apk_delta_create(base, target, apk_ostream_to_file(AT_FDCWD, output, 0644));
+	if (r == 0) {
+		struct apk_file_info fi;
+		if (apk_fileinfo_get(AT_FDCWD, output, 0, &fi, NULL) == 0)
+			apk_msg(out, "%s: %lld bytes for an index of %zu bytes",
+				output, (long long) fi.size, target.len);
+	}
+err:
+	if (r < 0) apk_err(out, "Delta generation failed: %s", apk_error_str(r));
+	free(base.ptr);
+	free(target.ptr);
+	return r;
+}
+
 static int index_main(void *ctx, struct apk_ctx *ac, struct apk_string_array *args)
 {
 	struct apk_out *out = &ac->out;
@@ -118,6 +172,9 @@ static int index_main(void *ctx, struct apk_ctx *ac, struct apk_string_array *ar
 	char **parg;
 	apk_blob_t *rewrite_arch = NULL;
 
+	if (ictx->delta_from)
+		return index_write_delta(out, ictx, args);
+
 	if (isatty(STDOUT_FILENO) && ictx->output == NULL &&
 	    !(db->ctx->force & APK_FORCE_BINARY_STDOUT)) {
 		apk_err(out,
@@ -209,7 +266,10 @@ static int index_main(void *ctx, struct apk_ctx *ac, struct apk_string_array *ar
 	apk_ostream_close(counter);
 
 	if (r >= 0) {
-		os = apk_ostream_gzip(os);
+		if (ictx->index_flags & APK_INDEXF_RSYNCABLE)
+			os = apk_ostream_gzip_rsyncable(os);
+		else
+			os = apk_ostream_gzip(os);
 		if (ictx->description != NULL) {
 			struct apk_file_info fi_desc;
 			memset(&fi_desc, 0, sizeof(fi));
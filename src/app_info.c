@@ -14,6 +14,7 @@
 #include "apk_applet.h"
 #include "apk_package.h"
 #include "apk_database.h"
+#include "apk_balloc.h"
 #include "apk_print.h"
 
 struct info_ctx {
@@ -21,6 +22,7 @@ struct info_ctx {
 	void (*action)(struct info_ctx *ctx, struct apk_database *db, struct apk_string_array *args);
 	int subaction_mask;
 	int errors;
+	unsigned int from_stdin : 1;
 };
 
 static int verbosity = 0;
@@ -81,6 +83,226 @@ static void info_exists(struct info_ctx *ctx, struct apk_database *db,
 	}
 }
 
+static struct apk_package *who_owns(struct apk_database *db, const char *path,
+				    char *fnbuf, apk_blob_t *fn, const char **via)
+{
+	struct apk_package *pkg;
+	char buf[PATH_MAX];
+	ssize_t r;
+
+	if (path[0] != '/' && realpath(path, fnbuf))
+		*fn = APK_BLOB_STR(fnbuf);
+	else
+		*fn = APK_BLOB_STR(path);
+
+	*via = "";
+	pkg = apk_db_get_file_owner(db, *fn);
+	if (pkg == NULL) {
+		r = readlinkat(db->root_fd, path, buf, sizeof(buf));
+		if (r > 0 && r < PATH_MAX && buf[0] == '/') {
+			buf[r] = 0;
+			pkg = apk_db_get_file_owner(db, APK_BLOB_STR(buf));
+			*via = "symlink target ";
+		}
+	}
+	return pkg;
+}
+
+/* Directory tree of the installed packages for the prefix queries of
+ * the batch mode. Built on first use from the package directory
+ * instances, and keyed by the database directory. */
+struct owner_diri {
+	struct owner_diri *next;
+	struct apk_db_dir_instance *diri;
+};
+
+struct owner_node {
+	apk_hash_node hash_node;
+	struct apk_db_dir *dir;
+	struct owner_node *children, **children_tail, *next;
+	struct owner_diri *diris, **diris_tail;
+};
+
+struct owner_index {
+	struct apk_balloc ba;
+	struct apk_hash nodes;
+	int built;
+};
+
+static apk_blob_t owner_node_get_key(apk_hash_item item)
+{
+	struct owner_node *n = (struct owner_node *) item;
+	return APK_BLOB_PTR_LEN((char *) &n->dir, sizeof n->dir);
+}
+
+static const struct apk_hash_ops owner_node_hash_ops = {
+	.node_offset = offsetof(struct owner_node, hash_node),
+	.get_key = owner_node_get_key,
+	.hash_key = apk_blob_hash,
+	.compare = apk_blob_compare,
+};
+
+static struct owner_node *owner_node_query(struct owner_index *idx, struct apk_db_dir *dir)
+{
+	return apk_hash_get(&idx->nodes, APK_BLOB_PTR_LEN((char *) &dir, sizeof dir));
+}
+
+static struct owner_node *owner_node_get(struct owner_index *idx, struct apk_db_dir *dir)
+{
+	apk_blob_t key = APK_BLOB_PTR_LEN((char *) &dir, sizeof dir);
+	unsigned long hash = apk_hash_from_key(&idx->nodes, key);
+	struct owner_node *n, *parent;
+
+	n = apk_hash_get_hashed(&idx->nodes, key, hash);
+	if (n) return n;
+
+	n = apk_balloc_new0(&idx->ba, struct owner_node);
+	n->dir = dir;
+	n->children_tail = &n->children;
+	n->diris_tail = &n->diris;
+	apk_hash_insert_hashed(&idx->nodes, n, hash);
+	if (dir->parent) {
+		parent = owner_node_get(idx, dir->parent);
+		*parent->children_tail = n;
+		parent->children_tail = &n->next;
+	}
+	return n;
+}
+
+static void owner_index_build(struct owner_index *idx, struct apk_database *db)
+{
+	struct apk_installed_package *ipkg;
+	struct apk_db_dir_instance *diri;
+	struct owner_node *n;
+	struct owner_diri *od;
+	struct hlist_node *c;
+
+	if (idx->built) return;
+	idx->built = 1;
+
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list) {
+		apk_db_ipkg_load_files(db, ipkg);
+		hlist_for_each_entry(diri, c, &ipkg->owned_dirs, pkg_dirs_list) {
+			n = owner_node_get(idx, diri->dir);
+			od = apk_balloc_new(&idx->ba, struct owner_diri);
+			*od = (struct owner_diri) { .diri = diri };
+			*n->diris_tail = od;
+			n->diris_tail = &od->next;
+		}
+	}
+}
+
+static int owner_node_print(struct owner_node *n)
+{
+	struct owner_node *child;
+	struct owner_diri *od;
+	struct apk_db_file *file;
+	struct hlist_node *c;
+	int found = 0;
+
+	for (od = n->diris; od; od = od->next) {
+		hlist_for_each_entry(file, c, &od->diri->owned_files, diri_files_list) {
+			printf("/" DIR_FILE_FMT " is owned by " PKG_VER_FMT "\n",
+			       DIR_FILE_PRINTF(n->dir, file), PKG_VER_PRINTF(od->diri->pkg));
+			found = 1;
+		}
+	}
+	for (child = n->children; child; child = child->next)
+		found |= owner_node_print(child);
+	return found;
+}
+
+static void who_owns_prefix(struct info_ctx *ctx, struct apk_database *db,
+			    struct owner_index *idx, apk_blob_t prefix)
+{
+	struct apk_out *out = &db->ctx->out;
+	struct owner_node *n = NULL;
+	struct apk_db_dir *dir;
+	char path[PATH_MAX], buf[PATH_MAX];
+	apk_blob_t name = prefix;
+	ssize_t r;
+
+	while (name.len && name.ptr[0] == '/') name.ptr++, name.len--;
+	while (name.len && name.ptr[name.len-1] == '/') name.len--;
+
+	owner_index_build(idx, db);
+	dir = apk_db_dir_query(db, name);
+	if (dir == NULL && name.len && name.len < sizeof path) {
+		/* A symlinked directory is looked up by its target, as
+		 * with the plain paths */
+		memcpy(path, name.ptr, name.len);
+		path[name.len] = 0;
+		r = readlinkat(db->root_fd, path, buf, sizeof buf);
+		if (r > 0 && r < PATH_MAX && buf[0] == '/') {
+			name = APK_BLOB_PTR_LEN(buf, r);
+			while (name.len && name.ptr[0] == '/') name.ptr++, name.len--;
+			while (name.len && name.ptr[name.len-1] == '/') name.len--;
+			dir = apk_db_dir_query(db, name);
+		}
+	}
+	if (dir) n = owner_node_query(idx, dir);
+	if (n == NULL || !owner_node_print(n)) {
+		apk_err(out, BLOB_FMT ": Could not find owner package",
+			BLOB_PRINTF(prefix));
+		ctx->errors++;
+	}
+}
+
+static void info_who_owns_batch(struct info_ctx *ctx, struct apk_database *db)
+{
+	struct apk_out *out = &db->ctx->out;
+	struct apk_istream *is;
+	struct apk_package *pkg;
+	struct owner_index idx;
+	const char *via;
+	char path[PATH_MAX], fnbuf[PATH_MAX];
+	apk_blob_t l, fn;
+
+	is = apk_istream_from_fd(STDIN_FILENO);
+	if (IS_ERR(is)) {
+		apk_err(out, "stdin: %s", apk_error_str(PTR_ERR(is)));
+		ctx->errors++;
+		return;
+	}
+
+	apk_balloc_init(&idx.ba, 64*1024);
+	apk_hash_init(&idx.nodes, &owner_node_hash_ops, 1000);
+	idx.built = 0;
+
+	/* The caller may wait for each answer before writing the next
+	 * query, so the answers are flushed as they are resolved */
+	while (apk_istream_get_delim(is, APK_BLOB_STR("\n"), &l) == 0) {
+		if (l.len == 0) continue;
+		if (l.ptr[l.len-1] == '/') {
+			who_owns_prefix(ctx, db, &idx, l);
+			fflush(stdout);
+			continue;
+		}
+		if (l.len >= sizeof path) {
+			apk_err(out, BLOB_FMT ": %s", BLOB_PRINTF(l), apk_error_str(-ENAMETOOLONG));
+			ctx->errors++;
+			continue;
+		}
+		memcpy(path, l.ptr, l.len);
+		path[l.len] = 0;
+
+		pkg = who_owns(db, path, fnbuf, &fn, &via);
+		if (pkg == NULL) {
+			apk_err(out, BLOB_FMT ": Could not find owner package",
+				BLOB_PRINTF(fn));
+			ctx->errors++;
+			continue;
+		}
+		printf(BLOB_FMT " %sis owned by " PKG_VER_FMT "\n",
+		       BLOB_PRINTF(fn), via, PKG_VER_PRINTF(pkg));
+		fflush(stdout);
+	}
+	apk_istream_close(is);
+
+	apk_hash_free(&idx.nodes);
+	apk_balloc_destroy(&idx.ba);
+}
+
 static void info_who_owns(struct info_ctx *ctx, struct apk_database *db,
 			  struct apk_string_array *args)
 {
@@ -90,27 +312,17 @@ static void info_who_owns(struct info_ctx *ctx, struct apk_database *db,
 	struct apk_dependency dep;
 	struct apk_ostream *os;
 	const char *via;
-	char **parg, fnbuf[PATH_MAX], buf[PATH_MAX];
+	char **parg, fnbuf[PATH_MAX];
 	apk_blob_t fn;
-	ssize_t r;
+
+	if (ctx->from_stdin) {
+		info_who_owns_batch(ctx, db);
+		return;
+	}
 
 	apk_dependency_array_init(&deps);
 	foreach_array_item(parg, args) {
-		if (*parg[0] != '/' && realpath(*parg, fnbuf))
-			fn = APK_BLOB_STR(fnbuf);
-		else
-			fn = APK_BLOB_STR(*parg);
-
-		via = "";
-		pkg = apk_db_get_file_owner(db, fn);
-		if (pkg == NULL) {
-			r = readlinkat(db->root_fd, *parg, buf, sizeof(buf));
-			if (r > 0 && r < PATH_MAX && buf[0] == '/') {
-				pkg = apk_db_get_file_owner(db, APK_BLOB_STR(buf));
-				via = "symlink target ";
-			}
-		}
-
+		pkg = who_owns(db, *parg, fnbuf, &fn, &via);
 		if (pkg == NULL) {
 			apk_err(out, BLOB_FMT ": Could not find owner package",
 				BLOB_PRINTF(fn));
@@ -222,6 +434,7 @@ static void print_rdep_pkg(struct apk_package *pkg0, struct apk_dependency *dep0
 
 static void info_print_required_by(struct apk_database *db, struct apk_package *pkg)
 {
+	apk_db_calc_rdepends(db);
 	if (verbosity == 1)
 		printf(PKG_VER_FMT " is required by:\n", PKG_VER_PRINTF(pkg));
 	if (verbosity > 1)
@@ -242,6 +455,7 @@ static void info_print_rinstall_if(struct apk_database *db, struct apk_package *
 	int i, j;
 	char *separator = verbosity > 1 ? " " : "\n";
 
+	apk_db_calc_rdepends(db);
 	if (verbosity == 1)
 		printf(PKG_VER_FMT " affects auto-installation of:\n",
 		       PKG_VER_PRINTF(pkg));
@@ -280,6 +494,7 @@ static void info_print_contents(struct apk_database *db, struct apk_package *pkg
 		printf(PKG_VER_FMT " contains:\n",
 		       PKG_VER_PRINTF(pkg));
 
+	apk_db_ipkg_load_files(db, ipkg);
 	hlist_for_each_entry_safe(diri, dc, dn, &ipkg->owned_dirs,
 				  pkg_dirs_list) {
 		hlist_for_each_entry_safe(file, fc, fn, &diri->owned_files,
@@ -365,6 +580,7 @@ static void print_name_info(struct apk_database *db, const char *match, struct a
 	OPT(OPT_INFO_contents,		APK_OPT_SH("L") "contents") \
 	OPT(OPT_INFO_depends,		APK_OPT_SH("R") "depends") \
 	OPT(OPT_INFO_description,	APK_OPT_SH("d") "description") \
+	OPT(OPT_INFO_from_stdin,	"from-stdin") \
 	OPT(OPT_INFO_install_if,	"install-if") \
 	OPT(OPT_INFO_installed,		APK_OPT_SH("e") "installed") \
 	OPT(OPT_INFO_license,		"license") \
@@ -389,6 +605,9 @@ static int option_parse_applet(void *pctx, struct apk_ctx *ac, int opt, const ch
 		ctx->action = info_exists;
 		ac->open_flags |= APK_OPENF_NO_REPOS;
 		break;
+	case OPT_INFO_from_stdin:
+		ctx->from_stdin = 1;
+		/* fallthrough */
 	case OPT_INFO_who_owns:
 		ctx->action = info_who_owns;
 		ac->open_flags |= APK_OPENF_NO_REPOS;
@@ -472,7 +691,8 @@ static const struct apk_option_group optgroup_applet = {
 
 static struct apk_applet apk_info = {
 	.name = "info",
-	.open_flags = APK_OPENF_READ,
+	.open_flags = APK_OPENF_READ | APK_OPENF_LAZY_FILES,
+	.remote = 1,
 	.context_size = sizeof(struct info_ctx),
 	.optgroups = { &optgroup_global, &optgroup_applet },
 	.main = info_main,
@@ -253,6 +253,8 @@ static int list_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *ar
 
 	if (ctx->match_origin)
 		args = NULL;
+	if (ctx->match_depends)
+		apk_db_calc_rdepends(db);
 
 	apk_name_foreach_matching(
 		db, args, APK_FOREACH_NULL_MATCHES_ALL | apk_foreach_genid(),
@@ -263,7 +265,8 @@ static int list_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *ar
 
 static struct apk_applet apk_list = {
 	.name = "list",
-	.open_flags = APK_OPENF_READ,
+	.open_flags = APK_OPENF_READ | APK_OPENF_LAZY_FILES,
+	.remote = 1,
 	.context_size = sizeof(struct list_ctx),
 	.optgroups = { &optgroup_global, &optgroup_applet },
 	.main = list_main,
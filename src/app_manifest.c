@@ -40,6 +40,8 @@ static void process_package(struct apk_database *db, struct apk_package *pkg)
 	if (ipkg == NULL)
 		return;
 
+	apk_db_ipkg_load_files(db, ipkg);
+
 	if (apk_out_verbosity(out) > 1) {
 		prefix1 = pkg->name->name;
 		prefix2 = ": ";
@@ -172,7 +174,8 @@ static int manifest_main(void *applet_ctx, struct apk_ctx *ac, struct apk_string
 
 static struct apk_applet apk_manifest = {
 	.name = "manifest",
-	.open_flags = APK_OPENF_READ,
+	.open_flags = APK_OPENF_READ | APK_OPENF_LAZY_FILES,
+	.remote = 1,
 	.main = manifest_main,
 };
 
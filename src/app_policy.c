@@ -69,7 +69,8 @@ static int policy_main(void *ctx, struct apk_ctx *ac, struct apk_string_array *a
 
 static struct apk_applet apk_policy = {
 	.name = "policy",
-	.open_flags = APK_OPENF_READ,
+	.open_flags = APK_OPENF_READ | APK_OPENF_LAZY_FILES,
+	.remote = 1,
 	.main = policy_main,
 };
 
@@ -158,7 +158,7 @@ static void print_result(struct apk_database *db, const char *match, struct apk_
 	} else {
 		foreach_array_item(p, name->providers) {
 			if (pkg == NULL ||
-			    apk_version_compare_blob(*p->version, *pkg->version) == APK_VERSION_GREATER)
+			    apk_version_compare_atom(p->version, pkg->version) == APK_VERSION_GREATER)
 				pkg = p->pkg;
 		}
 		if (pkg)
@@ -185,6 +185,8 @@ static int search_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *
 		ctx->print_package = print_package_name;
 	if (ctx->print_result == NULL)
 		ctx->print_result = ctx->print_package;
+	if (ctx->print_result == print_rdepends)
+		apk_db_calc_rdepends(db);
 
 	if (ctx->search_description || ctx->search_origin)
 		return apk_hash_foreach(&db->available.packages, print_pkg, ctx);
@@ -0,0 +1,481 @@
+/* app_serve.c - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "apk_applet.h"
+#include "apk_database.h"
+#include "apk_print.h"
+
+/* The daemon keeps the database open and answers the read-only queries
+ * of other apk invocations. The client passes its stdin, stdout, stderr
+ * and current directory along with its command line, and the daemon runs
+ * the applet in a forked child against the already open database. If the
+ * daemon is not running, or can not give the answer the client would get
+ * by opening the database itself, the client runs the command locally. */
+
+#define APK_SERVE_SOCKET	"/run/apk-serve.sock"
+#define APK_SERVE_MAGIC		0x31767273	/* "srv1" */
+#define APK_SERVE_MAX_REQUEST	(64*1024)
+#define APK_SERVE_NUM_FDS	4
+
+enum {
+	SERVE_ACCEPTED = 0,
+	SERVE_DECLINED = 1,
+};
+
+struct serve_header {
+	uint32_t magic;
+	uint32_t len;
+};
+
+struct serve_ctx {
+	const char *socket;
+	char root[PATH_MAX];
+	char *repositories_file;
+	struct apk_digest stamp;
+	int db_open;
+};
+
+#define SERVE_OPTIONS(OPT) \
+	OPT(OPT_SERVE_socket,	APK_OPT_ARG "socket")
+
+APK_OPT_APPLET(option_desc, SERVE_OPTIONS);
+
+static int option_parse_applet(void *pctx, struct apk_ctx *ac, int opt, const char *optarg)
+{
+	struct serve_ctx *ctx = (struct serve_ctx *) pctx;
+
+	switch (opt) {
+	case OPT_SERVE_socket:
+		ctx->socket = optarg;
+		break;
+	default:
+		return -ENOTSUP;
+	}
+	return 0;
+}
+
+static const struct apk_option_group optgroup_applet = {
+	.desc = option_desc,
+	.parse = option_parse_applet,
+};
+
+/* Only queries which read the installed state and repositories, and have
+ * no side effects of their own, can be answered from the shared database. */
+static int serve_applet_remote(struct apk_applet *applet, struct apk_ctx *ac)
+{
+	const unsigned long open_mask = APK_OPENF_READ | APK_OPENF_LAZY_FILES | APK_OPENF_NO_REPOS;
+
+	if (!applet->remote) return 0;
+	if (!(ac->open_flags & APK_OPENF_READ) || (ac->open_flags & ~open_mask)) return 0;
+	if (ac->flags & (APK_OVERLAY_FROM_STDIN | APK_ALLOC_STATS | APK_TIMINGS)) return 0;
+	if (ac->timings_file) return 0;
+	return 1;
+}
+
+static const char *serve_socket_path(const char *path)
+{
+	if (!path) path = getenv("APK_SERVE_SOCKET") ?: APK_SERVE_SOCKET;
+	if (!path[0] || strlen(path) >= sizeof(((struct sockaddr_un *)0)->sun_path))
+		return NULL;
+	return path;
+}
+
+static int serve_read_fully(int fd, void *ptr, size_t size)
+{
+	size_t i = 0;
+	ssize_t r;
+
+	while (i < size) {
+		r = read(fd, ptr + i, size - i);
+		if (r == 0) return -ECONNRESET;
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			return -errno;
+		}
+		i += r;
+	}
+	return 0;
+}
+
+static int serve_send(int fd, const int *fds, int num_fds, const void *ptr, size_t len)
+{
+	struct serve_header hdr = { .magic = APK_SERVE_MAGIC, .len = len };
+	union {
+		struct cmsghdr cmsg;
+		char buf[CMSG_SPACE(sizeof(int[APK_SERVE_NUM_FDS]))];
+	} u = {};
+	struct iovec iov[2] = {
+		{ .iov_base = &hdr, .iov_len = sizeof hdr },
+		{ .iov_base = (void *) ptr, .iov_len = len },
+	};
+	struct msghdr msg = {
+		.msg_iov = iov,
+		.msg_iovlen = ARRAY_SIZE(iov),
+		.msg_control = u.buf,
+		.msg_controllen = CMSG_SPACE(sizeof(int[num_fds])),
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int[num_fds]));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int[num_fds]));
+
+	if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof hdr + len) return -EIO;
+	return 0;
+}
+
+static int serve_recv(int fd, int *fds, char **payload, size_t *len)
+{
+	struct serve_header hdr;
+	union {
+		struct cmsghdr cmsg;
+		char buf[CMSG_SPACE(sizeof(int[APK_SERVE_NUM_FDS]))];
+	} u;
+	struct iovec iov = { .iov_base = &hdr, .iov_len = sizeof hdr };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = u.buf,
+		.msg_controllen = sizeof u.buf,
+	};
+	struct cmsghdr *cmsg;
+	char *buf;
+	int r;
+
+	if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) != sizeof hdr) return -EPROTO;
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(sizeof(int[APK_SERVE_NUM_FDS])))
+		return -EPROTO;
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(int[APK_SERVE_NUM_FDS]));
+	if (hdr.magic != APK_SERVE_MAGIC || hdr.len == 0 || hdr.len > APK_SERVE_MAX_REQUEST)
+		return -EPROTO;
+
+	buf = malloc(hdr.len + 1);
+	if (!buf) return -ENOMEM;
+	r = serve_read_fully(fd, buf, hdr.len);
+	if (r < 0) {
+		free(buf);
+		return r;
+	}
+	buf[hdr.len] = 0;
+	*payload = buf;
+	*len = hdr.len;
+	return 0;
+}
+
+/* Both ends talk only to a peer running as root or as themselves: the
+ * daemon runs commands with the client's descriptors, and the client
+ * hands its descriptors and arguments to the daemon. */
+static int serve_peer_allowed(struct apk_out *out, int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof cred;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) return 0;
+	if (cred.uid == 0 || cred.uid == geteuid()) return 1;
+	apk_dbg(out, "Rejected peer with uid %d", (int) cred.uid);
+	return 0;
+}
+
+int apk_serve_request(struct apk_ctx *ac, struct apk_applet *applet, int argc, char **argv, int *result)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	const char *path;
+	char *payload, *p;
+	size_t len;
+	int32_t reply, status;
+	int fd, fds[APK_SERVE_NUM_FDS], i, r;
+
+	if (!serve_applet_remote(applet, ac)) return 0;
+	if (!(path = serve_socket_path(NULL))) return 0;
+	strcpy(sun.sun_path, path);
+
+	len = strlen(applet->name) + 1;
+	for (i = 0; i < argc; i++) len += strlen(argv[i]) + 1;
+	if (len > APK_SERVE_MAX_REQUEST) return 0;
+	payload = p = malloc(len);
+	if (!payload) return 0;
+	p = stpcpy(p, applet->name) + 1;
+	for (i = 0; i < argc; i++) p = stpcpy(p, argv[i]) + 1;
+
+	fds[0] = STDIN_FILENO;
+	fds[1] = STDOUT_FILENO;
+	fds[2] = STDERR_FILENO;
+	fds[3] = openat(AT_FDCWD, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || fds[3] < 0) goto declined;
+	if (connect(fd, (struct sockaddr *) &sun, sizeof sun) < 0) goto declined;
+	if (!serve_peer_allowed(&ac->out, fd)) goto declined;
+
+	fflush(stdout);
+	fflush(stderr);
+	if (serve_send(fd, fds, ARRAY_SIZE(fds), payload, len) < 0) goto declined;
+	if (serve_read_fully(fd, &reply, sizeof reply) < 0 || reply != SERVE_ACCEPTED) goto declined;
+
+	/* From here on the daemon owns the output; if it goes away the
+	 * command can not be run again locally without repeating it. */
+	r = serve_read_fully(fd, &status, sizeof status);
+	*result = r < 0 ? r : status;
+	close(fd);
+	close(fds[3]);
+	free(payload);
+	return 1;
+
+declined:
+	if (fd >= 0) close(fd);
+	if (fds[3] >= 0) close(fds[3]);
+	free(payload);
+	return 0;
+}
+
+static int serve_same_string(const char *a, const char *b)
+{
+	if (!a || !b) return a == b;
+	return strcmp(a, b) == 0;
+}
+
+static int serve_same_path(const char *path, const char *resolved)
+{
+	char buf[PATH_MAX];
+
+	if (!path || !resolved) return path == NULL && resolved == NULL;
+	if (!realpath(path, buf)) return 0;
+	return strcmp(buf, resolved) == 0;
+}
+
+/* The request is answered by the daemon only if opening the database with
+ * the request's options would result in the same database. */
+static int serve_compatible(struct serve_ctx *ctx, struct apk_ctx *ac, struct apk_ctx *rc)
+{
+	const unsigned int flags_mask = APK_ALLOW_UNTRUSTED | APK_NO_NETWORK | APK_NO_CACHE;
+	const unsigned int force_mask = APK_FORCE_OLD_APK | APK_FORCE_REFRESH;
+	int i;
+
+	if ((rc->flags ^ ac->flags) & flags_mask) return 0;
+	if ((rc->force ^ ac->force) & force_mask) return 0;
+	if (!serve_same_path(rc->root ?: "/", ctx->root)) return 0;
+	if (!serve_same_path(rc->repositories_file, ctx->repositories_file)) return 0;
+	if (!serve_same_string(rc->arch, ac->arch)) return 0;
+	if (!serve_same_string(rc->cache_dir ?: "etc/apk/cache", ac->cache_dir)) return 0;
+	if (!serve_same_string(rc->keys_dir ?: "etc/apk/keys", ac->keys_dir)) return 0;
+	if (rc->repository_list->num != ac->repository_list->num) return 0;
+	for (i = 0; i < rc->repository_list->num; i++)
+		if (strcmp(rc->repository_list->item[i], ac->repository_list->item[i]) != 0)
+			return 0;
+	return 1;
+}
+
+static int serve_reply(int fd, int32_t val)
+{
+	return apk_write_fully(fd, &val, sizeof val) == sizeof val ? 0 : -EIO;
+}
+
+/* Runs in the forked child: answer one request and exit. */
+static int serve_one(struct serve_ctx *ctx, struct apk_ctx *ac, int fd)
+{
+	struct apk_string_array *args;
+	struct apk_applet *applet;
+	struct apk_ctx rc;
+	void *applet_ctx = NULL;
+	char *payload, *p, *end, **argv;
+	size_t len;
+	int fds[APK_SERVE_NUM_FDS], argc, i, r;
+
+	if (!serve_peer_allowed(&ac->out, fd)) return 1;
+	if (serve_recv(fd, fds, &payload, &len) < 0) return 1;
+
+	end = payload + len;
+	for (argc = -1, p = payload; p < end; p += strlen(p) + 1) argc++;
+	if (argc < 1 || end[-1] != 0) return 1;
+	argv = calloc(argc + 1, sizeof *argv);
+	if (!argv) return 1;
+	p = payload + strlen(payload) + 1;
+	for (i = 0; i < argc; i++, p += strlen(p) + 1) argv[i] = p;
+
+	applet = apk_applet_find(payload);
+	if (!applet || !applet->remote || fchdir(fds[3]) < 0)
+		return serve_reply(fd, SERVE_DECLINED);
+
+	apk_ctx_init(&rc);
+	rc.open_flags = applet->open_flags;
+	rc.force |= applet->forced_force;
+	if (applet->context_size) applet_ctx = calloc(1, applet->context_size);
+	optind = 0;
+	r = apk_applet_parse_options(argc, argv, applet, applet_ctx, &rc);
+	if (r != 0 || !serve_applet_remote(applet, &rc) || !serve_compatible(ctx, ac, &rc))
+		return serve_reply(fd, SERVE_DECLINED);
+
+	argc -= optind;
+	argv += optind;
+	if (argc >= 1 && strcmp(argv[0], applet->name) == 0) {
+		argc--;
+		argv++;
+	}
+
+	apk_dbg(&ac->out, "Answering %s query", applet->name);
+	for (i = 0; i < 3; i++)
+		if (dup2(fds[i], i) < 0) return serve_reply(fd, SERVE_DECLINED);
+	if (serve_reply(fd, SERVE_ACCEPTED) < 0) return 1;
+
+	ac->flags = rc.flags | (ac->flags & APK_NO_CHROOT);
+	ac->force = rc.force;
+	ac->open_flags = rc.open_flags;
+	ac->out.verbosity = rc.out.verbosity;
+	ac->progress.out = NULL;
+	apk_out_reset(&ac->out);
+
+	apk_string_array_init(&args);
+	apk_string_array_resize(&args, argc);
+	memcpy(args->item, argv, argc * sizeof(*argv));
+	r = applet->main(applet_ctx, ac, args);
+	if (r == -ESHUTDOWN) r = 0;
+
+	fflush(stdout);
+	fflush(stderr);
+	serve_reply(fd, r);
+	return 0;
+}
+
+/* Reopen the database if any of the files it was read from changed. */
+static int serve_refresh(struct serve_ctx *ctx, struct apk_ctx *ac)
+{
+	struct apk_database *db = ac->db;
+	struct apk_digest stamp;
+	int r;
+
+	if (ctx->db_open) {
+		if (apk_db_state_stamp(db, &stamp) != 0 ||
+		    apk_digest_cmp(&stamp, &ctx->stamp) == 0)
+			return 0;
+		apk_msg(&ac->out, "Database changed, reopening");
+		apk_db_close(db);
+		apk_db_init(db);
+		ctx->db_open = 0;
+	}
+
+	r = apk_db_open(db, ac);
+	if (r != 0) {
+		apk_db_init(db);
+		return r;
+	}
+	ctx->db_open = 1;
+	apk_db_calc_rdepends(db);
+	return apk_db_state_stamp(db, &ctx->stamp);
+}
+
+static int serve_listen(const char *path)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	mode_t old_umask;
+	int fd, r;
+
+	strcpy(sun.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) return -errno;
+
+	/* Replace a stale socket, but not one of a running daemon. */
+	if (connect(fd, (struct sockaddr *) &sun, sizeof sun) == 0) {
+		close(fd);
+		return -EADDRINUSE;
+	}
+	unlink(path);
+
+	old_umask = umask(0077);
+	r = bind(fd, (struct sockaddr *) &sun, sizeof sun);
+	umask(old_umask);
+	if (r < 0 || listen(fd, 16) < 0) {
+		r = -errno;
+		close(fd);
+		return r;
+	}
+	return fd;
+}
+
+static int serve_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *args)
+{
+	struct serve_ctx *ctx = (struct serve_ctx *) pctx;
+	struct apk_out *out = &ac->out;
+	const char *path;
+	pid_t pid;
+	int sfd, fd, r;
+
+	if (args->num != 0) return -EINVAL;
+	path = serve_socket_path(ctx->socket);
+	if (!path) {
+		apk_err(out, "No socket path configured");
+		return -EINVAL;
+	}
+	if (!realpath(ac->root, ctx->root)) return -errno;
+	if (ac->repositories_file) {
+		ctx->repositories_file = realpath(ac->repositories_file, NULL);
+		if (!ctx->repositories_file) return -errno;
+	}
+
+	ctx->db_open = 1;
+	apk_db_calc_rdepends(ac->db);
+	r = apk_db_state_stamp(ac->db, &ctx->stamp);
+	if (r != 0) return r;
+
+	sfd = serve_listen(path);
+	if (sfd < 0) {
+		apk_err(out, "%s: %s", path, apk_error_str(sfd));
+		return sfd;
+	}
+	signal(SIGCHLD, SIG_IGN);
+	apk_msg(out, "Listening on %s", path);
+
+	for (;;) {
+		fd = accept4(sfd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			r = -errno;
+			break;
+		}
+
+		r = serve_refresh(ctx, ac);
+		if (r != 0) apk_err(out, "Failed to reopen database: %s", apk_error_str(r));
+
+		pid = ctx->db_open ? fork() : -1;
+		if (pid == 0) {
+			close(sfd);
+			signal(SIGCHLD, SIG_DFL);
+			_exit(serve_one(ctx, ac, fd));
+		}
+		if (pid < 0) serve_reply(fd, SERVE_DECLINED);
+		close(fd);
+	}
+
+	close(sfd);
+	unlink(path);
+	free(ctx->repositories_file);
+	return r;
+}
+
+static struct apk_applet apk_serve = {
+	.name = "serve",
+	.open_flags = APK_OPENF_READ,
+	.context_size = sizeof(struct serve_ctx),
+	.optgroups = { &optgroup_global, &optgroup_applet },
+	.main = serve_main,
+};
+
+APK_DEFINE_APPLET(apk_serve);
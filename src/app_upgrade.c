@@ -91,7 +91,7 @@ int apk_do_self_upgrade(struct apk_database *db, unsigned short solver_flags, un
 		struct apk_package *pkg0 = p0->pkg;
 		if (pkg0->name != name || pkg0->repos == 0)
 			continue;
-		if (apk_version_compare_blob(*pkg0->version, *pkg->version) == APK_VERSION_GREATER) {
+		if (apk_version_compare_atom(pkg0->version, pkg->version) == APK_VERSION_GREATER) {
 			r = 1;
 			break;
 		}
@@ -23,6 +23,7 @@ static int verify_main(void *ctx, struct apk_ctx *ac, struct apk_string_array *a
 	int r, rc = 0;
 
 	apk_extract_init(&ectx, ac, 0);
+	apk_extract_pipeline(&ectx);
 
 	foreach_array_item(parg, args) {
 		r = apk_extract(&ectx, apk_istream_from_file(AT_FDCWD, *parg));
@@ -136,7 +136,7 @@ static void ver_print_package_status(struct apk_database *db, const char *match,
 			continue;
 		if (!(ctx->all_tags || (pkg0->repos & allowed_repos)))
 			continue;
-		r = apk_version_compare_blob(*pkg0->version, *latest);
+		r = apk_version_compare_atom(pkg0->version, latest);
 		switch (r) {
 		case APK_VERSION_GREATER:
 			latest = pkg0->version;
@@ -147,7 +147,7 @@ static void ver_print_package_status(struct apk_database *db, const char *match,
 			break;
 		}
 	}
-	r = latest->len ? apk_version_compare_blob(*pkg->version, *latest)
+	r = latest->len ? apk_version_compare_atom(pkg->version, latest)
 			: APK_VERSION_UNKNOWN;
 	opstr = apk_version_op_string(r);
 	if ((ctx->limchars != NULL) && (strchr(ctx->limchars, *opstr) == NULL))
@@ -199,7 +199,8 @@ static int ver_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *arg
 
 static struct apk_applet apk_ver = {
 	.name = "version",
-	.open_flags = APK_OPENF_READ,
+	.open_flags = APK_OPENF_READ | APK_OPENF_LAZY_FILES,
+	.remote = 1,
 	.context_size = sizeof(struct ver_ctx),
 	.optgroups = { &optgroup_global, &optgroup_applet },
 	.main = ver_main,
@@ -8,19 +8,121 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include "apk_defines.h"
 #include "apk_applet.h"
 #include "apk_database.h"
 #include "apk_version.h"
 #include "apk_print.h"
+#include "apk_io.h"
+
+struct vertest_ctx {
+	unsigned int bench : 1;
+};
+
+#define VERTEST_OPTIONS(OPT) \
+	OPT(OPT_VERTEST_bench,	"bench")
+
+APK_OPT_APPLET(option_desc, VERTEST_OPTIONS);
+
+static int option_parse_applet(void *pctx, struct apk_ctx *ac, int opt, const char *optarg)
+{
+	struct vertest_ctx *ctx = (struct vertest_ctx *) pctx;
+
+	switch (opt) {
+	case OPT_VERTEST_bench:
+		ctx->bench = 1;
+		break;
+	default:
+		return -ENOTSUP;
+	}
+	return 0;
+}
+
+static const struct apk_option_group optgroup_applet = {
+	.desc = option_desc,
+	.parse = option_parse_applet,
+};
+
+/* Compare every pair of the versions read from stdin with both the
+ * tokenizing and the keyed comparison, report any difference, and time
+ * a round of each. */
+static int vertest_bench(struct apk_out *out)
+{
+	struct apk_atom_pool atoms;
+	struct apk_istream *is;
+	apk_blob_t line, **vers = NULL, **tmp;
+	unsigned long num = 0, max = 0, i, j, errors = 0;
+	uint64_t t0, t1, t2;
+	int fuzzy, r;
+
+	apk_atom_init(&atoms);
+	is = apk_istream_from_fd(STDIN_FILENO);
+	while (apk_istream_get_delim(is, APK_BLOB_STR("\n"), &line) == 0) {
+		if (line.len == 0) continue;
+		if (num >= max) {
+			max = max ? 2 * max : 256;
+			tmp = realloc(vers, max * sizeof *vers);
+			if (!tmp) {
+				r = -ENOMEM;
+				goto err;
+			}
+			vers = tmp;
+		}
+		vers[num++] = apk_atomize_dup(&atoms, line);
+	}
+	r = apk_istream_close(is);
+	if (r < 0) goto err;
+
+	for (i = 0; i < num; i++) {
+		for (j = 0; j < num; j++) {
+			for (fuzzy = 0; fuzzy <= 1; fuzzy++) {
+				int rb = apk_version_compare_blob_fuzzy(*vers[i], *vers[j], fuzzy);
+				int ra = apk_version_compare_atom_fuzzy(vers[i], vers[j], fuzzy);
+				if (ra == rb) continue;
+				apk_err(out, BLOB_FMT " %s " BLOB_FMT "%s, but keyed %s",
+					BLOB_PRINTF(*vers[i]), apk_version_op_string(rb),
+					BLOB_PRINTF(*vers[j]), fuzzy ? " (fuzzy)" : "",
+					apk_version_op_string(ra));
+				errors++;
+			}
+		}
+	}
+
+	t0 = apk_time_ns();
+	for (i = 0; i < num; i++)
+		for (j = 0; j < num; j++)
+			apk_version_compare_blob(*vers[i], *vers[j]);
+	t1 = apk_time_ns();
+	for (i = 0; i < num; i++)
+		for (j = 0; j < num; j++)
+			apk_version_compare_atom(vers[i], vers[j]);
+	t2 = apk_time_ns();
+
+	apk_out(out, "%-12s %12lu", "versions", num);
+	apk_out(out, "%-12s %12lu", "comparisons", num * num);
+	apk_out(out, "%-12s %12lu", "mismatches", errors);
+	apk_out(out, "%-12s %12lu", "blob_us", (unsigned long)((t1 - t0) / 1000));
+	apk_out(out, "%-12s %12lu", "key_us", (unsigned long)((t2 - t1) / 1000));
+	r = errors ? 1 : 0;
+err:
+	free(vers);
+	apk_atom_free(&atoms);
+	if (r < 0) apk_err(out, "reading versions: %s", apk_error_str(r));
+	return r ? 1 : 0;
+}
 
 static int vertest_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *args)
 {
+	struct vertest_ctx *ctx = (struct vertest_ctx *) pctx;
 	struct apk_out *out = &ac->out;
 	apk_blob_t arg, ver, op, space = APK_BLOB_STRLIT(" ");
 	char **parg;
 	int errors = 0;
 
+	if (ctx->bench) return vertest_bench(out);
+
 	foreach_array_item(parg, args) {
 		int ok = 0;
 
@@ -46,6 +148,8 @@ static int vertest_main(void *pctx, struct apk_ctx *ac, struct apk_string_array
 
 static struct apk_applet apk_vertest = {
 	.name = "vertest",
+	.context_size = sizeof(struct vertest_ctx),
+	.optgroups = { &optgroup_global, &optgroup_applet },
 	.main = vertest_main,
 };
 
@@ -7,13 +7,15 @@
  * SPDX-License-Identifier: GPL-2.0-only
  */
 
+#include <stdlib.h>
 #include "apk_atom.h"
 
 apk_blob_t apk_atom_null = APK_BLOB_NULL;
 
 struct apk_atom_hashnode {
-	struct hlist_node hash_node;
+	apk_hash_node hash_node;
 	apk_blob_t blob;
+	struct apk_version_key *version_key;
 };
 
 static apk_blob_t atom_hash_get_key(apk_hash_item item)
@@ -21,22 +23,29 @@ static apk_blob_t atom_hash_get_key(apk_hash_item item)
 	return ((struct apk_atom_hashnode *) item)->blob;
 }
 
+static void atom_hash_delete_item(apk_hash_item item)
+{
+	free(((struct apk_atom_hashnode *) item)->version_key);
+}
+
 static struct apk_hash_ops atom_ops = {
 	.node_offset = offsetof(struct apk_atom_hashnode, hash_node),
 	.get_key = atom_hash_get_key,
 	.hash_key = apk_blob_hash,
 	.compare = apk_blob_compare,
-	.delete_item = (apk_hash_delete_f) free,
+	.delete_item = atom_hash_delete_item,
 };
 
 void apk_atom_init(struct apk_atom_pool *atoms)
 {
-	apk_hash_init(&atoms->hash, &atom_ops, 10000);
+	apk_balloc_init(&atoms->ba, 64*1024);
+	apk_hash_init(&atoms->hash, &atom_ops, 1000);
 }
 
 void apk_atom_free(struct apk_atom_pool *atoms)
 {
 	apk_hash_free(&atoms->hash);
+	apk_balloc_destroy(&atoms->ba);
 }
 
 apk_blob_t *apk_atom_get(struct apk_atom_pool *atoms, apk_blob_t blob, int duplicate)
@@ -51,14 +60,20 @@ apk_blob_t *apk_atom_get(struct apk_atom_pool *atoms, apk_blob_t blob, int dupli
 
 	if (duplicate) {
 		char *ptr;
-		atom = malloc(sizeof(*atom) + blob.len);
+		atom = apk_balloc_new_extra(&atoms->ba, struct apk_atom_hashnode, blob.len);
 		ptr = (char*) (atom + 1);
 		memcpy(ptr, blob.ptr, blob.len);
 		atom->blob = APK_BLOB_PTR_LEN(ptr, blob.len);
 	} else {
-		atom = malloc(sizeof(*atom));
+		atom = apk_balloc_new(&atoms->ba, struct apk_atom_hashnode);
 		atom->blob = blob;
 	}
+	atom->version_key = NULL;
 	apk_hash_insert_hashed(&atoms->hash, atom, hash);
 	return &atom->blob;
 }
+
+struct apk_version_key **apk_atom_version_key(apk_blob_t *atom)
+{
+	return &container_of(atom, struct apk_atom_hashnode, blob)->version_key;
+}
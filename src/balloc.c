@@ -0,0 +1,57 @@
+/* balloc.c - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "apk_balloc.h"
+
+struct apk_balloc_page {
+	struct hlist_node pages_list;
+};
+
+void apk_balloc_init(struct apk_balloc *ba, size_t page_size)
+{
+	*ba = (struct apk_balloc) { .page_size = page_size };
+}
+
+void apk_balloc_destroy(struct apk_balloc *ba)
+{
+	struct apk_balloc_page *p;
+	struct hlist_node *pc, *pn;
+
+	hlist_for_each_entry_safe(p, pc, pn, &ba->pages_head, pages_list)
+		free(p);
+	apk_balloc_init(ba, ba->page_size);
+}
+
+void *apk_balloc_aligned(struct apk_balloc *ba, size_t size, size_t align)
+{
+	uintptr_t ptr = ROUND_UP(ba->cur, align);
+
+	if (!ba->cur || ptr + size > ba->end) {
+		size_t page_size = max(ba->page_size, sizeof(struct apk_balloc_page) + align + size);
+		struct apk_balloc_page *bp = malloc(page_size);
+		if (!bp) return NULL;
+		hlist_add_head(&bp->pages_list, &ba->pages_head);
+		ba->cur = (uintptr_t)bp + sizeof *bp;
+		ba->end = (uintptr_t)bp + page_size;
+		ba->bytes_reserved += page_size;
+		ptr = ROUND_UP(ba->cur, align);
+	}
+	ba->cur = ptr + size;
+	ba->num_allocs++;
+	ba->bytes_used += size;
+	return (void *) ptr;
+}
+
+void *apk_balloc_aligned0(struct apk_balloc *ba, size_t size, size_t align)
+{
+	void *ptr = apk_balloc_aligned(ba, size, align);
+	if (ptr) memset(ptr, 0, size);
+	return ptr;
+}
@@ -194,13 +194,19 @@ static int cmp_upgrade(struct apk_change *change)
 	return 0;
 }
 
-static void run_triggers(struct apk_database *db, struct apk_changeset *changeset)
+static int run_triggers(struct apk_database *db, struct apk_changeset *changeset)
 {
 	struct apk_change *change;
 	struct apk_installed_package *ipkg;
+	int r;
 
-	if (apk_db_fire_triggers(db) == 0)
-		return;
+	r = apk_db_fire_triggers(db);
+	if (r < 0) {
+		apk_err(&db->ctx->out, "Unable to match triggers: %s", apk_error_str(r));
+		return 1;
+	}
+	if (r == 0)
+		return 0;
 
 	foreach_array_item(change, changeset->changes) {
 		struct apk_package *pkg = change->new_pkg;
@@ -215,6 +221,7 @@ static void run_triggers(struct apk_database *db, struct apk_changeset *changese
 				    ipkg->pending_triggers->item);
 		apk_string_array_free(&ipkg->pending_triggers);
 	}
+	return 0;
 }
 
 #define PRE_COMMIT_HOOK		0
@@ -256,6 +263,16 @@ static int run_commit_hooks(struct apk_database *db, int type)
 				    run_commit_hook, &hook);
 }
 
+static int timing_begin_change(struct apk_database *db, struct apk_change *change)
+{
+	struct apk_package *pkg = change->new_pkg ?: change->old_pkg;
+	char name[256];
+
+	if (!(db->ctx->flags & APK_TIMINGS)) return -1;
+	snprintf(name, sizeof name, PKG_VER_FMT, PKG_VER_PRINTF(pkg));
+	return apk_timing_begin(db->ctx, "package", name);
+}
+
 int apk_solver_commit_changeset(struct apk_database *db,
 				struct apk_changeset *changeset,
 				struct apk_dependency_array *world)
@@ -266,7 +283,7 @@ int apk_solver_commit_changeset(struct apk_database *db,
 	char buf[32];
 	const char *size_unit;
 	off_t humanized, size_diff = 0, download_size = 0;
-	int r, errors = 0;
+	int r, errors = 0, timing;
 
 	assert(world);
 	if (apk_db_check_world(db, world) != 0) {
@@ -326,7 +343,10 @@ int apk_solver_commit_changeset(struct apk_database *db,
 		}
 	}
 
-	if (run_commit_hooks(db, PRE_COMMIT_HOOK) == -2)
+	timing = apk_timing_begin(db->ctx, "pre-commit", NULL);
+	r = run_commit_hooks(db, PRE_COMMIT_HOOK);
+	apk_timing_end(db->ctx, timing, 0);
+	if (r == -2)
 		return -1;
 
 	/* Go through changes */
@@ -341,11 +361,16 @@ int apk_solver_commit_changeset(struct apk_database *db,
 			if (!(db->ctx->flags & APK_SIMULATE) &&
 			    ((change->old_pkg != change->new_pkg) ||
 			     (change->reinstall && pkg_available(db, change->new_pkg)))) {
+				timing = timing_begin_change(db, change);
 				r = apk_db_install_pkg(db, change->old_pkg, change->new_pkg,
 						       progress_cb, &prog) != 0;
+				apk_timing_end(db->ctx, timing, change->new_pkg ? change->new_pkg->size : 0);
 			}
-			if (r == 0 && change->new_pkg && change->new_pkg->ipkg)
+			if (r == 0 && change->new_pkg && change->new_pkg->ipkg &&
+			    change->new_pkg->ipkg->repository_tag != change->new_repository_tag) {
 				change->new_pkg->ipkg->repository_tag = change->new_repository_tag;
+				change->new_pkg->ipkg->db_dirty = 1;
+			}
 		}
 		errors += r;
 		count_change(change, &prog.done);
@@ -354,12 +379,16 @@ int apk_solver_commit_changeset(struct apk_database *db,
 			   prog.total.bytes + prog.total.packages);
 
 	apk_db_update_directory_permissions(db);
-	run_triggers(db, changeset);
+	timing = apk_timing_begin(db->ctx, "triggers", NULL);
+	errors += run_triggers(db, changeset);
+	apk_timing_end(db->ctx, timing, 0);
 
 all_done:
 	apk_dependency_array_copy(&db->world, world);
 	if (apk_db_write_config(db) != 0) errors++;
+	timing = apk_timing_begin(db->ctx, "post-commit", NULL);
 	run_commit_hooks(db, POST_COMMIT_HOOK);
+	apk_timing_end(db->ctx, timing, 0);
 
 	if (!db->performing_self_upgrade) {
 		if (errors)
@@ -692,8 +721,10 @@ int apk_solver_commit(struct apk_database *db,
 	r = apk_solver_solve(db, solver_flags, world, &changeset);
 	if (r == 0)
 		r = apk_solver_commit_changeset(db, &changeset, world);
-	else
+	else if (r > 0)
 		apk_solver_print_errors(db, &changeset, world);
+	else
+		apk_err(out, "Unable to solve dependencies: %s", apk_error_str(r));
 
 	apk_change_array_free(&changeset.changes);
 	return r;
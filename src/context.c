@@ -8,6 +8,10 @@
  */
 
 #include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include "apk_context.h"
@@ -21,11 +25,118 @@ void apk_ctx_init(struct apk_ctx *ac)
 	ac->out.out = stdout;
 	ac->out.err = stderr;
 	ac->out.verbosity = 1;
+	ac->num_cpus = max(sysconf(_SC_NPROCESSORS_ONLN), 1);
 	apk_digest_ctx_init(&ac->dctx, APK_DIGEST_SHA256);
+	apk_timing_array_init(&ac->timings);
+}
+
+static void apk_ctx_write_timings(struct apk_ctx *ac)
+{
+	struct apk_out *out = &ac->out;
+	struct apk_ostream *os;
+	struct apk_timing *t;
+	char buf[PATH_MAX + 128];
+	int n;
+
+	if (ac->timings_file) {
+		os = apk_ostream_to_file(AT_FDCWD, ac->timings_file, 0644);
+		if (IS_ERR(os)) {
+			apk_err(out, "%s: %s", ac->timings_file, apk_error_str(PTR_ERR(os)));
+			return;
+		}
+		foreach_array_item(t, ac->timings) {
+			n = snprintf(buf, sizeof buf, "%s\t%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n",
+				t->phase, t->name ?: "", t->start / 1000, t->duration / 1000, t->bytes);
+			if (n > 0) apk_ostream_write(os, buf, min(n, (int) sizeof buf - 1));
+		}
+		n = apk_ostream_close(os);
+		if (n < 0) apk_err(out, "%s: %s", ac->timings_file, apk_error_str(n));
+		return;
+	}
+
+	apk_out_fmt(out, "", "%-14s %10s %10s %12s %s", "phase", "start-ms", "time-ms", "bytes", "name");
+	foreach_array_item(t, ac->timings)
+		apk_out_fmt(out, "", "%-14s %10.3f %10.3f %12" PRIu64 " %s",
+			    t->phase, t->start / 1e6, t->duration / 1e6, t->bytes, t->name ?: "");
+}
+
+static const struct {
+	const char *name;
+	size_t offset;
+} solver_counters[] = {
+#define COUNTER(x) { #x, offsetof(struct apk_solver_stats, x) }
+	COUNTER(solves),
+	COUNTER(restarts),
+	COUNTER(names_discovered),
+	COUNTER(max_dep_chain),
+	COUNTER(reconsider_name),
+	COUNTER(compare_providers),
+	COUNTER(select_package),
+	COUNTER(dirty_queued),
+	COUNTER(dirty_requeued),
+	COUNTER(disqualify_package),
+#undef COUNTER
+}, solver_phases[] = {
+#define PHASE(x) { #x, offsetof(struct apk_solver_stats, x##_ns) }
+	PHASE(discover),
+	PHASE(apply),
+	PHASE(resolve),
+	PHASE(changeset),
+#undef PHASE
+};
+
+#define solver_counter(st, i) (*(unsigned long *)((char *)(st) + solver_counters[i].offset))
+#define solver_phase(st, i) (*(uint64_t *)((char *)(st) + solver_phases[i].offset))
+
+static void apk_ctx_write_solver_stats(struct apk_ctx *ac)
+{
+	struct apk_out *out = &ac->out;
+	struct apk_solver_stats *st = &ac->solver_stats;
+	struct apk_ostream *os;
+	char buf[128];
+	size_t i;
+	int n;
+
+	if (ac->solver_stats_file) {
+		os = apk_ostream_to_file(AT_FDCWD, ac->solver_stats_file, 0644);
+		if (IS_ERR(os)) {
+			apk_err(out, "%s: %s", ac->solver_stats_file, apk_error_str(PTR_ERR(os)));
+			return;
+		}
+		apk_ostream_write(os, "{\n", 2);
+		for (i = 0; i < ARRAY_SIZE(solver_counters); i++) {
+			n = snprintf(buf, sizeof buf, "\t\"%s\": %lu,\n",
+				solver_counters[i].name, solver_counter(st, i));
+			apk_ostream_write(os, buf, n);
+		}
+		for (i = 0; i < ARRAY_SIZE(solver_phases); i++) {
+			n = snprintf(buf, sizeof buf, "\t\"%s_ms\": %.3f%s\n",
+				solver_phases[i].name, solver_phase(st, i) / 1e6,
+				i + 1 < ARRAY_SIZE(solver_phases) ? "," : "");
+			apk_ostream_write(os, buf, n);
+		}
+		apk_ostream_write(os, "}\n", 2);
+		n = apk_ostream_close(os);
+		if (n < 0) apk_err(out, "%s: %s", ac->solver_stats_file, apk_error_str(n));
+		return;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(solver_counters); i++)
+		apk_out_fmt(out, "", "%-20s %12lu", solver_counters[i].name, solver_counter(st, i));
+	for (i = 0; i < ARRAY_SIZE(solver_phases); i++) {
+		snprintf(buf, sizeof buf, "%s_ms", solver_phases[i].name);
+		apk_out_fmt(out, "", "%-20s %12.3f", buf, solver_phase(st, i) / 1e6);
+	}
 }
 
 void apk_ctx_free(struct apk_ctx *ac)
 {
+	struct apk_timing *t;
+
+	if (ac->flags & APK_TIMINGS) apk_ctx_write_timings(ac);
+	if (ac->flags & APK_SOLVER_STATS) apk_ctx_write_solver_stats(ac);
+	foreach_array_item(t, ac->timings) free(t->name);
+	apk_timing_array_free(&ac->timings);
 	apk_id_cache_free(&ac->id_cache);
 	apk_trust_free(&ac->trust);
 	apk_string_array_free(&ac->repository_list);
@@ -44,6 +155,9 @@ int apk_ctx_prepare(struct apk_ctx *ac)
 	if (!ac->keys_dir) ac->keys_dir = "etc/apk/keys";
 	if (!ac->root) ac->root = "/";
 	if (!ac->cache_max_age) ac->cache_max_age = 4*60*60; /* 4 hours default */
+	if (ac->timings_file) ac->flags |= APK_TIMINGS;
+	if (ac->solver_stats_file) ac->flags |= APK_SOLVER_STATS;
+	if (ac->flags & APK_TIMINGS) ac->timings_origin = apk_time_ns();
 
 	if (!strcmp(ac->root, "/")) {
 		// No chroot needed if using system root
@@ -103,3 +217,45 @@ struct apk_id_cache *apk_ctx_get_id_cache(struct apk_ctx *ac)
 		apk_id_cache_init(&ac->id_cache, apk_ctx_fd_root(ac));
 	return &ac->id_cache;
 }
+
+uint64_t apk_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int apk_timing_begin(struct apk_ctx *ac, const char *phase, const char *name)
+{
+	if (!(ac->flags & APK_TIMINGS)) return -1;
+	*apk_timing_array_add(&ac->timings) = (struct apk_timing) {
+		.phase = phase,
+		.name = name ? strdup(name) : NULL,
+		.start = apk_time_ns() - ac->timings_origin,
+	};
+	return ac->timings->num - 1;
+}
+
+void apk_timing_end(struct apk_ctx *ac, int id, uint64_t bytes)
+{
+	struct apk_timing *t;
+
+	if (id < 0) return;
+	t = &ac->timings->item[id];
+	t->duration = apk_time_ns() - ac->timings_origin - t->start;
+	t->bytes = bytes;
+}
+
+void apk_timing_add(struct apk_ctx *ac, const char *phase, const char *name,
+		    uint64_t start, uint64_t end, uint64_t bytes)
+{
+	if (!(ac->flags & APK_TIMINGS)) return;
+	*apk_timing_array_add(&ac->timings) = (struct apk_timing) {
+		.phase = phase,
+		.name = name ? strdup(name) : NULL,
+		.start = start - ac->timings_origin,
+		.duration = end - start,
+		.bytes = bytes,
+	};
+}
@@ -16,6 +16,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <pthread.h>
 #include <fnmatch.h>
 #include <sys/file.h>
 #include <sys/wait.h>
@@ -32,6 +33,7 @@
 #include "apk_defines.h"
 #include "apk_package.h"
 #include "apk_database.h"
+#include "apk_delta.h"
 #include "apk_applet.h"
 #include "apk_extract.h"
 #include "apk_print.h"
@@ -56,9 +58,12 @@ static const char * const apk_static_cache_dir = "var/cache/apk";
 static const char * const apk_world_file = "etc/apk/world";
 static const char * const apk_arch_file = "etc/apk/arch";
 static const char * const apk_lock_file = "lib/apk/db/lock";
+static const char * const apk_state_lock_file = "lib/apk/db/state.lock";
 static const char * const apk_scripts_file = "lib/apk/db/scripts.tar";
 static const char * const apk_triggers_file = "lib/apk/db/triggers";
 const char * const apk_installed_file = "lib/apk/db/installed";
+static const char * const apk_installed_snapshot_file = "lib/apk/db/installed.adb";
+static const char * const apk_installed_journal_file = "lib/apk/db/installed.journal";
 
 static struct apk_db_acl *apk_default_acl_dir, *apk_default_acl_file;
 
@@ -145,7 +150,6 @@ static const struct apk_hash_ops dir_hash_ops = {
 	.get_key = apk_db_dir_get_key,
 	.hash_key = apk_blob_hash,
 	.compare = apk_blob_compare,
-	.delete_item = (apk_hash_delete_f) free,
 };
 
 struct apk_db_file_hash_key {
@@ -190,7 +194,6 @@ static const struct apk_hash_ops file_hash_ops = {
 	.hash_key = apk_db_file_hash_key,
 	.hash_item = apk_db_file_hash_item,
 	.compare_item = apk_db_file_compare_item,
-	.delete_item = (apk_hash_delete_f) free,
 };
 
 struct apk_name *apk_db_query_name(struct apk_database *db, apk_blob_t name)
@@ -301,11 +304,19 @@ struct apk_db_dir *apk_db_dir_query(struct apk_database *db,
 	return (struct apk_db_dir *) apk_hash_get(&db->installed.dirs, name);
 }
 
+static inline int protected_path_match(struct apk_protected_path *ppath, const char *name)
+{
+	if (ppath->wildcard) return fnmatch(ppath->component, name, FNM_PATHNAME) == 0;
+	return strcmp(ppath->component, name) == 0;
+}
+
 struct apk_db_dir *apk_db_dir_get(struct apk_database *db, apk_blob_t name)
 {
 	struct apk_db_dir *dir;
 	struct apk_protected_path_array *ppaths;
-	struct apk_protected_path *ppath;
+	struct apk_protected_path **pparent, *ppath;
+	struct apk_protected_path *root = db->protected_paths;
+	unsigned int rule = 0;
 	apk_blob_t bparent;
 	unsigned long hash = apk_hash_from_key(&db->installed.dirs, name);
 	char *relative_name;
@@ -315,7 +326,7 @@ struct apk_db_dir *apk_db_dir_get(struct apk_database *db, apk_blob_t name)
 	dir = (struct apk_db_dir *) apk_hash_get_hashed(&db->installed.dirs, name, hash);
 	if (dir != NULL && dir->refs) return apk_db_dir_ref(dir);
 	if (dir == NULL) {
-		dir = calloc(1, sizeof(*dir) + name.len + 1);
+		dir = apk_balloc_new0_extra(&db->ba_dirs, struct apk_db_dir, name.len + 1);
 		dir->rooted_name[0] = '/';
 		memcpy(dir->name, name.ptr, name.len);
 		dir->name[name.len] = 0;
@@ -333,47 +344,51 @@ struct apk_db_dir *apk_db_dir_get(struct apk_database *db, apk_blob_t name)
 	if (name.len == 0) {
 		dir->parent = NULL;
 		dir->has_protected_children = 1;
-		ppaths = NULL;
+		*apk_protected_path_array_add(&dir->protected_paths) = root;
+		return dir;
 	} else if (apk_blob_rsplit(name, '/', &bparent, NULL)) {
 		dir->parent = apk_db_dir_get(db, bparent);
 		dir->protect_mode = dir->parent->protect_mode;
 		dir->has_protected_children = (dir->protect_mode != APK_PROTECT_NONE);
-		ppaths = dir->parent->protected_paths;
+		relative_name = dir->name + bparent.len + 1;
 	} else {
 		dir->parent = apk_db_dir_get(db, APK_BLOB_NULL);
-		ppaths = db->protected_paths;
+		relative_name = dir->name;
 	}
-
-	if (ppaths == NULL)
-		return dir;
-
-	relative_name = strrchr(dir->rooted_name, '/') + 1;
-	foreach_array_item(ppath, ppaths) {
-		char *slash = strchr(ppath->relative_pattern, '/');
-		if (slash != NULL) {
-			*slash = 0;
-			if (fnmatch(ppath->relative_pattern, relative_name, FNM_PATHNAME) != 0) {
-				*slash = '/';
-				continue;
+	ppaths = dir->parent->protected_paths;
+
+	foreach_array_item(pparent, ppaths) {
+		for (ppath = (*pparent)->children; ppath; ppath = ppath->next) {
+			if (!protected_path_match(ppath, relative_name)) continue;
+			if (ppath->children)
+				*apk_protected_path_array_add(&dir->protected_paths) = ppath;
+			if (ppath->rule > rule) {
+				rule = ppath->rule;
+				dir->protect_mode = ppath->protect_mode;
 			}
-			*slash = '/';
-
-			*apk_protected_path_array_add(&dir->protected_paths) = (struct apk_protected_path) {
-				.relative_pattern = slash + 1,
-				.protect_mode = ppath->protect_mode,
-			};
-		} else {
-			if (fnmatch(ppath->relative_pattern, relative_name, FNM_PATHNAME) != 0)
-				continue;
-
-			dir->protect_mode = ppath->protect_mode;
+			dir->has_protected_children |= ppath->has_protected;
 		}
-		dir->has_protected_children |= (ppath->protect_mode != APK_PROTECT_NONE);
 	}
 
 	return dir;
 }
 
+int apk_db_dir_protect_mode(struct apk_db_dir *dir, const char *name)
+{
+	struct apk_protected_path **pparent, *ppath;
+	unsigned int rule = 0;
+	int protect_mode = dir->protect_mode;
+
+	foreach_array_item(pparent, dir->protected_paths) {
+		for (ppath = (*pparent)->children; ppath; ppath = ppath->next) {
+			if (ppath->rule <= rule || !protected_path_match(ppath, name)) continue;
+			rule = ppath->rule;
+			protect_mode = ppath->protect_mode;
+		}
+	}
+	return protect_mode;
+}
+
 static struct apk_db_dir_instance *apk_db_diri_new(struct apk_database *db,
 						   struct apk_package *pkg,
 						   apk_blob_t name,
@@ -381,7 +396,7 @@ static struct apk_db_dir_instance *apk_db_diri_new(struct apk_database *db,
 {
 	struct apk_db_dir_instance *diri;
 
-	diri = calloc(1, sizeof(struct apk_db_dir_instance));
+	diri = apk_balloc_new0(&db->ba_diris, struct apk_db_dir_instance);
 	if (diri != NULL) {
 		hlist_add_after(&diri->pkg_dirs_list, *after);
 		*after = &diri->pkg_dirs_list.next;
@@ -423,34 +438,16 @@ static void apk_db_diri_free(struct apk_database *db,
 		apk_db_dir_prepare(db, diri->dir, 0);
 
 	apk_db_dir_unref(db, dir, rmdir_mode);
-	free(diri);
-}
-
-struct apk_db_file *apk_db_file_query(struct apk_database *db,
-				      apk_blob_t dir,
-				      apk_blob_t name)
-{
-	struct apk_db_file_hash_key key;
-
-	if (dir.len && dir.ptr[dir.len-1] == '/')
-		dir.len--;
-
-	key = (struct apk_db_file_hash_key) {
-		.dirname = dir,
-		.filename = name,
-	};
-
-	return (struct apk_db_file *) apk_hash_get(&db->installed.files,
-						   APK_BLOB_BUF(&key));
 }
 
-static struct apk_db_file *apk_db_file_new(struct apk_db_dir_instance *diri,
+static struct apk_db_file *apk_db_file_new(struct apk_database *db,
+					   struct apk_db_dir_instance *diri,
 					   apk_blob_t name,
 					   struct hlist_node ***after)
 {
 	struct apk_db_file *file;
 
-	file = malloc(sizeof(*file) + name.len + 1);
+	file = apk_balloc_new_extra(&db->ba_files, struct apk_db_file, name.len + 1);
 	if (file == NULL)
 		return NULL;
 
@@ -488,7 +485,7 @@ static struct apk_db_file *apk_db_file_get(struct apk_database *db,
 	if (file != NULL)
 		return file;
 
-	file = apk_db_file_new(diri, name, after);
+	file = apk_db_file_new(db, diri, name, after);
 	apk_hash_insert_hashed(&db->installed.files, file, hash);
 	db->installed.stats.files++;
 
@@ -525,6 +522,16 @@ static inline void add_provider(struct apk_name *name, struct apk_provider p)
 	*apk_provider_array_add(&name->providers) = p;
 }
 
+static void del_provider(struct apk_name *name, struct apk_package *pkg)
+{
+	struct apk_provider *p;
+	size_t n = 0;
+
+	foreach_array_item(p, name->providers)
+		if (p->pkg != pkg) name->providers->item[n++] = *p;
+	apk_provider_array_resize(&name->providers, n);
+}
+
 struct apk_package *apk_db_pkg_add(struct apk_database *db, struct apk_package *pkg)
 {
 	struct apk_package *idb;
@@ -544,8 +551,10 @@ struct apk_package *apk_db_pkg_add(struct apk_database *db, struct apk_package *
 		add_provider(pkg->name, APK_PROVIDER_FROM_PACKAGE(pkg));
 		foreach_array_item(dep, pkg->provides)
 			add_provider(dep->name, APK_PROVIDER_FROM_PROVIDES(pkg, dep));
-		if (db->open_complete)
+		if (db->open_complete) {
+			apk_db_calc_rdepends(db);
 			apk_db_pkg_rdepends(db, pkg);
+		}
 	} else {
 		idb->repos |= pkg->repos;
 		if (idb->filename == NULL && pkg->filename != NULL) {
@@ -562,6 +571,18 @@ struct apk_package *apk_db_pkg_add(struct apk_database *db, struct apk_package *
 	return idb;
 }
 
+/* Remove a package not available from any source, used when the installed
+ * database journal removes a package loaded from the installed database */
+static void apk_db_pkg_del(struct apk_database *db, struct apk_package *pkg)
+{
+	struct apk_dependency *dep;
+
+	del_provider(pkg->name, pkg);
+	foreach_array_item(dep, pkg->provides)
+		del_provider(dep->name, pkg);
+	apk_hash_delete(&db->available.packages, APK_BLOB_CSUM(pkg->csum));
+}
+
 static int apk_pkg_format_cache_pkg(apk_blob_t to, struct apk_package *pkg)
 {
 	/* pkgname-1.0_alpha1.12345678.apk */
@@ -578,18 +599,29 @@ static int apk_pkg_format_cache_pkg(apk_blob_t to, struct apk_package *pkg)
 	return 0;
 }
 
-int apk_repo_format_cache_index(apk_blob_t to, struct apk_repository *repo)
+static int format_cache_item(apk_blob_t to, struct apk_repository *repo, const char *suffix)
 {
-	/* APKINDEX.12345678.tar.gz */
 	apk_blob_push_blob(&to, APK_BLOB_STR("APKINDEX."));
 	apk_blob_push_hexdump(&to, APK_BLOB_PTR_LEN((char *) repo->csum.data, APK_CACHE_CSUM_BYTES));
-	apk_blob_push_blob(&to, APK_BLOB_STR(".tar.gz"));
+	apk_blob_push_blob(&to, APK_BLOB_STR(suffix));
 	apk_blob_push_blob(&to, APK_BLOB_PTR_LEN("", 1));
 	if (APK_BLOB_IS_NULL(to))
 		return -ENOBUFS;
 	return 0;
 }
 
+int apk_repo_format_cache_index(apk_blob_t to, struct apk_repository *repo)
+{
+	/* APKINDEX.12345678.tar.gz */
+	return format_cache_item(to, repo, ".tar.gz");
+}
+
+int apk_repo_format_cache_digest(apk_blob_t to, struct apk_repository *repo)
+{
+	/* APKINDEX.12345678.adb */
+	return format_cache_item(to, repo, ".adb");
+}
+
 int apk_repo_format_real_url(apk_blob_t *default_arch, struct apk_repository *repo,
 			     struct apk_package *pkg, char *buf, size_t len,
 			     struct apk_url_print *urlp)
@@ -627,6 +659,65 @@ int apk_repo_format_item(struct apk_database *db, struct apk_repository *repo, s
 	}
 }
 
+/* Update the cached index with a delta published next to it. The rebuilt
+ * index is verified as a downloaded one would be before it replaces the
+ * cached copy, and gets the timestamps of the index it replaces. */
+static int apk_cache_download_delta(struct apk_database *db, const char *url,
+				    const char *cacheitem, const struct apk_file_meta *meta)
+{
+	struct apk_extract_ctx ectx;
+	struct apk_istream *is, bis;
+	struct apk_ostream *os;
+	apk_blob_t base, target = APK_BLOB_NULL;
+	char delta_url[PATH_MAX], name[64];
+	const char *slash;
+	int r;
+
+	base = apk_blob_from_file(db->cache_fd, cacheitem);
+	if (APK_BLOB_IS_NULL(base)) return -ENOENT;
+
+	r = apk_delta_format_name(APK_BLOB_BUF(name), base);
+	if (r < 0) goto err;
+	r = -ENAMETOOLONG;
+	slash = strrchr(url, '/');
+	if (!slash || snprintf(delta_url, sizeof delta_url, "%.*s/%s",
+			       (int)(slash - url), url, name) >= sizeof delta_url)
+		goto err;
+
+	is = apk_istream_from_url(delta_url, 0);
+	if (IS_ERR(is)) {
+		r = PTR_ERR(is);
+		goto err;
+	}
+	r = apk_delta_apply(base, is, &target);
+	if (r < 0) goto err;
+
+	apk_extract_init(&ectx, db->ctx, 0);
+	r = apk_extract(&ectx, apk_istream_from_blob(&bis, target));
+	if (r < 0) goto err;
+
+	os = apk_ostream_to_file(db->cache_fd, cacheitem, 0644);
+	if (IS_ERR(os)) {
+		r = PTR_ERR(os);
+		goto err;
+	}
+	apk_ostream_write(os, target.ptr, target.len);
+	r = apk_ostream_close(os);
+	if (r == 0 && meta) {
+		struct timespec times[2] = {
+			{ .tv_sec = meta->atime },
+			{ .tv_sec = meta->mtime },
+		};
+		utimensat(db->cache_fd, cacheitem, times, 0);
+	}
+err:
+	if (r < 0 && r != -ENOENT)
+		apk_dbg(&db->ctx->out, "%s: delta not used: %s", url, apk_error_str(r));
+	free(base.ptr);
+	free(target.ptr);
+	return r;
+}
+
 int apk_cache_download(struct apk_database *db, struct apk_repository *repo,
 		       struct apk_package *pkg, int autoupdate,
 		       apk_progress_cb cb, void *cb_ctx)
@@ -637,9 +728,10 @@ int apk_cache_download(struct apk_database *db, struct apk_repository *repo,
 	struct apk_istream *is;
 	struct apk_ostream *os;
 	struct apk_extract_ctx ectx;
+	struct apk_file_meta meta;
 	char url[PATH_MAX];
-	char cacheitem[128];
-	int r;
+	char cacheitem[128], digest[128];
+	int r, timing;
 	time_t now = time(NULL);
 
 	if (pkg != NULL)
@@ -660,16 +752,43 @@ int apk_cache_download(struct apk_database *db, struct apk_repository *repo,
 
 	if (db->ctx->flags & APK_SIMULATE) return 0;
 
-	os = apk_ostream_to_file(db->cache_fd, cacheitem, 0644);
-	if (IS_ERR(os)) return PTR_ERR(os);
+	if (pkg == NULL && apk_repo_format_cache_digest(APK_BLOB_BUF(digest), repo) == 0)
+		unlinkat(db->cache_fd, digest, 0);
 
 	if (cb) cb(cb_ctx, 0);
 
+	timing = -1;
+	if (db->ctx->flags & APK_TIMINGS) {
+		char name[PATH_MAX];
+		snprintf(name, sizeof name, URL_FMT, URL_PRINTF(urlp));
+		timing = apk_timing_begin(db->ctx, "download", name);
+	}
+
 	is = apk_istream_from_url(url, apk_db_url_since(db, st.st_mtime));
+	/* A delta is asked for only once the index is known to have changed:
+	 * it was not answered as unmodified, and it is newer than the cached
+	 * copy. The full download stays open as the fallback. */
+	if (pkg == NULL && !IS_ERR(is)) {
+		apk_istream_get_meta(is, &meta);
+		if (fstatat(db->cache_fd, cacheitem, &st, 0) == 0 &&
+		    (!meta.mtime || meta.mtime > st.st_mtime) &&
+		    apk_cache_download_delta(db, url, cacheitem, autoupdate ? NULL : &meta) == 0) {
+			apk_istream_close(is);
+			r = 0;
+			goto done;
+		}
+	}
+
+	os = apk_ostream_to_file(db->cache_fd, cacheitem, 0644);
 	is = apk_istream_tee(is, os, autoupdate ? 0 : APK_ISTREAM_TEE_COPY_META, cb, cb_ctx);
 	apk_extract_init(&ectx, db->ctx, 0);
 	if (pkg) apk_extract_verify_identity(&ectx, &pkg->csum);
 	r = apk_extract(&ectx, is);
+done:
+	if (timing >= 0) {
+		if (fstatat(db->cache_fd, cacheitem, &st, 0) != 0) st.st_size = 0;
+		apk_timing_end(db->ctx, timing, st.st_size);
+	}
 	if (r == -EALREADY) {
 		if (autoupdate) utimensat(db->cache_fd, cacheitem, NULL, 0);
 		return r;
@@ -747,21 +866,84 @@ err:
 	return apk_istream_close(is);
 }
 
-int apk_db_index_read(struct apk_database *db, struct apk_istream *is, int repo)
+struct fdb_files_ctx {
+	struct apk_package *pkg;
+	struct apk_db_dir_instance *diri;
+	struct apk_db_file *file;
+	struct hlist_node **diri_node;
+	struct hlist_node **file_diri_node;
+};
+
+static inline int fdb_files_field(int field)
+{
+	return field == 'F' || field == 'a' || field == 'M' || field == 'R' || field == 'Z';
+}
+
+/* Returns 1 if the field is not part of the file list */
+static int apk_db_fdb_read_files(struct apk_database *db, struct fdb_files_ctx *ctx,
+				 int field, apk_blob_t l)
 {
-	struct apk_out *out = &db->ctx->out;
-	struct apk_package *pkg = NULL;
-	struct apk_installed_package *ipkg = NULL;
-	struct apk_db_dir_instance *diri = NULL;
-	struct apk_db_file *file = NULL;
 	struct apk_db_acl *acl;
-	struct hlist_node **diri_node = NULL;
-	struct hlist_node **file_diri_node = NULL;
 	struct apk_checksum xattr_csum;
-	apk_blob_t token = APK_BLOB_STR("\n"), l;
 	mode_t mode;
 	uid_t uid;
 	gid_t gid;
+
+	switch (field) {
+	case 'F':
+		if (ctx->diri) apk_db_dir_apply_diri_permissions(ctx->diri);
+		if (ctx->pkg->name == NULL) return -APKE_V2DB_FORMAT;
+		ctx->diri = find_diri(ctx->pkg->ipkg, l, NULL, &ctx->diri_node);
+		if (!ctx->diri) ctx->diri = apk_db_diri_new(db, ctx->pkg, l, &ctx->diri_node);
+		ctx->file_diri_node = hlist_tail_ptr(&ctx->diri->owned_files);
+		break;
+	case 'a':
+		if (ctx->file == NULL) return -APKE_V2DB_FORMAT;
+	case 'M':
+		if (ctx->diri == NULL) return -APKE_V2DB_FORMAT;
+		uid = apk_blob_pull_uint(&l, 10);
+		apk_blob_pull_char(&l, ':');
+		gid = apk_blob_pull_uint(&l, 10);
+		apk_blob_pull_char(&l, ':');
+		mode = apk_blob_pull_uint(&l, 8);
+		if (apk_blob_pull_blob_match(&l, APK_BLOB_STR(":")))
+			apk_blob_pull_csum(&l, &xattr_csum);
+		else
+			xattr_csum.type = APK_CHECKSUM_NONE;
+
+		acl = apk_db_acl_atomize_csum(db, mode, uid, gid, &xattr_csum);
+		if (field == 'M')
+			ctx->diri->acl = acl;
+		else
+			ctx->file->acl = acl;
+		break;
+	case 'R':
+		if (ctx->diri == NULL) return -APKE_V2DB_FORMAT;
+		ctx->file = apk_db_file_get(db, ctx->diri, l, &ctx->file_diri_node);
+		break;
+	case 'Z':
+		if (ctx->file == NULL) return -APKE_V2DB_FORMAT;
+		apk_blob_pull_csum(&l, &ctx->file->csum);
+		break;
+	default:
+		return 1;
+	}
+	if (APK_BLOB_IS_NULL(l)) return -APKE_V2DB_FORMAT;
+	return 0;
+}
+
+/* With lazy set, the file lists of installed packages are not loaded, but
+ * only their location in the stream buffer is recorded. The buffer needs
+ * to stay valid until the file lists are loaded. With borrow set, the
+ * stream is a writable buffer that stays valid as long as the database,
+ * and the packages refer to their strings in it. */
+static int apk_db_fdb_read(struct apk_database *db, struct apk_istream *is, int repo, int lazy, int borrow)
+{
+	struct apk_out *out = &db->ctx->out;
+	struct apk_package *pkg = NULL;
+	struct apk_installed_package *ipkg = NULL;
+	struct fdb_files_ctx ctx = {};
+	apk_blob_t token = APK_BLOB_STR("\n"), l;
 	int field, r, lineno = 0;
 
 	if (IS_ERR(is)) return PTR_ERR(is);
@@ -773,7 +955,7 @@ int apk_db_index_read(struct apk_database *db, struct apk_istream *is, int repo)
 			if (pkg == NULL)
 				continue;
 
-			if (diri) apk_db_dir_apply_diri_permissions(diri);
+			if (ctx.diri) apk_db_dir_apply_diri_permissions(ctx.diri);
 
 			if (repo >= 0) {
 				pkg->repos |= BIT(repo);
@@ -800,9 +982,9 @@ int apk_db_index_read(struct apk_database *db, struct apk_istream *is, int repo)
 		/* If no package, create new */
 		if (pkg == NULL) {
 			pkg = apk_pkg_new();
+			pkg->borrowed_info = borrow;
 			ipkg = NULL;
-			diri = NULL;
-			file_diri_node = NULL;
+			ctx = (struct fdb_files_ctx) { .pkg = pkg };
 		}
 
 		/* Standard index line? */
@@ -814,48 +996,24 @@ int apk_db_index_read(struct apk_database *db, struct apk_istream *is, int repo)
 			 * happen after package name has been read, but
 			 * before first FDB entry. */
 			ipkg = apk_pkg_install(db, pkg);
-			diri_node = hlist_tail_ptr(&ipkg->owned_dirs);
+			ctx.diri_node = hlist_tail_ptr(&ipkg->owned_dirs);
 		}
 		if (repo != -1 || ipkg == NULL)
 			continue;
 
 		/* Check FDB special entries */
-		switch (field) {
-		case 'F':
-			if (diri) apk_db_dir_apply_diri_permissions(diri);
+		if (lazy && fdb_files_field(field)) {
 			if (pkg->name == NULL) goto bad_entry;
-			diri = find_diri(ipkg, l, NULL, &diri_node);
-			if (!diri) diri = apk_db_diri_new(db, pkg, l, &diri_node);
-			file_diri_node = hlist_tail_ptr(&diri->owned_files);
-			break;
-		case 'a':
-			if (file == NULL) goto bad_entry;
-		case 'M':
-			if (diri == NULL) goto bad_entry;
-			uid = apk_blob_pull_uint(&l, 10);
-			apk_blob_pull_char(&l, ':');
-			gid = apk_blob_pull_uint(&l, 10);
-			apk_blob_pull_char(&l, ':');
-			mode = apk_blob_pull_uint(&l, 8);
-			if (apk_blob_pull_blob_match(&l, APK_BLOB_STR(":")))
-				apk_blob_pull_csum(&l, &xattr_csum);
-			else
-				xattr_csum.type = APK_CHECKSUM_NONE;
+			if (APK_BLOB_IS_NULL(ipkg->lazy_files))
+				ipkg->lazy_files = APK_BLOB_PTR_LEN(l.ptr - 2, 0);
+			ipkg->lazy_files.len = l.ptr + l.len - ipkg->lazy_files.ptr;
+			continue;
+		}
+		r = apk_db_fdb_read_files(db, &ctx, field, l);
+		if (r < 0) goto bad_entry;
+		if (r == 0) continue;
 
-			acl = apk_db_acl_atomize_csum(db, mode, uid, gid, &xattr_csum);
-			if (field == 'M')
-				diri->acl = acl;
-			else
-				file->acl = acl;
-			break;
-		case 'R':
-			if (diri == NULL) goto bad_entry;
-			file = apk_db_file_get(db, diri, l, &file_diri_node);
-			break;
-		case 'Z':
-			if (file == NULL) goto bad_entry;
-			apk_blob_pull_csum(&l, &file->csum);
-			break;
+		switch (field) {
 		case 'r':
 			apk_blob_pull_deps(&l, db, &ipkg->replaces);
 			break;
@@ -899,6 +1057,78 @@ err_fmt:
 	return apk_istream_close(is);
 }
 
+int apk_db_index_read(struct apk_database *db, struct apk_istream *is, int repo)
+{
+	return apk_db_fdb_read(db, is, repo, 0, 0);
+}
+
+struct load_files_ctx {
+	struct apk_database *db;
+	struct fdb_files_ctx files;
+};
+
+static int load_files_line(void *pctx, apk_blob_t l)
+{
+	struct load_files_ctx *ctx = pctx;
+
+	if (l.len < 2 || l.ptr[1] != ':' || !fdb_files_field(l.ptr[0])) return 0;
+	return apk_db_fdb_read_files(ctx->db, &ctx->files, l.ptr[0],
+				     APK_BLOB_PTR_LEN(l.ptr + 2, l.len - 2));
+}
+
+void apk_db_ipkg_load_files(struct apk_database *db, struct apk_installed_package *ipkg)
+{
+	struct load_files_ctx ctx = {
+		.db = db,
+		.files.pkg = ipkg->pkg,
+		.files.diri_node = hlist_tail_ptr(&ipkg->owned_dirs),
+	};
+	apk_blob_t files = ipkg->lazy_files;
+	int r;
+
+	if (APK_BLOB_IS_NULL(files)) return;
+	ipkg->lazy_files = APK_BLOB_NULL;
+
+	r = apk_blob_for_each_segment(files, "\n", load_files_line, &ctx);
+	if (ctx.files.diri) apk_db_dir_apply_diri_permissions(ctx.files.diri);
+	if (r < 0) {
+		apk_err(&db->ctx->out, PKG_VER_FMT ": FDB format error in file list",
+			PKG_VER_PRINTF(ipkg->pkg));
+		ipkg->broken_files = 1;
+	}
+}
+
+static void apk_db_load_files(struct apk_database *db)
+{
+	struct apk_installed_package *ipkg;
+
+	if (!db->installed.lazy_fdb) return;
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list)
+		apk_db_ipkg_load_files(db, ipkg);
+	apk_istream_close(db->installed.lazy_fdb);
+	db->installed.lazy_fdb = NULL;
+}
+
+struct apk_db_file *apk_db_file_query(struct apk_database *db,
+				      apk_blob_t dir,
+				      apk_blob_t name)
+{
+	struct apk_db_file_hash_key key;
+
+	apk_db_load_files(db);
+
+	if (dir.len && dir.ptr[dir.len-1] == '/')
+		dir.len--;
+
+	key = (struct apk_db_file_hash_key) {
+		.dirname = dir,
+		.filename = name,
+	};
+
+	return (struct apk_db_file *) apk_hash_get(&db->installed.files,
+						   APK_BLOB_BUF(&key));
+}
+
 static void apk_blob_push_db_acl(apk_blob_t *b, char field, struct apk_db_acl *acl)
 {
 	char hdr[2] = { field, ':' };
@@ -916,96 +1146,103 @@ static void apk_blob_push_db_acl(apk_blob_t *b, char field, struct apk_db_acl *a
 	apk_blob_push_blob(b, APK_BLOB_STR("\n"));
 }
 
-static int apk_db_write_fdb(struct apk_database *db, struct apk_ostream *os)
+static int apk_db_write_fdb_entry(struct apk_database *db, struct apk_installed_package *ipkg, struct apk_ostream *os)
 {
-	struct apk_installed_package *ipkg;
-	struct apk_package *pkg;
+	struct apk_package *pkg = ipkg->pkg;
 	struct apk_db_dir_instance *diri;
 	struct apk_db_file *file;
 	struct hlist_node *c1, *c2;
 	char buf[1024+PATH_MAX];
 	apk_blob_t bbuf = APK_BLOB_BUF(buf);
-	int r = 0;
+	int r;
 
-	if (IS_ERR(os)) return PTR_ERR(os);
+	r = apk_pkg_write_index_entry(pkg, os);
+	if (r < 0) return r;
 
-	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list) {
-		pkg = ipkg->pkg;
-		r = apk_pkg_write_index_entry(pkg, os);
-		if (r < 0) goto err;
+	if (ipkg->replaces->num) {
+		apk_blob_push_blob(&bbuf, APK_BLOB_STR("r:"));
+		apk_blob_push_deps(&bbuf, db, ipkg->replaces);
+		apk_blob_push_blob(&bbuf, APK_BLOB_STR("\n"));
+	}
+	if (ipkg->replaces_priority) {
+		apk_blob_push_blob(&bbuf, APK_BLOB_STR("q:"));
+		apk_blob_push_uint(&bbuf, ipkg->replaces_priority, 10);
+		apk_blob_push_blob(&bbuf, APK_BLOB_STR("\n"));
+	}
+	if (ipkg->repository_tag) {
+		apk_blob_push_blob(&bbuf, APK_BLOB_STR("s:"));
+		apk_blob_push_blob(&bbuf, db->repo_tags[ipkg->repository_tag].plain_name);
+		apk_blob_push_blob(&bbuf, APK_BLOB_STR("\n"));
+	}
+	if (ipkg->broken_files || ipkg->broken_script || ipkg->broken_xattr || ipkg->sha256_160) {
+		apk_blob_push_blob(&bbuf, APK_BLOB_STR("f:"));
+		if (ipkg->broken_files)
+			apk_blob_push_blob(&bbuf, APK_BLOB_STR("f"));
+		if (ipkg->broken_script)
+			apk_blob_push_blob(&bbuf, APK_BLOB_STR("s"));
+		if (ipkg->broken_xattr)
+			apk_blob_push_blob(&bbuf, APK_BLOB_STR("x"));
+		if (ipkg->sha256_160)
+			apk_blob_push_blob(&bbuf, APK_BLOB_STR("S"));
+		apk_blob_push_blob(&bbuf, APK_BLOB_STR("\n"));
+	}
+	bbuf = apk_blob_pushed(APK_BLOB_BUF(buf), bbuf);
+	if (APK_BLOB_IS_NULL(bbuf)) return -ENOBUFS;
+	if (bbuf.len) {
+		r = apk_ostream_write(os, bbuf.ptr, bbuf.len);
+		if (r < 0) return r;
+	}
+	bbuf = APK_BLOB_BUF(buf);
 
-		if (ipkg->replaces->num) {
-			apk_blob_push_blob(&bbuf, APK_BLOB_STR("r:"));
-			apk_blob_push_deps(&bbuf, db, ipkg->replaces);
-			apk_blob_push_blob(&bbuf, APK_BLOB_STR("\n"));
-		}
-		if (ipkg->replaces_priority) {
-			apk_blob_push_blob(&bbuf, APK_BLOB_STR("q:"));
-			apk_blob_push_uint(&bbuf, ipkg->replaces_priority, 10);
-			apk_blob_push_blob(&bbuf, APK_BLOB_STR("\n"));
-		}
-		if (ipkg->repository_tag) {
-			apk_blob_push_blob(&bbuf, APK_BLOB_STR("s:"));
-			apk_blob_push_blob(&bbuf, db->repo_tags[ipkg->repository_tag].plain_name);
-			apk_blob_push_blob(&bbuf, APK_BLOB_STR("\n"));
-		}
-		if (ipkg->broken_files || ipkg->broken_script || ipkg->broken_xattr || ipkg->sha256_160) {
-			apk_blob_push_blob(&bbuf, APK_BLOB_STR("f:"));
-			if (ipkg->broken_files)
-				apk_blob_push_blob(&bbuf, APK_BLOB_STR("f"));
-			if (ipkg->broken_script)
-				apk_blob_push_blob(&bbuf, APK_BLOB_STR("s"));
-			if (ipkg->broken_xattr)
-				apk_blob_push_blob(&bbuf, APK_BLOB_STR("x"));
-			if (ipkg->sha256_160)
-				apk_blob_push_blob(&bbuf, APK_BLOB_STR("S"));
-			apk_blob_push_blob(&bbuf, APK_BLOB_STR("\n"));
-		}
-		hlist_for_each_entry(diri, c1, &ipkg->owned_dirs, pkg_dirs_list) {
-			apk_blob_push_blob(&bbuf, APK_BLOB_STR("F:"));
-			apk_blob_push_blob(&bbuf, APK_BLOB_PTR_LEN(diri->dir->name, diri->dir->namelen));
+	hlist_for_each_entry(diri, c1, &ipkg->owned_dirs, pkg_dirs_list) {
+		apk_blob_push_blob(&bbuf, APK_BLOB_STR("F:"));
+		apk_blob_push_blob(&bbuf, APK_BLOB_PTR_LEN(diri->dir->name, diri->dir->namelen));
+		apk_blob_push_blob(&bbuf, APK_BLOB_STR("\n"));
+
+		if (diri->acl != apk_default_acl_dir)
+			apk_blob_push_db_acl(&bbuf, 'M', diri->acl);
+
+		bbuf = apk_blob_pushed(APK_BLOB_BUF(buf), bbuf);
+		if (APK_BLOB_IS_NULL(bbuf)) return -ENOBUFS;
+		r = apk_ostream_write(os, bbuf.ptr, bbuf.len);
+		if (r < 0) return r;
+		bbuf = APK_BLOB_BUF(buf);
+
+		hlist_for_each_entry(file, c2, &diri->owned_files, diri_files_list) {
+			apk_blob_push_blob(&bbuf, APK_BLOB_STR("R:"));
+			apk_blob_push_blob(&bbuf, APK_BLOB_PTR_LEN(file->name, file->namelen));
 			apk_blob_push_blob(&bbuf, APK_BLOB_STR("\n"));
 
-			if (diri->acl != apk_default_acl_dir)
-				apk_blob_push_db_acl(&bbuf, 'M', diri->acl);
+			if (file->acl != apk_default_acl_file)
+				apk_blob_push_db_acl(&bbuf, 'a', file->acl);
 
-			bbuf = apk_blob_pushed(APK_BLOB_BUF(buf), bbuf);
-			if (APK_BLOB_IS_NULL(bbuf)) {
-				r = -ENOBUFS;
-				goto err;
+			if (file->csum.type != APK_CHECKSUM_NONE) {
+				apk_blob_push_blob(&bbuf, APK_BLOB_STR("Z:"));
+				apk_blob_push_csum(&bbuf, &file->csum);
+				apk_blob_push_blob(&bbuf, APK_BLOB_STR("\n"));
 			}
+
+			bbuf = apk_blob_pushed(APK_BLOB_BUF(buf), bbuf);
+			if (APK_BLOB_IS_NULL(bbuf)) return -ENOBUFS;
 			r = apk_ostream_write(os, bbuf.ptr, bbuf.len);
-			if (r < 0) goto err;
+			if (r < 0) return r;
 			bbuf = APK_BLOB_BUF(buf);
+		}
+	}
+	return apk_ostream_write(os, "\n", 1);
+}
 
-			hlist_for_each_entry(file, c2, &diri->owned_files, diri_files_list) {
-				apk_blob_push_blob(&bbuf, APK_BLOB_STR("R:"));
-				apk_blob_push_blob(&bbuf, APK_BLOB_PTR_LEN(file->name, file->namelen));
-				apk_blob_push_blob(&bbuf, APK_BLOB_STR("\n"));
-
-				if (file->acl != apk_default_acl_file)
-					apk_blob_push_db_acl(&bbuf, 'a', file->acl);
+static int apk_db_write_fdb(struct apk_database *db, struct apk_ostream *os)
+{
+	struct apk_installed_package *ipkg;
+	int r = 0;
 
-				if (file->csum.type != APK_CHECKSUM_NONE) {
-					apk_blob_push_blob(&bbuf, APK_BLOB_STR("Z:"));
-					apk_blob_push_csum(&bbuf, &file->csum);
-					apk_blob_push_blob(&bbuf, APK_BLOB_STR("\n"));
-				}
+	if (IS_ERR(os)) return PTR_ERR(os);
 
-				bbuf = apk_blob_pushed(APK_BLOB_BUF(buf), bbuf);
-				if (APK_BLOB_IS_NULL(bbuf)) {
-					r = -ENOBUFS;
-					goto err;
-				}
-				r = apk_ostream_write(os, bbuf.ptr, bbuf.len);
-				if (r < 0) goto err;
-				bbuf = APK_BLOB_BUF(buf);
-			}
-		}
-		r = apk_ostream_write(os, "\n", 1);
-		if (r < 0) goto err;
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list) {
+		r = apk_db_write_fdb_entry(db, ipkg, os);
+		if (r < 0) break;
 	}
-err:
 	if (r < 0) apk_ostream_cancel(os, r);
 	return apk_ostream_close(os);
 }
@@ -1091,12 +1328,38 @@ static int apk_read_script_archive_entry(void *ctx,
 
 	/* Attach script */
 	pkg = apk_db_get_pkg(db, &csum);
-	if (pkg != NULL && pkg->ipkg != NULL)
+	if (pkg == NULL || pkg->ipkg == NULL)
+		return 0;
+	if (db->installed.scriptdb) {
+		void *ptr = apk_istream_get(is, ae->size);
+		if (IS_ERR(ptr)) return PTR_ERR(ptr);
+		apk_ipkg_map_script(pkg->ipkg, type, APK_BLOB_PTR_LEN(ptr, ae->size));
+	} else {
 		apk_ipkg_add_script(pkg->ipkg, is, type, ae->size);
+	}
 
 	return 0;
 }
 
+/* The scripts database is kept mapped, and the installed packages refer
+ * to their scripts in it. Only the tar headers are read when opening the
+ * database. The script pages are read in when a script is executed, or
+ * when the database is written after a change. */
+static int apk_db_scriptdb_read(struct apk_database *db)
+{
+	struct apk_istream *is, bis;
+	apk_blob_t b;
+
+	is = apk_istream_from_file_mmap(db->root_fd, apk_scripts_file);
+	if (IS_ERR(is)) return PTR_ERR(is);
+	b = apk_istream_mmap(is);
+	if (!APK_BLOB_IS_NULL(b)) {
+		db->installed.scriptdb = is;
+		is = apk_istream_from_blob(&bis, b);
+	}
+	return apk_tar_parse(is, apk_read_script_archive_entry, db, db->id_cache);
+}
+
 static int parse_triggers(void *ctx, apk_blob_t blob)
 {
 	struct apk_installed_package *ipkg = ctx;
@@ -1159,41 +1422,897 @@ static int apk_db_triggers_read(struct apk_database *db, struct apk_istream *is)
 	return apk_istream_close(is);
 }
 
-static int apk_db_read_state(struct apk_database *db, int flags)
+/* The installed database snapshot is an ADB rendition of the text
+ * installed database. It is written right after the text database and
+ * carries a stamp of it, so that any other writer of the text database
+ * invalidates the snapshot.
+ *
+ * The snapshot saves the parsing, but it is still loaded in full: the
+ * applets and the solver work on the in-memory package, directory and
+ * file hashes, so these are built for every installed package. Applets
+ * that only query packages open the database with APK_OPENF_LAZY_FILES
+ * instead, which indexes the text database and loads the file lists of
+ * a package only when they are needed. */
+static int apk_db_file_stamp(int atfd, const char *file, struct apk_db_file_stamp *stamp)
 {
-	apk_blob_t blob, world;
-	int r, ret = 0;
+	struct stat st;
 
-	/* Read:
-	 * 1. /etc/apk/world
-	 * 2. installed packages db
-	 * 3. triggers db
-	 * 4. scripts db
-	 */
-	if (!(flags & APK_OPENF_NO_WORLD)) {
-		blob = world = apk_blob_from_file(db->root_fd, apk_world_file);
-		if (!APK_BLOB_IS_NULL(blob)) {
-			blob = apk_blob_trim(blob);
-			apk_blob_pull_deps(&blob, db, &db->world);
-			free(world.ptr);
-		} else {
+	if (fstatat(atfd, file, &st, 0) != 0)
+		return -errno;
+
+	*stamp = (struct apk_db_file_stamp) {
+		.size = htole64(st.st_size),
+		.mtime_sec = htole64(st.st_mtim.tv_sec),
+		.mtime_nsec = htole64(st.st_mtim.tv_nsec),
+		.ino = htole64(st.st_ino),
+	};
+	return 0;
+}
+
+static int apk_db_installed_stamp(struct apk_database *db, struct apk_db_file_stamp *stamp)
+{
+	return apk_db_file_stamp(db->root_fd, apk_installed_file, stamp);
+}
+
+static void state_stamp_add(struct apk_digest_ctx *dctx, int atfd, const char *file)
+{
+	struct apk_db_file_stamp stamp;
+	int r;
+
+	r = apk_db_file_stamp(atfd, file, &stamp);
+	if (r < 0) memset(&stamp, 0, sizeof stamp);
+	apk_digest_ctx_update(dctx, file, strlen(file));
+	apk_digest_ctx_update(dctx, &stamp, sizeof stamp);
+}
+
+static int state_stamp_add_file(void *pctx, int dirfd, const char *file)
+{
+	state_stamp_add(pctx, dirfd, file);
+	return 0;
+}
+
+/* Digest of the stamps of every file the database state and the
+ * repository indexes are read from. A long running reader compares it
+ * against the value taken when it opened the database to find out if
+ * it needs to reopen. */
+int apk_db_state_stamp(struct apk_database *db, struct apk_digest *d)
+{
+	static const char * const state_files[] = {
+		apk_installed_file,
+		apk_installed_snapshot_file,
+		apk_installed_journal_file,
+		apk_triggers_file,
+		apk_scripts_file,
+		apk_world_file,
+		apk_arch_file,
+		"etc/apk/repositories",
+		"etc/apk/repositories.d",
+	};
+	struct apk_digest_ctx dctx;
+	struct apk_repository *repo;
+	char buf[PATH_MAX];
+	const char *file;
+	int i, r;
+
+	r = apk_digest_ctx_init(&dctx, APK_DIGEST_SHA1);
+	if (r != 0) return r;
+
+	for (i = 0; i < ARRAY_SIZE(state_files); i++)
+		state_stamp_add(&dctx, db->root_fd, state_files[i]);
+	apk_dir_foreach_file(openat(db->root_fd, "etc/apk/repositories.d", O_RDONLY | O_CLOEXEC),
+			     state_stamp_add_file, &dctx);
+	if (db->ctx->repositories_file)
+		state_stamp_add(&dctx, AT_FDCWD, db->ctx->repositories_file);
+
+	for (i = APK_REPOSITORY_FIRST_CONFIGURED; i < db->num_repos; i++) {
+		repo = &db->repos[i];
+		if (apk_url_local_file(repo->url)) {
+			if (apk_repo_format_real_url(db->arch, repo, NULL, buf, sizeof buf, NULL) == 0 &&
+			    (file = apk_url_local_file(buf)) != NULL)
+				state_stamp_add(&dctx, AT_FDCWD, file);
+		} else if (apk_repo_format_cache_index(APK_BLOB_BUF(buf), repo) == 0) {
+			state_stamp_add(&dctx, db->cache_fd, buf);
+		}
+	}
+	if (apk_db_cache_active(db)) state_stamp_add(&dctx, db->cache_fd, "installed");
+
+	r = apk_digest_ctx_final(&dctx, d);
+	apk_digest_ctx_free(&dctx);
+	return r;
+}
+
+static int snapshot_wo_int(struct adb_obj *obj, unsigned i, uint64_t val)
+{
+	if (val > UINT32_MAX) return -E2BIG;
+	if (val) adb_wo_int(obj, i, val);
+	return 0;
+}
+
+static void snapshot_wo_atom(struct adb_obj *obj, unsigned i, apk_blob_t *atom)
+{
+	if (atom && atom->ptr) adb_wo_blob(obj, i, *atom);
+}
+
+static void snapshot_wo_str(struct adb_obj *obj, unsigned i, const char *str)
+{
+	if (str) adb_wo_blob(obj, i, APK_BLOB_STR(str));
+}
+
+static int snapshot_wo_deps(struct adb_obj *obj, unsigned i, struct apk_database *db,
+			    struct apk_dependency_array *deps, apk_blob_t buf)
+{
+	apk_blob_t b = buf;
+
+	if (!deps || !deps->num) return 0;
+	apk_blob_push_deps(&b, db, deps);
+	b = apk_blob_pushed(buf, b);
+	if (APK_BLOB_IS_NULL(b)) return -ENOBUFS;
+	adb_wo_blob(obj, i, b);
+	return 0;
+}
+
+static int snapshot_wa_append(struct adb_obj *arr, adb_val_t val)
+{
+	if (adb_ro_num(arr) >= arr->schema->num_fields) return -E2BIG;
+	adb_wa_append(arr, val);
+	return 0;
+}
+
+static adb_val_t snapshot_w_acl(struct adb_obj *acl, struct apk_db_acl *a)
+{
+	adb_wo_int(acl, ADBI_IDBS_ACL_MODE, a->mode);
+	adb_wo_int(acl, ADBI_IDBS_ACL_UID, a->uid);
+	adb_wo_int(acl, ADBI_IDBS_ACL_GID, a->gid);
+	if (a->xattr_csum.type != APK_CHECKSUM_NONE)
+		adb_wo_blob(acl, ADBI_IDBS_ACL_XATTR_HASH, APK_BLOB_CSUM(a->xattr_csum));
+	return adb_w_obj(acl);
+}
+
+static int snapshot_wo_pkginfo(struct apk_database *db, struct apk_package *pkg,
+			       struct adb_obj *pkgo, apk_blob_t buf)
+{
+	int r;
+
+	adb_wo_blob(pkgo, ADBI_IDBS_PKG_UNIQUE_ID, APK_BLOB_CSUM(pkg->csum));
+	adb_wo_blob(pkgo, ADBI_IDBS_PKG_NAME, APK_BLOB_STR(pkg->name->name));
+	snapshot_wo_atom(pkgo, ADBI_IDBS_PKG_VERSION, pkg->version);
+	snapshot_wo_atom(pkgo, ADBI_IDBS_PKG_ARCH, pkg->arch);
+	snapshot_wo_atom(pkgo, ADBI_IDBS_PKG_LICENSE, pkg->license);
+	snapshot_wo_atom(pkgo, ADBI_IDBS_PKG_ORIGIN, pkg->origin);
+	snapshot_wo_atom(pkgo, ADBI_IDBS_PKG_MAINTAINER, pkg->maintainer);
+	snapshot_wo_str(pkgo, ADBI_IDBS_PKG_DESCRIPTION, pkg->description);
+	snapshot_wo_str(pkgo, ADBI_IDBS_PKG_URL, pkg->url);
+	snapshot_wo_str(pkgo, ADBI_IDBS_PKG_REPO_COMMIT, pkg->commit);
+
+	if ((r = snapshot_wo_int(pkgo, ADBI_IDBS_PKG_FILE_SIZE, pkg->size)) < 0 ||
+	    (r = snapshot_wo_int(pkgo, ADBI_IDBS_PKG_INSTALLED_SIZE, pkg->installed_size)) < 0 ||
+	    (r = snapshot_wo_int(pkgo, ADBI_IDBS_PKG_BUILD_TIME, pkg->build_time)) < 0 ||
+	    (r = snapshot_wo_int(pkgo, ADBI_IDBS_PKG_PRIORITY, pkg->provider_priority)) < 0 ||
+	    (r = snapshot_wo_deps(pkgo, ADBI_IDBS_PKG_DEPENDS, db, pkg->depends, buf)) < 0 ||
+	    (r = snapshot_wo_deps(pkgo, ADBI_IDBS_PKG_PROVIDES, db, pkg->provides, buf)) < 0 ||
+	    (r = snapshot_wo_deps(pkgo, ADBI_IDBS_PKG_INSTALL_IF, db, pkg->install_if, buf)) < 0)
+		return r;
+	return 0;
+}
+
+static int apk_db_snapshot_write_pkg(struct apk_database *db, struct apk_installed_package *ipkg,
+				     struct adb_obj *pkgo, struct adb_obj *dirs, struct adb_obj *files,
+				     apk_blob_t buf)
+{
+	struct apk_db_dir_instance *diri;
+	struct apk_db_file *file;
+	struct hlist_node *c1, *c2;
+	struct adb *sdb = pkgo->db;
+	struct adb_obj diro, fileo, acl;
+	int r, flags = 0;
+
+	adb_wo_alloca(&diro, &schema_idbs_dir, sdb);
+	adb_wo_alloca(&fileo, &schema_idbs_file, sdb);
+	adb_wo_alloca(&acl, &schema_idbs_acl, sdb);
+
+	if ((r = snapshot_wo_pkginfo(db, ipkg->pkg, pkgo, buf)) < 0 ||
+	    (r = snapshot_wo_int(pkgo, ADBI_IDBS_PKG_REPLACES_PRIORITY, ipkg->replaces_priority)) < 0 ||
+	    (r = snapshot_wo_deps(pkgo, ADBI_IDBS_PKG_REPLACES, db, ipkg->replaces, buf)) < 0)
+		return r;
+	if (ipkg->repository_tag)
+		adb_wo_blob(pkgo, ADBI_IDBS_PKG_REPOSITORY_TAG, db->repo_tags[ipkg->repository_tag].plain_name);
+
+	if (ipkg->broken_files) flags |= ADB_IDBS_FLAG_BROKEN_FILES;
+	if (ipkg->broken_script) flags |= ADB_IDBS_FLAG_BROKEN_SCRIPT;
+	if (ipkg->broken_xattr) flags |= ADB_IDBS_FLAG_BROKEN_XATTR;
+	if (ipkg->sha256_160) flags |= ADB_IDBS_FLAG_SHA256_160;
+	snapshot_wo_int(pkgo, ADBI_IDBS_PKG_FLAGS, flags);
+
+	hlist_for_each_entry(diri, c1, &ipkg->owned_dirs, pkg_dirs_list) {
+		adb_wo_blob(&diro, ADBI_IDBS_DI_NAME, APK_BLOB_PTR_LEN(diri->dir->name, diri->dir->namelen));
+		if (diri->acl != apk_default_acl_dir)
+			adb_wo_val(&diro, ADBI_IDBS_DI_ACL, snapshot_w_acl(&acl, diri->acl));
+
+		hlist_for_each_entry(file, c2, &diri->owned_files, diri_files_list) {
+			adb_wo_blob(&fileo, ADBI_IDBS_FI_NAME, APK_BLOB_PTR_LEN(file->name, file->namelen));
+			if (file->acl != apk_default_acl_file)
+				adb_wo_val(&fileo, ADBI_IDBS_FI_ACL, snapshot_w_acl(&acl, file->acl));
+			if (file->csum.type != APK_CHECKSUM_NONE)
+				adb_wo_blob(&fileo, ADBI_IDBS_FI_HASH, APK_BLOB_CSUM(file->csum));
+			if ((r = snapshot_wa_append(files, adb_w_obj(&fileo))) < 0)
+				return r;
+		}
+		adb_wo_arr(&diro, ADBI_IDBS_DI_FILES, files);
+		if ((r = snapshot_wa_append(dirs, adb_w_obj(&diro))) < 0)
+			return r;
+	}
+	adb_wo_arr(pkgo, ADBI_IDBS_PKG_PATHS, dirs);
+	return 0;
+}
+
+static int apk_db_snapshot_write(struct apk_database *db)
+{
+	struct apk_db_file_stamp stamp;
+	struct apk_installed_package *ipkg;
+	struct apk_ostream *os;
+	struct adb sdb;
+	struct adb_obj root, pkgs, pkgo, dirs, files;
+	struct list_head *buckets = NULL;
+	adb_val_t *vals = NULL;
+	char *buf = NULL;
+	int r;
+
+	r = apk_db_installed_stamp(db, &stamp);
+	if (r < 0) goto err;
+
+	buckets = malloc(sizeof(struct list_head[1024]));
+	vals = malloc(sizeof(adb_val_t[APK_MAX_SNAPSHOT_ENTRIES + APK_MAX_MANIFEST_PATHS + APK_MAX_MANIFEST_FILES]));
+	buf = malloc(64 * 1024);
+	if (!buckets || !vals || !buf) {
+		r = -ENOMEM;
+		goto err;
+	}
+
+	adb_w_init_dynamic(&sdb, ADB_SCHEMA_INSTALLED_SNAPSHOT, buckets, 1024);
+	adb_wo_alloca(&root, &schema_idbs, &sdb);
+	adb_wo_alloca(&pkgo, &schema_idbs_package, &sdb);
+	adb_wo_init(&pkgs, &vals[0], &schema_idbs_package_array, &sdb);
+	adb_wo_init(&dirs, &vals[APK_MAX_SNAPSHOT_ENTRIES], &schema_idbs_dir_array, &sdb);
+	adb_wo_init(&files, &vals[APK_MAX_SNAPSHOT_ENTRIES + APK_MAX_MANIFEST_PATHS], &schema_idbs_file_array, &sdb);
+
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list) {
+		r = apk_db_snapshot_write_pkg(db, ipkg, &pkgo, &dirs, &files, APK_BLOB_PTR_LEN(buf, 64 * 1024));
+		if (r == -E2BIG)
+			apk_warn(&db->ctx->out, PKG_VER_FMT ": too many directories or files for the installed database snapshot",
+				 PKG_VER_PRINTF(ipkg->pkg));
+		if (r < 0) goto err_adb;
+		if ((r = snapshot_wa_append(&pkgs, adb_w_obj(&pkgo))) < 0) goto err_adb;
+		if (sdb.adb.len >= ADB_VALUE_MASK) {
+			r = -APKE_ADB_LIMIT;
+			goto err_adb;
+		}
+	}
+	adb_wo_blob(&root, ADBI_IDBS_STAMP, APK_BLOB_STRUCT(stamp));
+	adb_wo_arr(&root, ADBI_IDBS_PACKAGES, &pkgs);
+	adb_w_rootobj(&root);
+
+	os = apk_ostream_to_file(db->root_fd, apk_installed_snapshot_file, 0644);
+	if (IS_ERR(os)) {
+		r = PTR_ERR(os);
+		goto err_adb;
+	}
+	adb_c_header(os, &sdb);
+	adb_c_block(os, ADB_BLOCK_ADB, sdb.adb);
+	r = apk_ostream_close(os);
+err_adb:
+	adb_free(&sdb);
+err:
+	free(buf);
+	free(vals);
+	free(buckets);
+	if (r < 0) {
+		unlinkat(db->root_fd, apk_installed_snapshot_file, 0);
+		apk_warn(&db->ctx->out, "Installed database snapshot not written: %s", apk_error_str(r));
+	}
+	return r;
+}
+
+static struct apk_db_acl *snapshot_r_acl(struct apk_database *db, struct adb_obj *acl, struct apk_db_acl *def)
+{
+	struct apk_checksum xattr_csum;
+	apk_blob_t b;
+
+	if (adb_ro_num(acl) <= 1) return def;
+
+	b = adb_ro_blob(acl, ADBI_IDBS_ACL_XATTR_HASH);
+	xattr_csum.type = APK_CHECKSUM_NONE;
+	if (b.len <= APK_CHECKSUM_MAX) {
+		xattr_csum.type = b.len;
+		memcpy(xattr_csum.data, b.ptr, b.len);
+	}
+	return apk_db_acl_atomize_csum(db,
+		adb_ro_int(acl, ADBI_IDBS_ACL_MODE),
+		adb_ro_int(acl, ADBI_IDBS_ACL_UID),
+		adb_ro_int(acl, ADBI_IDBS_ACL_GID),
+		&xattr_csum);
+}
+
+static apk_blob_t *snapshot_r_atom(struct apk_database *db, struct adb_obj *obj, unsigned i)
+{
+	apk_blob_t b = adb_ro_blob(obj, i);
+	if (APK_BLOB_IS_NULL(b)) return NULL;
+	return apk_atomize_dup(&db->atoms, b);
+}
+
+static char *snapshot_r_str(struct adb_obj *obj, unsigned i)
+{
+	apk_blob_t b = adb_ro_blob(obj, i);
+	if (APK_BLOB_IS_NULL(b)) return NULL;
+	return apk_blob_cstr(b);
+}
+
+static struct apk_package *snapshot_r_pkginfo(struct apk_database *db, struct adb_obj *pkgo)
+{
+	struct apk_package *pkg;
+	apk_blob_t b;
+
+	pkg = apk_pkg_new();
+	if (!pkg) return ERR_PTR(-ENOMEM);
+
+	b = adb_ro_blob(pkgo, ADBI_IDBS_PKG_UNIQUE_ID);
+	if (b.len > APK_CHECKSUM_MAX) goto err;
+	pkg->csum.type = b.len;
+	memcpy(pkg->csum.data, b.ptr, b.len);
+
+	b = adb_ro_blob(pkgo, ADBI_IDBS_PKG_NAME);
+	if (APK_BLOB_IS_NULL(b)) goto err;
+	pkg->name = apk_db_get_name(db, b);
+	pkg->version = apk_atomize_dup(&db->atoms, adb_ro_blob(pkgo, ADBI_IDBS_PKG_VERSION));
+	pkg->arch = snapshot_r_atom(db, pkgo, ADBI_IDBS_PKG_ARCH);
+	pkg->license = snapshot_r_atom(db, pkgo, ADBI_IDBS_PKG_LICENSE);
+	pkg->origin = snapshot_r_atom(db, pkgo, ADBI_IDBS_PKG_ORIGIN);
+	pkg->maintainer = snapshot_r_atom(db, pkgo, ADBI_IDBS_PKG_MAINTAINER);
+	pkg->description = apk_blob_cstr(adb_ro_blob(pkgo, ADBI_IDBS_PKG_DESCRIPTION));
+	pkg->url = apk_blob_cstr(adb_ro_blob(pkgo, ADBI_IDBS_PKG_URL));
+	pkg->commit = snapshot_r_str(pkgo, ADBI_IDBS_PKG_REPO_COMMIT);
+	pkg->size = adb_ro_int(pkgo, ADBI_IDBS_PKG_FILE_SIZE);
+	pkg->installed_size = adb_ro_int(pkgo, ADBI_IDBS_PKG_INSTALLED_SIZE);
+	pkg->build_time = adb_ro_int(pkgo, ADBI_IDBS_PKG_BUILD_TIME);
+	pkg->provider_priority = adb_ro_int(pkgo, ADBI_IDBS_PKG_PRIORITY);
+	b = adb_ro_blob(pkgo, ADBI_IDBS_PKG_DEPENDS);
+	apk_blob_pull_deps(&b, db, &pkg->depends);
+	b = adb_ro_blob(pkgo, ADBI_IDBS_PKG_PROVIDES);
+	apk_blob_pull_deps(&b, db, &pkg->provides);
+	b = adb_ro_blob(pkgo, ADBI_IDBS_PKG_INSTALL_IF);
+	apk_blob_pull_deps(&b, db, &pkg->install_if);
+	return pkg;
+err:
+	apk_pkg_free(pkg);
+	return ERR_PTR(-APKE_V2DB_FORMAT);
+}
+
+static int apk_db_snapshot_read_pkg(struct apk_database *db, struct adb_obj *pkgo)
+{
+	struct apk_package *pkg;
+	struct apk_installed_package *ipkg;
+	struct apk_db_dir_instance *diri;
+	struct apk_db_file *file;
+	struct hlist_node **diri_node, **file_diri_node;
+	struct adb_obj dirs, diro, files, fileo, acl;
+	apk_blob_t b;
+	int i, j, flags;
+
+	pkg = snapshot_r_pkginfo(db, pkgo);
+	if (IS_ERR(pkg)) return PTR_ERR(pkg);
+	/* The text database always has the license field */
+	if (!pkg->license) pkg->license = apk_atomize_dup(&db->atoms, APK_BLOB_STRLIT(""));
+
+	ipkg = apk_pkg_install(db, pkg);
+	b = adb_ro_blob(pkgo, ADBI_IDBS_PKG_REPLACES);
+	apk_blob_pull_deps(&b, db, &ipkg->replaces);
+	ipkg->replaces_priority = adb_ro_int(pkgo, ADBI_IDBS_PKG_REPLACES_PRIORITY);
+	b = adb_ro_blob(pkgo, ADBI_IDBS_PKG_REPOSITORY_TAG);
+	if (!APK_BLOB_IS_NULL(b)) ipkg->repository_tag = apk_db_get_tag_id(db, b);
+	flags = adb_ro_int(pkgo, ADBI_IDBS_PKG_FLAGS);
+	ipkg->broken_files = !!(flags & ADB_IDBS_FLAG_BROKEN_FILES);
+	ipkg->broken_script = !!(flags & ADB_IDBS_FLAG_BROKEN_SCRIPT);
+	ipkg->broken_xattr = !!(flags & ADB_IDBS_FLAG_BROKEN_XATTR);
+	ipkg->sha256_160 = !!(flags & ADB_IDBS_FLAG_SHA256_160);
+
+	diri_node = hlist_tail_ptr(&ipkg->owned_dirs);
+	adb_ro_obj(pkgo, ADBI_IDBS_PKG_PATHS, &dirs);
+	for (i = ADBI_FIRST; i <= adb_ra_num(&dirs); i++) {
+		adb_ro_obj(&dirs, i, &diro);
+		b = adb_ro_blob(&diro, ADBI_IDBS_DI_NAME);
+		if (APK_BLOB_IS_NULL(b)) b = APK_BLOB_PTR_LEN("", 0);
+		diri = apk_db_diri_new(db, pkg, b, &diri_node);
+		if (!diri) return -ENOMEM;
+		diri->acl = snapshot_r_acl(db, adb_ro_obj(&diro, ADBI_IDBS_DI_ACL, &acl), apk_default_acl_dir);
+
+		file_diri_node = hlist_tail_ptr(&diri->owned_files);
+		adb_ro_obj(&diro, ADBI_IDBS_DI_FILES, &files);
+		for (j = ADBI_FIRST; j <= adb_ra_num(&files); j++) {
+			adb_ro_obj(&files, j, &fileo);
+			b = adb_ro_blob(&fileo, ADBI_IDBS_FI_NAME);
+			if (APK_BLOB_IS_NULL(b)) return -APKE_V2DB_FORMAT;
+			file = apk_db_file_get(db, diri, b, &file_diri_node);
+			if (!file) return -ENOMEM;
+			file->acl = snapshot_r_acl(db, adb_ro_obj(&fileo, ADBI_IDBS_FI_ACL, &acl), apk_default_acl_file);
+			b = adb_ro_blob(&fileo, ADBI_IDBS_FI_HASH);
+			if (b.len > APK_CHECKSUM_MAX) return -APKE_V2DB_FORMAT;
+			file->csum.type = b.len;
+			memcpy(file->csum.data, b.ptr, b.len);
+		}
+		apk_db_dir_apply_diri_permissions(diri);
+	}
+
+	if (apk_db_pkg_add(db, pkg) == NULL) return -APKE_V2DB_FORMAT;
+	return 0;
+}
+
+/* Check everything apk_db_snapshot_read_pkg() depends on, so that a
+ * corrupt snapshot is found before anything is added to the database */
+static int snapshot_validate_pkg(struct adb_obj *pkgo)
+{
+	struct adb_obj dirs, diro, files, fileo;
+	int i, j;
+
+	if (adb_ro_blob(pkgo, ADBI_IDBS_PKG_UNIQUE_ID).len > APK_CHECKSUM_MAX ||
+	    APK_BLOB_IS_NULL(adb_ro_blob(pkgo, ADBI_IDBS_PKG_NAME)) ||
+	    APK_BLOB_IS_NULL(adb_ro_blob(pkgo, ADBI_IDBS_PKG_VERSION)))
+		return -APKE_ADB_SCHEMA;
+
+	adb_ro_obj(pkgo, ADBI_IDBS_PKG_PATHS, &dirs);
+	for (i = ADBI_FIRST; i <= adb_ra_num(&dirs); i++) {
+		adb_ro_obj(&dirs, i, &diro);
+		adb_ro_obj(&diro, ADBI_IDBS_DI_FILES, &files);
+		for (j = ADBI_FIRST; j <= adb_ra_num(&files); j++) {
+			adb_ro_obj(&files, j, &fileo);
+			if (APK_BLOB_IS_NULL(adb_ro_blob(&fileo, ADBI_IDBS_FI_NAME)) ||
+			    adb_ro_blob(&fileo, ADBI_IDBS_FI_HASH).len > APK_CHECKSUM_MAX)
+				return -APKE_ADB_SCHEMA;
+		}
+	}
+	return 0;
+}
+
+/* Returns -ENOMEM, or -APKE_V2DB_FORMAT, if loading the snapshot failed
+ * half way. Other errors mean nothing was loaded, and the text database
+ * needs to be read. A corrupt snapshot is removed so that it is not
+ * tried again. */
+static int apk_db_snapshot_read(struct apk_database *db)
+{
+	struct apk_trust trust = { .allow_untrusted = 1 };
+	struct apk_db_file_stamp stamp;
+	struct adb sdb;
+	struct adb_obj root, pkgs, pkgo;
+	apk_blob_t b;
+	int i, r;
+
+	r = apk_db_installed_stamp(db, &stamp);
+	if (r < 0) return r;
+
+	r = adb_m_open(&sdb, apk_istream_from_file_mmap(db->root_fd, apk_installed_snapshot_file),
+		       ADB_SCHEMA_INSTALLED_SNAPSHOT, &trust);
+	if (r < 0) return r;
+
+	adb_r_rootobj(&sdb, &root, &schema_idbs);
+	b = adb_ro_blob(&root, ADBI_IDBS_STAMP);
+	if (apk_blob_compare(b, APK_BLOB_STRUCT(stamp)) != 0) {
+		r = -ESTALE;
+		goto done;
+	}
+
+	adb_ro_obj(&root, ADBI_IDBS_PACKAGES, &pkgs);
+	for (i = ADBI_FIRST; i <= adb_ra_num(&pkgs); i++) {
+		r = snapshot_validate_pkg(adb_ro_obj(&pkgs, i, &pkgo));
+		if (r < 0) {
+			apk_warn(&db->ctx->out, "Installed database snapshot format error (package %d), ignoring it", i);
+			unlinkat(db->root_fd, apk_installed_snapshot_file, 0);
+			goto done;
+		}
+	}
+	for (i = ADBI_FIRST; i <= adb_ra_num(&pkgs); i++) {
+		r = apk_db_snapshot_read_pkg(db, adb_ro_obj(&pkgs, i, &pkgo));
+		if (r < 0) {
+			apk_err(&db->ctx->out, "Installed database snapshot not loaded: %s", apk_error_str(r));
+			break;
+		}
+	}
+done:
+	adb_free(&sdb);
+	return r;
+}
+
+/* The installed database journal holds the changes done to the installed
+ * database since the text database was last written in full. It starts
+ * with a header line containing the stamp of the text database it applies
+ * to. Each transaction consists of package removals ("-:<checksum>") and
+ * full installed database entries of new or modified packages, and is
+ * terminated with a "=:" line. Incomplete transactions are ignored. */
+static int apk_db_journal_header(struct apk_database *db, apk_blob_t *to)
+{
+	apk_blob_push_blob(to, APK_BLOB_STR("J:"));
+	apk_blob_push_hexdump(to, APK_BLOB_STRUCT(db->installed.journal.base));
+	apk_blob_push_blob(to, APK_BLOB_STR("\n"));
+	return APK_BLOB_IS_NULL(*to) ? -ENOBUFS : 0;
+}
+
+static int journal_next_line(apk_blob_t *b, apk_blob_t *l)
+{
+	if (b->len <= 0) return 0;
+	if (!apk_blob_split(*b, APK_BLOB_STR("\n"), l, b)) {
+		*l = *b;
+		*b = APK_BLOB_PTR_LEN(b->ptr + b->len, 0);
+	}
+	return 1;
+}
+
+static int journal_pull_csum(apk_blob_t l, struct apk_checksum *csum)
+{
+	l.ptr += 2;
+	l.len -= 2;
+	apk_blob_pull_csum(&l, csum);
+	if (APK_BLOB_IS_NULL(l) || csum->type == APK_CHECKSUM_NONE) return -APKE_V2DB_FORMAT;
+	return 0;
+}
+
+/* Drop the installed state of a package from memory without touching
+ * the filesystem */
+static void apk_db_pkg_forget(struct apk_database *db, struct apk_package *pkg)
+{
+	struct apk_installed_package *ipkg = pkg->ipkg;
+	struct apk_db_dir_instance *diri;
+	struct apk_db_file *file;
+	struct apk_db_file_hash_key key;
+	struct hlist_node *dc, *dn, *fc, *fn;
+
+	hlist_for_each_entry_safe(diri, dc, dn, &ipkg->owned_dirs, pkg_dirs_list) {
+		hlist_for_each_entry_safe(file, fc, fn, &diri->owned_files, diri_files_list) {
+			key = (struct apk_db_file_hash_key) {
+				.dirname = APK_BLOB_PTR_LEN(diri->dir->name, diri->dir->namelen),
+				.filename = APK_BLOB_PTR_LEN(file->name, file->namelen),
+			};
+			__hlist_del(fc, &diri->owned_files.first);
+			apk_hash_delete_hashed(&db->installed.files, APK_BLOB_BUF(&key),
+					       apk_blob_hash_seed(key.filename, diri->dir->hash));
+			db->installed.stats.files--;
+		}
+		__hlist_del(dc, &ipkg->owned_dirs.first);
+		apk_db_diri_free(db, diri, APK_DIR_FREE);
+	}
+	apk_pkg_uninstall(db, pkg);
+}
+
+static int apk_db_journal_apply(struct apk_database *db, apk_blob_t txn)
+{
+	struct apk_checksum csum;
+	struct apk_package *pkg;
+	struct apk_db_dir_instance *diri;
+	struct hlist_node *n;
+	struct apk_istream is;
+	struct list_head *slots;
+	apk_blob_t b, l, entry = APK_BLOB_NULL;
+	int r = 0, i, num = 0, in_entry = 0;
+
+	/* Modified packages keep their position in the installed list, so
+	 * mark it with a slot before removing the old instance. All old
+	 * instances are removed first, as files may have moved between the
+	 * packages. */
+	for (b = txn; journal_next_line(&b, &l); ) {
+		if (in_entry) {
+			if (l.len == 0) in_entry = 0;
+			continue;
+		}
+		if (l.len == 0) continue;
+		if (l.len < 2 || l.ptr[1] != ':') return -APKE_V2DB_FORMAT;
+		switch (l.ptr[0]) {
+		case 'C':
+			in_entry = 1;
+			num++;
+			break;
+		case '-':
+			break;
+		default:
+			return -APKE_V2DB_FORMAT;
+		}
+	}
+	if (in_entry) return -APKE_V2DB_FORMAT;
+
+	slots = calloc(num ?: 1, sizeof slots[0]);
+	if (!slots) return -ENOMEM;
+
+	for (b = txn, i = 0; journal_next_line(&b, &l); ) {
+		if (in_entry) {
+			if (l.len == 0) in_entry = 0;
+			continue;
+		}
+		if (l.len == 0) continue;
+		if ((r = journal_pull_csum(l, &csum)) < 0) goto err;
+		pkg = apk_db_get_pkg(db, &csum);
+		if (l.ptr[0] == 'C') {
+			in_entry = 1;
+			if (pkg && pkg->ipkg)
+				list_add(&slots[i], &pkg->ipkg->installed_pkgs_list);
+			i++;
+		}
+		if (pkg && pkg->ipkg) apk_db_pkg_forget(db, pkg);
+	}
+
+	for (b = txn, i = 0; journal_next_line(&b, &l); ) {
+		if (!in_entry) {
+			if (l.len == 0 || l.ptr[0] != 'C') continue;
+			in_entry = 1;
+			entry = l;
+			continue;
+		}
+		if (l.len != 0) continue;
+		in_entry = 0;
+
+		entry = APK_BLOB_PTR_PTR(entry.ptr, l.ptr);
+		r = apk_db_index_read(db, apk_istream_from_blob(&is, entry), -1);
+		if (r < 0) goto err;
+		if ((r = journal_pull_csum(entry, &csum)) < 0) goto err;
+		pkg = apk_db_get_pkg(db, &csum);
+		if (!pkg || !pkg->ipkg) {
+			r = -APKE_V2DB_FORMAT;
+			goto err;
+		}
+		/* The entry may have been merged to an existing package */
+		hlist_for_each_entry(diri, n, &pkg->ipkg->owned_dirs, pkg_dirs_list)
+			diri->pkg = pkg;
+		if (slots[i].next) {
+			list_del(&pkg->ipkg->installed_pkgs_list);
+			list_add_tail(&pkg->ipkg->installed_pkgs_list, &slots[i]);
+			list_del(&slots[i]);
+		}
+		i++;
+	}
+
+	/* Drop the removed packages, as they would not exist if the
+	 * installed database was written in full */
+	for (b = txn; journal_next_line(&b, &l); ) {
+		if (l.len < 2 || l.ptr[0] != '-' || l.ptr[1] != ':') continue;
+		if (journal_pull_csum(l, &csum) < 0) continue;
+		pkg = apk_db_get_pkg(db, &csum);
+		if (pkg && !pkg->ipkg && !pkg->repos && !pkg->filename)
+			apk_db_pkg_del(db, pkg);
+	}
+err:
+	for (i = 0; i < num; i++)
+		if (slots[i].next && slots[i].next != LIST_POISON1) list_del(&slots[i]);
+	free(slots);
+	return r;
+}
+
+static int apk_db_journal_replay(struct apk_database *db)
+{
+	struct apk_out *out = &db->ctx->out;
+	char buf[128];
+	apk_blob_t journal, b, l, hdr = APK_BLOB_BUF(buf), txn;
+	int r = 0;
+
+	if (apk_db_installed_stamp(db, &db->installed.journal.base) < 0) return 0;
+	db->installed.journal.base_loaded = 1;
+	db->installed.journal.size = 0;
+
+	journal = apk_blob_from_file(db->root_fd, apk_installed_journal_file);
+	if (APK_BLOB_IS_NULL(journal)) return 0;
+
+	/* A journal for other version of the text database is stale */
+	apk_db_journal_header(db, &hdr);
+	hdr = apk_blob_pushed(APK_BLOB_BUF(buf), hdr);
+	b = journal;
+	if (apk_blob_compare(APK_BLOB_PTR_LEN(b.ptr, min(hdr.len, b.len)), hdr) != 0)
+		goto done;
+	b.ptr += hdr.len;
+	b.len -= hdr.len;
+	db->installed.journal.size = hdr.len;
+
+	for (txn = b; journal_next_line(&b, &l); ) {
+		if (l.len != 2 || l.ptr[0] != '=' || l.ptr[1] != ':') continue;
+		r = apk_db_journal_apply(db, APK_BLOB_PTR_PTR(txn.ptr, l.ptr - 1));
+		if (r < 0) {
+			apk_err(out, "Installed database journal format error (offset %d)",
+				(int)(txn.ptr - journal.ptr));
+			break;
+		}
+		txn = b;
+		db->installed.journal.size = b.ptr - journal.ptr;
+	}
+done:
+	free(journal.ptr);
+	return r;
+}
+
+static int apk_db_journal_append(struct apk_database *db)
+{
+	struct apk_installed_package *ipkg;
+	struct apk_package **ppkg;
+	struct apk_ostream *os;
+	struct stat st;
+	char buf[128];
+	apk_blob_t b;
+	int fd, r;
+
+	fd = openat(db->root_fd, apk_installed_journal_file, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) return -errno;
+
+	/* Drop any partially written transaction */
+	if (ftruncate(fd, db->installed.journal.size) < 0 ||
+	    lseek(fd, db->installed.journal.size, SEEK_SET) < 0) {
+		r = -errno;
+		close(fd);
+		return r;
+	}
+
+	os = apk_ostream_to_fd(dup(fd));
+	if (IS_ERR(os)) {
+		close(fd);
+		return PTR_ERR(os);
+	}
+	if (db->installed.journal.size == 0) {
+		b = APK_BLOB_BUF(buf);
+		apk_db_journal_header(db, &b);
+		b = apk_blob_pushed(APK_BLOB_BUF(buf), b);
+		apk_ostream_write(os, b.ptr, b.len);
+	}
+	foreach_array_item(ppkg, db->installed.journal.removed) {
+		b = APK_BLOB_BUF(buf);
+		apk_blob_push_blob(&b, APK_BLOB_STR("-:"));
+		apk_blob_push_csum(&b, &(*ppkg)->csum);
+		apk_blob_push_blob(&b, APK_BLOB_STR("\n"));
+		b = apk_blob_pushed(APK_BLOB_BUF(buf), b);
+		apk_ostream_write(os, b.ptr, b.len);
+	}
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list) {
+		if (!ipkg->db_dirty) continue;
+		r = apk_db_write_fdb_entry(db, ipkg, os);
+		if (r < 0) {
+			apk_ostream_cancel(os, r);
+			break;
+		}
+	}
+	r = apk_ostream_close(os);
+
+	/* The commit marker is written only after the transaction data is
+	 * on disk, so a crash leaves at most an incomplete transaction. */
+	if (r == 0 && fdatasync(fd) < 0) r = -errno;
+	if (r == 0 && write(fd, "=:\n", 3) != 3) r = -EIO;
+	if (r == 0 && fstat(fd, &st) < 0) r = -errno;
+	close(fd);
+	if (r < 0) return r;
+
+	db->installed.journal.size = st.st_size;
+	return 0;
+}
+
+/* Write the installed database changes to the journal when the changes
+ * are small compared to the whole database, and the journal has not grown
+ * too big. Otherwise rewrite the text database and its snapshot, and
+ * discard the journal. */
+static int apk_db_write_installed(struct apk_database *db)
+{
+	struct apk_db_file_stamp stamp;
+	struct apk_installed_package *ipkg;
+	int r, num_dirty = 0;
+
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list)
+		if (ipkg->db_dirty) num_dirty++;
+	num_dirty += db->installed.journal.removed->num;
+
+	if (db->installed.journal.base_loaded &&
+	    apk_db_installed_stamp(db, &stamp) == 0 &&
+	    memcmp(&stamp, &db->installed.journal.base, sizeof stamp) == 0 &&
+	    num_dirty * APK_DB_JOURNAL_RATIO < db->installed.stats.packages &&
+	    (db->installed.journal.size < APK_DB_JOURNAL_MIN_COMPACT ||
+	     db->installed.journal.size * APK_DB_JOURNAL_RATIO < le64toh(stamp.size))) {
+		if (num_dirty == 0) return 0;
+		r = apk_db_journal_append(db);
+		if (r == 0) goto done;
+		apk_dbg(&db->ctx->out, "Installed database journal not written: %s", apk_error_str(r));
+	}
+
+	r = apk_db_write_fdb(db, apk_ostream_to_file(db->root_fd, apk_installed_file, 0644));
+	if (r < 0) {
+		unlinkat(db->root_fd, apk_installed_snapshot_file, 0);
+		return r;
+	}
+	apk_db_snapshot_write(db);
+	unlinkat(db->root_fd, apk_installed_journal_file, 0);
+	db->installed.journal.size = 0;
+	db->installed.journal.base_loaded =
+		apk_db_installed_stamp(db, &db->installed.journal.base) == 0;
+done:
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list)
+		ipkg->db_dirty = 0;
+	apk_package_array_resize(&db->installed.journal.removed, 0);
+	return 0;
+}
+
+/* Index the installed database without loading the file lists. The file
+ * lists are loaded from the mapped database when first needed. */
+static int apk_db_read_lazy(struct apk_database *db)
+{
+	struct apk_istream *is, bis;
+	apk_blob_t b;
+	int r;
+
+	is = apk_istream_from_file_mmap(db->root_fd, apk_installed_file);
+	if (IS_ERR(is)) return PTR_ERR(is);
+	b = apk_istream_mmap(is);
+	if (APK_BLOB_IS_NULL(b)) {
+		apk_istream_close(is);
+		return -ENOTSUP;
+	}
+	db->installed.lazy_fdb = is;
+	r = apk_db_fdb_read(db, apk_istream_from_blob(&bis, b), -1, 1, 0);
+	return r < 0 ? -APKE_V2DB_FORMAT : r;
+}
+
+/* The write lock is held for the whole write transaction, and is not
+ * taken by read-only opens. Instead the state lock is held exclusively
+ * only while the state files are being replaced, and shared while they
+ * are read, so that readers see the last committed state as a whole
+ * without waiting for the transaction in progress. */
+static int apk_db_state_lock(struct apk_database *db, int operation)
+{
+	int fd;
+
+	if (operation == LOCK_EX)
+		fd = openat(db->root_fd, apk_state_lock_file, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+	else
+		fd = openat(db->root_fd, apk_state_lock_file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -errno;
+	while (flock(fd, operation) < 0) {
+		if (errno == EINTR) continue;
+		close(fd);
+		return -errno;
+	}
+	return fd;
+}
+
+static int apk_db_read_state(struct apk_database *db, int flags)
+{
+	apk_blob_t blob, world;
+	int r, ret = 0, lock_fd;
+
+	/* Read:
+	 * 1. /etc/apk/world
+	 * 2. installed packages db (from the snapshot if it is up to date,
+	 *    or with the file lists loaded on demand if requested)
+	 *    and the changes journaled after it
+	 * 3. triggers db
+	 * 4. scripts db
+	 */
+	lock_fd = apk_db_state_lock(db, LOCK_SH);
+	if (!(flags & APK_OPENF_NO_WORLD)) {
+		blob = world = apk_blob_from_file(db->root_fd, apk_world_file);
+		if (!APK_BLOB_IS_NULL(blob)) {
+			blob = apk_blob_trim(blob);
+			apk_blob_pull_deps(&blob, db, &db->world);
+			free(world.ptr);
+		} else {
 			ret = -ENOENT;
 		}
 	}
 
 	if (!(flags & APK_OPENF_NO_INSTALLED)) {
-		r = apk_db_index_read(db, apk_istream_from_file(db->root_fd, apk_installed_file), -1);
+		r = -ENOENT;
+		if ((flags & (APK_OPENF_LAZY_FILES|APK_OPENF_WRITE)) == APK_OPENF_LAZY_FILES)
+			r = apk_db_read_lazy(db);
+		if (r < 0 && r != -APKE_V2DB_FORMAT)
+			r = apk_db_snapshot_read(db);
+		if (r < 0 && r != -APKE_V2DB_FORMAT && r != -ENOMEM)
+			r = apk_db_index_read(db, apk_istream_from_file(db->root_fd, apk_installed_file), -1);
+		if (r == 0) r = apk_db_journal_replay(db);
 		if (r && r != -ENOENT) ret = r;
 		r = apk_db_triggers_read(db, apk_istream_from_file(db->root_fd, apk_triggers_file));
 		if (r && r != -ENOENT) ret = r;
 	}
 
 	if (!(flags & APK_OPENF_NO_SCRIPTS)) {
-		r = apk_tar_parse(apk_istream_from_file(db->root_fd, apk_scripts_file),
-				  apk_read_script_archive_entry, db, db->id_cache);
-		if (r && r != -ENOENT) ret = r;
+		r = apk_db_scriptdb_read(db);
+		if (r == -ENOENT) db->scripts_dirty = 1;
+		else if (r) ret = r;
 	}
 
+	if (lock_fd >= 0) close(lock_fd);
 	return ret;
 }
 
@@ -1262,9 +2381,39 @@ int apk_db_index_write(struct apk_database *db, struct apk_ostream *os)
 	return ctx.count;
 }
 
+static struct apk_protected_path *protected_path_get(struct apk_protected_path *parent, apk_blob_t comp)
+{
+	struct apk_protected_path **pp, *ppath;
+
+	for (pp = &parent->children; *pp; pp = &(*pp)->next)
+		if (apk_blob_compare(APK_BLOB_STR((*pp)->component), comp) == 0)
+			return *pp;
+
+	ppath = calloc(1, sizeof *ppath + comp.len + 1);
+	if (!ppath) return NULL;
+	memcpy(ppath->component, comp.ptr, comp.len);
+	ppath->component[comp.len] = 0;
+	ppath->wildcard = strpbrk(ppath->component, "*?[\\") != NULL;
+	*pp = ppath;
+	return ppath;
+}
+
+static void protected_path_free(struct apk_protected_path *ppath)
+{
+	struct apk_protected_path *next;
+
+	for (; ppath; ppath = next) {
+		next = ppath->next;
+		protected_path_free(ppath->children);
+		free(ppath);
+	}
+}
+
 static int add_protected_path(void *ctx, apk_blob_t blob)
 {
 	struct apk_database *db = (struct apk_database *) ctx;
+	struct apk_protected_path *ppath;
+	apk_blob_t comp;
 	int protect_mode = APK_PROTECT_NONE;
 
 	/* skip empty lines and comments */
@@ -1293,57 +2442,478 @@ static int add_protected_path(void *ctx, apk_blob_t blob)
 	blob.ptr++;
 	blob.len--;
 
-no_mode_char:
-	/* skip leading and trailing path separators */
-	while (blob.len && blob.ptr[0] == '/')
-		blob.ptr++, blob.len--;
-	while (blob.len && blob.ptr[blob.len-1] == '/')
-		blob.len--;
+no_mode_char:
+	/* skip leading and trailing path separators */
+	while (blob.len && blob.ptr[0] == '/')
+		blob.ptr++, blob.len--;
+	while (blob.len && blob.ptr[blob.len-1] == '/')
+		blob.len--;
+
+	ppath = db->protected_paths;
+	do {
+		if (!apk_blob_split(blob, APK_BLOB_STRLIT("/"), &comp, &blob)) {
+			comp = blob;
+			blob = APK_BLOB_NULL;
+		}
+		ppath = protected_path_get(ppath, comp);
+		if (!ppath) return -ENOMEM;
+		ppath->has_protected |= (protect_mode != APK_PROTECT_NONE);
+	} while (blob.ptr);
+
+	ppath->rule = ++db->num_protected_rules;
+	ppath->protect_mode = protect_mode;
+
+	return 0;
+}
+
+static int file_ends_with_dot_list(const char *file)
+{
+	const char *ext = strrchr(file, '.');
+	if (ext == NULL || strcmp(ext, ".list") != 0)
+		return FALSE;
+	return TRUE;
+}
+
+static int add_protected_paths_from_file(void *ctx, int dirfd, const char *file)
+{
+	struct apk_database *db = (struct apk_database *) ctx;
+	apk_blob_t blob;
+	int r;
+
+	if (!file_ends_with_dot_list(file))
+		return 0;
+
+	blob = apk_blob_from_file(dirfd, file);
+	if (APK_BLOB_IS_NULL(blob))
+		return 0;
+
+	r = apk_blob_for_each_segment(blob, "\n", add_protected_path, db);
+	free(blob.ptr);
+
+	return r;
+}
+
+static void handle_alarm(int sig)
+{
+}
+
+static void mark_in_cache(struct apk_database *db, int dirfd, const char *name, struct apk_package *pkg)
+{
+	if (pkg == NULL)
+		return;
+
+	pkg->repos |= BIT(APK_REPOSITORY_CACHED);
+}
+
+struct apkindex_ctx {
+	struct apk_database *db;
+	struct apk_extract_ctx ectx;
+	int repo, found;
+};
+
+static int load_v2index(struct apk_extract_ctx *ectx, apk_blob_t *desc, struct apk_istream *is)
+{
+	struct apkindex_ctx *ctx = container_of(ectx, struct apkindex_ctx, ectx);
+	struct apk_repository *repo = &ctx->db->repos[ctx->repo];
+
+	repo->description = *desc;
+	*desc = APK_BLOB_NULL;
+	return apk_db_index_read(ctx->db, is, ctx->repo);
+}
+
+static int load_v3index(struct apk_extract_ctx *ectx, struct adb_obj *ndx)
+{
+	struct apkindex_ctx *ctx = container_of(ectx, struct apkindex_ctx, ectx);
+	struct apk_database *db = ctx->db;
+	struct apk_repository *repo = &db->repos[ctx->repo];
+	struct apk_package *pkg;
+	struct adb_obj pkgs, pkginfo;
+	int i;
+
+	repo->description = apk_blob_dup(adb_ro_blob(ndx, ADBI_NDX_DESCRIPTION));
+	adb_ro_obj(ndx, ADBI_NDX_PACKAGES, &pkgs);
+
+	for (i = ADBI_FIRST; i <= adb_ra_num(&pkgs); i++) {
+		adb_ro_obj(&pkgs, i, &pkginfo);
+		pkg = apk_pkg_new();
+		if (!pkg) return -ENOMEM;
+		apk_pkg_from_adb(db, pkg, &pkginfo);
+		pkg->repos |= BIT(ctx->repo);
+		if (!apk_db_pkg_add(db, pkg)) return -APKE_ADB_SCHEMA;
+	}
+
+	return 0;
+}
+
+static const struct apk_extract_ops extract_index = {
+	.v2index = load_v2index,
+	.v3index = load_v3index,
+};
+
+static int load_index(struct apk_database *db, struct apk_istream *is, int repo)
+{
+	struct apkindex_ctx ctx = {
+		.db = db,
+		.repo = repo,
+	};
+	if (IS_ERR(is)) return PTR_ERR(is);
+	apk_extract_init(&ctx.ectx, db->ctx, &extract_index);
+	apk_extract_pipeline(&ctx.ectx);
+	return apk_extract(&ctx.ectx, is);
+}
+
+int apk_db_index_read_file(struct apk_database *db, const char *file, int repo)
+{
+	return load_index(db, apk_istream_from_file(AT_FDCWD, file), repo);
+}
+
+/* While opening the database, the repository indexes are read, decompressed
+ * and verified in parallel. The package database is not thread safe, so
+ * the indexes are parsed afterwards in the repository order. */
+struct repo_index_load {
+	struct apk_extract_ctx ectx;
+	struct adb digest;
+	struct apk_digest index_sha256;
+	struct apk_pkey *signer;
+	char *url;
+	apk_blob_t desc, index;
+	uint64_t read_start, read_end;
+	int repo, tag_id, r;
+	unsigned prefetch : 1;
+	unsigned cached : 1;
+	unsigned has_digest : 1;
+	unsigned want_digest : 1;
+	unsigned v3 : 1;
+};
+
+struct apk_repository_loader {
+	pthread_mutex_t mutex;
+	int num, next;
+	struct repo_index_load load[APK_MAX_REPOS];
+};
+
+static int prefetch_v2index(struct apk_extract_ctx *ectx, apk_blob_t *desc, struct apk_istream *is)
+{
+	struct repo_index_load *l = container_of(ectx, struct repo_index_load, ectx);
+	size_t size = 0;
+	apk_blob_t b;
+	char *ptr;
+	int r;
 
-	*apk_protected_path_array_add(&db->protected_paths) = (struct apk_protected_path) {
-		.relative_pattern = apk_blob_cstr(blob),
-		.protect_mode = protect_mode,
-	};
+	l->desc = *desc;
+	*desc = APK_BLOB_NULL;
+	while ((r = apk_istream_get_all(is, &b)) == 0) {
+		/* Keep room for a terminator after the last line */
+		if (l->index.len + b.len + 1 > size) {
+			size = max(2 * size, l->index.len + b.len + 1);
+			ptr = realloc(l->index.ptr, size);
+			if (!ptr) return -ENOMEM;
+			l->index.ptr = ptr;
+		}
+		memcpy(l->index.ptr + l->index.len, b.ptr, b.len);
+		l->index.len += b.len;
+	}
+	if (l->index.ptr) l->index.ptr[l->index.len] = 0;
+	return r == -APKE_EOF ? 0 : r;
+}
 
+static int prefetch_v3index(struct apk_extract_ctx *ectx, struct adb_obj *ndx)
+{
+	/* Loaded again on the main thread */
+	struct repo_index_load *l = container_of(ectx, struct repo_index_load, ectx);
+	l->v3 = 1;
 	return 0;
 }
 
-static int file_ends_with_dot_list(const char *file)
+static const struct apk_extract_ops prefetch_index = {
+	.v2index = prefetch_v2index,
+	.v3index = prefetch_v3index,
+};
+
+struct repo_loader_ctx {
+	struct apk_database *db;
+	struct apk_repository_loader *rl;
+	int pipeline;
+};
+
+static void *repo_loader_thread(void *pctx)
 {
-	const char *ext = strrchr(file, '.');
-	if (ext == NULL || strcmp(ext, ".list") != 0)
-		return FALSE;
-	return TRUE;
+	struct repo_loader_ctx *ctx = pctx;
+	struct apk_repository_loader *rl = ctx->rl;
+	struct repo_index_load *l;
+	struct apk_istream bis, *is;
+	apk_blob_t b;
+
+	while (1) {
+		pthread_mutex_lock(&rl->mutex);
+		do {
+			l = rl->next < rl->num ? &rl->load[rl->next++] : NULL;
+		} while (l && !l->prefetch);
+		pthread_mutex_unlock(&rl->mutex);
+		if (!l) break;
+
+		l->read_start = apk_time_ns();
+		apk_extract_init(&l->ectx, ctx->db->ctx, &prefetch_index);
+		if (ctx->pipeline) apk_extract_pipeline(&l->ectx);
+		b = APK_BLOB_NULL;
+		if (l->want_digest) {
+			/* The digest is keyed on the very bytes verified here */
+			apk_extract_signer(&l->ectx, &l->signer);
+			b = apk_blob_from_file(ctx->db->cache_fd, apk_url_local_file(l->url));
+		}
+		if (!APK_BLOB_IS_NULL(b) &&
+		    apk_digest_calc(&l->index_sha256, APK_DIGEST_SHA256, b.ptr, b.len) == 0)
+			is = apk_istream_from_blob(&bis, b);
+		else
+			is = apk_istream_from_file(ctx->db->cache_fd, apk_url_local_file(l->url));
+		l->r = apk_extract(&l->ectx, is);
+		free(b.ptr);
+		l->read_end = apk_time_ns();
+	}
+	return NULL;
 }
 
-static int add_protected_paths_from_file(void *ctx, int dirfd, const char *file)
+/* A digest of a cached index holds the parsed packages in the installed
+ * database snapshot format. It is written only for an index signed by a
+ * trusted key, and records the SHA-256 of the index and the key. It is
+ * valid as long as the cached index has that checksum and the key is still
+ * trusted, and is removed whenever the index is downloaded again. */
+static int apk_repo_digest_open(struct apk_database *db, struct repo_index_load *l)
 {
-	struct apk_database *db = (struct apk_database *) ctx;
-	apk_blob_t blob;
-
-	if (!file_ends_with_dot_list(file))
-		return 0;
+	struct apk_trust trust = { .allow_untrusted = 1 };
+	struct apk_digest d;
+	struct adb_obj root;
+	apk_blob_t index, key;
+	char name[128];
+	int r;
 
-	blob = apk_blob_from_file(dirfd, file);
-	if (APK_BLOB_IS_NULL(blob))
-		return 0;
+	r = apk_repo_format_cache_digest(APK_BLOB_BUF(name), &db->repos[l->repo]);
+	if (r < 0) return r;
+	index = apk_blob_from_file(db->cache_fd, l->url);
+	if (APK_BLOB_IS_NULL(index)) return -ENOENT;
+	r = apk_digest_calc(&d, APK_DIGEST_SHA256, index.ptr, index.len);
+	free(index.ptr);
+	if (r < 0) return r;
 
-	apk_blob_for_each_segment(blob, "\n", add_protected_path, db);
-	free(blob.ptr);
+	r = adb_m_open(&l->digest, apk_istream_from_file_mmap(db->cache_fd, name),
+		       ADB_SCHEMA_REPOSITORY_DIGEST, &trust);
+	if (r < 0) return r;
 
+	adb_r_rootobj(&l->digest, &root, &schema_rdig);
+	r = -ESTALE;
+	if (apk_blob_compare(adb_ro_blob(&root, ADBI_RDIG_INDEX_SHA256), APK_DIGEST_BLOB(d)) != 0)
+		goto err;
+	r = -APKE_SIGNATURE_UNTRUSTED;
+	key = adb_ro_blob(&root, ADBI_RDIG_SIGNING_KEY);
+	if (key.len != sizeof l->signer->id ||
+	    !apk_trust_key_by_id(apk_ctx_get_trust(db->ctx), (uint8_t *) key.ptr))
+		goto err;
 	return 0;
+err:
+	adb_free(&l->digest);
+	return r;
 }
 
-static void handle_alarm(int sig)
+static int apk_repo_digest_read(struct apk_database *db, struct repo_index_load *l)
 {
+	struct apk_repository *repo = &db->repos[l->repo];
+	struct apk_package *pkg;
+	struct adb_obj root, pkgs, pkgo;
+	apk_blob_t desc;
+	char name[128];
+	int i, r = 0;
+
+	adb_r_rootobj(&l->digest, &root, &schema_rdig);
+	desc = adb_ro_blob(&root, ADBI_RDIG_DESCRIPTION);
+	if (!APK_BLOB_IS_NULL(desc)) repo->description = apk_blob_dup(desc);
+
+	adb_ro_obj(&root, ADBI_RDIG_PACKAGES, &pkgs);
+	for (i = ADBI_FIRST; i <= adb_ra_num(&pkgs); i++) {
+		pkg = snapshot_r_pkginfo(db, adb_ro_obj(&pkgs, i, &pkgo));
+		if (IS_ERR(pkg)) {
+			r = PTR_ERR(pkg);
+			break;
+		}
+		pkg->repos |= BIT(l->repo);
+		if (apk_db_pkg_add(db, pkg) == NULL) {
+			apk_pkg_free(pkg);
+			r = -APKE_V2DB_FORMAT;
+			break;
+		}
+	}
+	adb_free(&l->digest);
+	if (r == 0) return 0;
+
+	/* Packages loaded so far are merged when the index is read */
+	apk_dbg(&db->ctx->out, "%s: digest not used: %s", l->url, apk_error_str(r));
+	if (apk_repo_format_cache_digest(APK_BLOB_BUF(name), repo) == 0)
+		unlinkat(db->cache_fd, name, 0);
+	free(repo->description.ptr);
+	repo->description = APK_BLOB_NULL;
+	return load_index(db, apk_istream_from_fd_url(db->cache_fd, l->url, apk_db_url_since(db, 0)), l->repo);
 }
 
-static void mark_in_cache(struct apk_database *db, int dirfd, const char *name, struct apk_package *pkg)
+static int apk_repo_digest_write(struct apk_database *db, struct repo_index_load *l)
 {
-	if (pkg == NULL)
-		return;
+	struct apk_repository *repo = &db->repos[l->repo];
+	struct apk_checksum csum;
+	struct apk_package *pkg;
+	struct apk_ostream *os;
+	struct adb ddb;
+	struct adb_obj root, pkgs, pkgo;
+	struct list_head *buckets = NULL;
+	adb_val_t *vals = NULL;
+	char name[128], *buf = NULL, *ptr, *end, *eol;
+	apk_blob_t line;
+	int r;
 
-	pkg->repos |= BIT(APK_REPOSITORY_CACHED);
+	r = apk_repo_format_cache_digest(APK_BLOB_BUF(name), repo);
+	if (r < 0) return r;
+
+	buckets = malloc(sizeof(struct list_head[1024]));
+	vals = malloc(sizeof(adb_val_t[APK_MAX_SNAPSHOT_ENTRIES]));
+	buf = malloc(64 * 1024);
+	if (!buckets || !vals || !buf) {
+		r = -ENOMEM;
+		goto err;
+	}
+
+	adb_w_init_dynamic(&ddb, ADB_SCHEMA_REPOSITORY_DIGEST, buckets, 1024);
+	adb_wo_alloca(&root, &schema_rdig, &ddb);
+	adb_wo_alloca(&pkgo, &schema_idbs_package, &ddb);
+	adb_wo_init(&pkgs, vals, &schema_idbs_package_array, &ddb);
+
+	/* Strings borrowed by the packages are terminated in place, so
+	 * a line ends with either a newline or a terminator. */
+	for (ptr = l->index.ptr, end = ptr + l->index.len; ptr < end; ptr = eol + 1) {
+		eol = strchrnul(ptr, '\n');
+		line = APK_BLOB_PTR_PTR(ptr, eol - 1);
+		if (line.len < 2 || line.ptr[0] != 'C' || line.ptr[1] != ':') continue;
+		if ((r = journal_pull_csum(line, &csum)) < 0) goto err_adb;
+		pkg = apk_db_get_pkg(db, &csum);
+		if (!pkg || !(pkg->repos & BIT(l->repo))) continue;
+		r = snapshot_wo_pkginfo(db, pkg, &pkgo, APK_BLOB_PTR_LEN(buf, 64 * 1024));
+		if (r < 0) goto err_adb;
+		if ((r = snapshot_wa_append(&pkgs, adb_w_obj(&pkgo))) < 0) goto err_adb;
+		if (ddb.adb.len >= ADB_VALUE_MASK) {
+			r = -APKE_ADB_LIMIT;
+			goto err_adb;
+		}
+	}
+	adb_wo_blob(&root, ADBI_RDIG_INDEX_SHA256, APK_DIGEST_BLOB(l->index_sha256));
+	adb_wo_blob(&root, ADBI_RDIG_DESCRIPTION, repo->description);
+	adb_wo_arr(&root, ADBI_RDIG_PACKAGES, &pkgs);
+	adb_wo_blob(&root, ADBI_RDIG_SIGNING_KEY, APK_BLOB_BUF(l->signer->id));
+	adb_w_rootobj(&root);
+
+	os = apk_ostream_to_file(db->cache_fd, name, 0644);
+	if (IS_ERR(os)) {
+		r = PTR_ERR(os);
+		goto err_adb;
+	}
+	adb_c_header(os, &ddb);
+	adb_c_block(os, ADB_BLOCK_ADB, ddb.adb);
+	r = apk_ostream_close(os);
+err_adb:
+	adb_free(&ddb);
+err:
+	free(buf);
+	free(vals);
+	free(buckets);
+	if (r < 0) {
+		unlinkat(db->cache_fd, name, 0);
+		apk_dbg(&db->ctx->out, "%s: digest not written: %s", l->url, apk_error_str(r));
+	}
+	return r;
+}
+
+static void apk_db_repository_loaded(struct apk_database *db, int repo_num, int tag_id, int r)
+{
+	struct apk_url_print urlp;
+
+	if (r != 0) {
+		apk_url_parse(&urlp, db->repos[repo_num].url);
+		apk_warn(&db->ctx->out, "Ignoring " URL_FMT ": %s", URL_PRINTF(urlp), apk_error_str(r));
+		db->available_repos &= ~BIT(repo_num);
+	} else {
+		db->repo_tags[tag_id].allowed_repos |= BIT(repo_num);
+	}
+}
+
+static void apk_db_load_repositories(struct apk_database *db)
+{
+	struct apk_repository_loader *rl = db->repo_loader;
+	struct repo_loader_ctx ctx = { .db = db, .rl = rl };
+	struct repo_index_load *l;
+	struct apk_istream is;
+	pthread_t threads[APK_MAX_INDEX_LOADERS];
+	struct apk_url_print urlp;
+	char name[PATH_MAX];
+	int i, r, num_prefetch = 0, num_threads = 0, timing;
+
+	db->repo_loader = NULL;
+	for (i = 0; i < rl->num; i++) {
+		l = &rl->load[i];
+		if (l->cached && apk_repo_digest_open(db, l) == 0) {
+			l->has_digest = 1;
+			l->prefetch = 0;
+		}
+		/* Only applets updating the cache write the digest, and only
+		 * for an index verified against a trusted key */
+		l->want_digest = l->cached && !(db->ctx->flags & (APK_SIMULATE | APK_ALLOW_UNTRUSTED)) &&
+			(db->ctx->open_flags & (APK_OPENF_WRITE | APK_OPENF_CACHE_WRITE));
+		if (l->prefetch) num_prefetch++;
+	}
+
+	/* The main thread loads indexes too. Load everything shared by
+	 * the workers before starting them. */
+	if (num_prefetch > 1 && db->ctx->num_cpus > 1) {
+		apk_ctx_get_trust(db->ctx);
+		apk_id_cache_resolve_uid(apk_ctx_get_id_cache(db->ctx), APK_BLOB_STRLIT("root"), 0);
+		apk_id_cache_resolve_gid(apk_ctx_get_id_cache(db->ctx), APK_BLOB_STRLIT("root"), 0);
+		num_threads = min(min(num_prefetch, db->ctx->num_cpus), APK_MAX_INDEX_LOADERS) - 1;
+		for (i = 0; i < num_threads; i++)
+			if (pthread_create(&threads[i], NULL, repo_loader_thread, &ctx) != 0) break;
+		num_threads = i;
+	}
+	/* Without worker threads, decompress on a helper thread instead */
+	ctx.pipeline = (num_threads == 0);
+	repo_loader_thread(&ctx);
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < rl->num; i++) {
+		l = &rl->load[i];
+		apk_url_parse(&urlp, db->repos[l->repo].url);
+		snprintf(name, sizeof name, URL_FMT, URL_PRINTF(urlp));
+		if (l->prefetch)
+			apk_timing_add(db->ctx, "index-read", name, l->read_start, l->read_end, l->index.len);
+		timing = apk_timing_begin(db->ctx, "index", name);
+		if (l->has_digest) {
+			r = apk_repo_digest_read(db, l);
+		} else if (!l->prefetch || l->v3) {
+			r = load_index(db, apk_istream_from_fd_url(db->cache_fd, l->url, apk_db_url_since(db, 0)), l->repo);
+		} else {
+			int compat = db->compat_newfeatures || db->compat_notinstallable;
+
+			db->repos[l->repo].description = l->desc;
+			r = l->r;
+			if (!APK_BLOB_IS_NULL(l->index)) {
+				int rr = apk_db_fdb_read(db, apk_istream_from_blob(&is, l->index), l->repo, 0, 1);
+				if (rr != 0) r = rr;
+			}
+			if (r == 0 && l->want_digest && l->signer && l->index_sha256.len &&
+			    compat == (db->compat_newfeatures || db->compat_notinstallable))
+				apk_repo_digest_write(db, l);
+			/* The packages read from the index refer to it */
+			db->repos[l->repo].index = l->index;
+		}
+		apk_timing_end(db->ctx, timing, l->index.len);
+		apk_db_repository_loaded(db, l->repo, l->tag_id, r);
+		free(l->url);
+	}
+	pthread_mutex_destroy(&rl->mutex);
+	free(rl);
 }
 
 static int add_repos_from_file(void *ctx, int dirfd, const char *file)
@@ -1433,6 +3003,21 @@ static int apk_db_name_rdepends(apk_hash_item item, void *pctx)
 	return 0;
 }
 
+/* The reverse dependencies, is_dependency and provider priority of
+ * the names are calculated on first use, or when a package is added
+ * after the database is opened. From then on they are updated
+ * incrementally. */
+void apk_db_calc_rdepends(struct apk_database *db)
+{
+	int timing;
+
+	if (db->rdepends_valid) return;
+	timing = apk_timing_begin(db->ctx, "rdepends", NULL);
+	apk_hash_foreach(&db->available.names, apk_db_name_rdepends, db);
+	db->rdepends_valid = 1;
+	apk_timing_end(db->ctx, timing, 0);
+}
+
 static inline int setup_static_cache(struct apk_database *db, struct apk_ctx *ac)
 {
 	db->cache_dir = apk_static_cache_dir;
@@ -1607,15 +3192,19 @@ static void unmount_proc(struct apk_database *db)
 void apk_db_init(struct apk_database *db)
 {
 	memset(db, 0, sizeof(*db));
-	apk_hash_init(&db->available.names, &pkg_name_hash_ops, 20000);
-	apk_hash_init(&db->available.packages, &pkg_info_hash_ops, 10000);
-	apk_hash_init(&db->installed.dirs, &dir_hash_ops, 20000);
-	apk_hash_init(&db->installed.files, &file_hash_ops, 200000);
+	apk_hash_init(&db->available.names, &pkg_name_hash_ops, 1000);
+	apk_hash_init(&db->available.packages, &pkg_info_hash_ops, 1000);
+	apk_hash_init(&db->installed.dirs, &dir_hash_ops, 1000);
+	apk_hash_init(&db->installed.files, &file_hash_ops, 5000);
 	apk_atom_init(&db->atoms);
+	apk_balloc_init(&db->ba_dirs, 64*1024);
+	apk_balloc_init(&db->ba_diris, 64*1024);
+	apk_balloc_init(&db->ba_files, 256*1024);
 	list_init(&db->installed.packages);
 	list_init(&db->installed.triggers);
 	apk_dependency_array_init(&db->world);
-	apk_protected_path_array_init(&db->protected_paths);
+	apk_package_array_init(&db->installed.journal.removed);
+	db->protected_paths = calloc(1, sizeof *db->protected_paths);
 	db->permanent = 1;
 	db->root_fd = -1;
 }
@@ -1625,7 +3214,7 @@ int apk_db_open(struct apk_database *db, struct apk_ctx *ac)
 	struct apk_out *out = &ac->out;
 	const char *msg = NULL;
 	apk_blob_t blob;
-	int r;
+	int r, timing, timing_open = apk_timing_begin(ac, "open", NULL);
 
 	apk_default_acl_dir = apk_db_acl_atomize(db, 0755, 0, 0);
 	apk_default_acl_file = apk_db_acl_atomize(db, 0644, 0, 0);
@@ -1664,6 +3253,7 @@ int apk_db_open(struct apk_database *db, struct apk_ctx *ac)
 
 	if (ac->open_flags & APK_OPENF_WRITE) {
 		msg = "Unable to lock database";
+		timing = apk_timing_begin(ac, "lock", NULL);
 		db->lock_fd = openat(db->root_fd, apk_lock_file,
 				     O_CREAT | O_RDWR | O_CLOEXEC, 0600);
 		if (db->lock_fd < 0) {
@@ -1687,16 +3277,21 @@ int apk_db_open(struct apk_database *db, struct apk_ctx *ac)
 			alarm(0);
 			sigaction(SIGALRM, &old_sa, NULL);
 		}
+		apk_timing_end(ac, timing, 0);
 
 		if (mount_proc(db) < 0)
 			goto ret_errno;
 	}
 
 	blob = APK_BLOB_STR("+etc\n" "@etc/init.d\n" "!etc/apk\n");
-	apk_blob_for_each_segment(blob, "\n", add_protected_path, db);
-
-	apk_dir_foreach_file(openat(db->root_fd, "etc/apk/protected_paths.d", O_RDONLY | O_CLOEXEC),
-			     add_protected_paths_from_file, db);
+	if (!db->protected_paths ||
+	    apk_blob_for_each_segment(blob, "\n", add_protected_path, db) != 0 ||
+	    apk_dir_foreach_file(openat(db->root_fd, "etc/apk/protected_paths.d", O_RDONLY | O_CLOEXEC),
+				 add_protected_paths_from_file, db) == -ENOMEM) {
+		msg = "Unable to read protected paths";
+		r = -ENOMEM;
+		goto ret_r;
+	}
 
 	/* figure out where to have the cache */
 	if ((r = setup_cache(db, ac)) < 0) {
@@ -1709,7 +3304,9 @@ int apk_db_open(struct apk_database *db, struct apk_ctx *ac)
 		apk_db_read_overlay(db, apk_istream_from_fd(STDIN_FILENO));
 	}
 
+	timing = apk_timing_begin(ac, "read-state", NULL);
 	r = apk_db_read_state(db, ac->open_flags);
+	apk_timing_end(ac, timing, 0);
 	if (r != 0 && !(r == -ENOENT && (ac->open_flags & APK_OPENF_CREATE))) {
 		msg = "Unable to read database state";
 		goto ret_r;
@@ -1724,6 +3321,9 @@ int apk_db_open(struct apk_database *db, struct apk_ctx *ac)
 	if (!(ac->open_flags & APK_OPENF_NO_SYS_REPOS)) {
 		char **repo;
 
+		db->repo_loader = calloc(1, sizeof *db->repo_loader);
+		if (db->repo_loader) pthread_mutex_init(&db->repo_loader->mutex, NULL);
+
 		foreach_array_item(repo, ac->repository_list)
 			apk_db_add_repository(db, APK_BLOB_STR(*repo));
 
@@ -1734,11 +3334,10 @@ int apk_db_open(struct apk_database *db, struct apk_ctx *ac)
 		} else {
 			add_repos_from_file(db, AT_FDCWD, ac->repositories_file);
 		}
+		if (db->repo_loader) apk_db_load_repositories(db);
 
 		if (db->repo_update_counter)
 			apk_db_index_write_nr_cache(db);
-
-		apk_hash_foreach(&db->available.names, apk_db_name_rdepends, db);
 	}
 
 	if (apk_db_cache_active(db) && (ac->open_flags & (APK_OPENF_NO_REPOS|APK_OPENF_NO_INSTALLED)) == 0)
@@ -1753,6 +3352,7 @@ int apk_db_open(struct apk_database *db, struct apk_ctx *ac)
 	}
 
 	ac->db = db;
+	apk_timing_end(ac, timing_open, 0);
 	return 0;
 
 ret_errno:
@@ -1774,7 +3374,7 @@ int apk_db_write_config(struct apk_database *db)
 {
 	struct apk_out *out = &db->ctx->out;
 	struct apk_ostream *os;
-	int r, rr = 0;
+	int r, rr = 0, timing, lock_fd;
 
 	if ((db->ctx->flags & APK_SIMULATE) || db->ctx->root == NULL)
 		return 0;
@@ -1794,6 +3394,8 @@ int apk_db_write_config(struct apk_database *db)
 		return -1;
 	}
 
+	timing = apk_timing_begin(db->ctx, "write-config", NULL);
+	lock_fd = apk_db_state_lock(db, LOCK_EX);
 	if (db->write_arch)
 		apk_blob_to_file(db->root_fd, apk_arch_file, *db->arch, APK_BTF_ADD_EOL);
 
@@ -1805,11 +3407,14 @@ int apk_db_write_config(struct apk_database *db)
 		if (r && !rr) rr = r;
 	}
 
-	r = apk_db_write_fdb(db, apk_ostream_to_file(db->root_fd, apk_installed_file, 0644));
+	r = apk_db_write_installed(db);
 	if (r < 0 && !rr) rr = r;
 
-	r = apk_db_scriptdb_write(db, apk_ostream_to_file(db->root_fd, apk_scripts_file, 0644));
-	if (r < 0 && !rr) rr = r;
+	if (db->scripts_dirty) {
+		r = apk_db_scriptdb_write(db, apk_ostream_to_file(db->root_fd, apk_scripts_file, 0644));
+		if (r < 0 && !rr) rr = r;
+		if (r >= 0) db->scripts_dirty = 0;
+	}
 
 	r = apk_db_index_write_nr_cache(db);
 	if (r < 0 && !rr) rr = r;
@@ -1817,6 +3422,9 @@ int apk_db_write_config(struct apk_database *db)
 	r = apk_db_triggers_write(db, apk_ostream_to_file(db->root_fd, apk_triggers_file, 0644));
 	if (r < 0 && !rr) rr = r;
 
+	if (lock_fd >= 0) close(lock_fd);
+	apk_timing_end(db->ctx, timing, 0);
+
 	if (rr) {
 		apk_err(out, "System state may be inconsistent: failed to write database: %s",
 			apk_error_str(rr));
@@ -1824,11 +3432,29 @@ int apk_db_write_config(struct apk_database *db)
 	return rr;
 }
 
+static void apk_db_alloc_stats(struct apk_database *db)
+{
+	struct apk_out *out = &db->ctx->out;
+	const struct {
+		const char *name;
+		struct apk_balloc *ba;
+	} *p, pools[] = {
+		{ "atoms", &db->atoms.ba },
+		{ "dirs", &db->ba_dirs },
+		{ "dir instances", &db->ba_diris },
+		{ "files", &db->ba_files },
+	};
+
+	apk_out_fmt(out, "", "%-14s %10s %12s %12s", "allocator", "objects", "bytes", "reserved");
+	for (p = pools; p < &pools[ARRAY_SIZE(pools)]; p++)
+		apk_out_fmt(out, "", "%-14s %10zu %12zu %12zu",
+			    p->name, p->ba->num_allocs, p->ba->bytes_used, p->ba->bytes_reserved);
+}
+
 void apk_db_close(struct apk_database *db)
 {
 	struct apk_installed_package *ipkg;
 	struct apk_db_dir_instance *diri;
-	struct apk_protected_path *ppath;
 	struct hlist_node *dc, *dn;
 	int i;
 
@@ -1844,17 +3470,23 @@ void apk_db_close(struct apk_database *db)
 	for (i = APK_REPOSITORY_FIRST_CONFIGURED; i < db->num_repos; i++) {
 		free((void*) db->repos[i].url);
 		free(db->repos[i].description.ptr);
+		free(db->repos[i].index.ptr);
 	}
-	foreach_array_item(ppath, db->protected_paths)
-		free(ppath->relative_pattern);
-	apk_protected_path_array_free(&db->protected_paths);
+	protected_path_free(db->protected_paths);
 
 	apk_dependency_array_free(&db->world);
+	apk_package_array_free(&db->installed.journal.removed);
+	if (db->installed.lazy_fdb) apk_istream_close(db->installed.lazy_fdb);
+	if (db->installed.scriptdb) apk_istream_close(db->installed.scriptdb);
 
 	apk_hash_free(&db->available.packages);
 	apk_hash_free(&db->available.names);
 	apk_hash_free(&db->installed.files);
 	apk_hash_free(&db->installed.dirs);
+	if (db->ctx && (db->ctx->flags & APK_ALLOC_STATS)) apk_db_alloc_stats(db);
+	apk_balloc_destroy(&db->ba_files);
+	apk_balloc_destroy(&db->ba_diris);
+	apk_balloc_destroy(&db->ba_dirs);
 	apk_atom_free(&db->atoms);
 
 	unmount_proc(db);
@@ -1900,35 +3532,195 @@ int apk_db_get_tag_id(struct apk_database *db, apk_blob_t tag)
 	return i;
 }
 
-static int fire_triggers(apk_hash_item item, void *ctx)
+/* The directory triggers are compiled into a tree of path components.
+ * Components with glob characters are matched with fnmatch against a
+ * single path component, which is equivalent to FNM_PATHNAME matching
+ * of the full path. Globs which cannot be split to components (escapes
+ * or brackets spanning a slash) are matched against the full path. */
+struct trigger_owner {
+	struct trigger_owner *next;
+	unsigned int idx;
+};
+
+struct trigger_node {
+	struct trigger_node *next, *children;
+	struct trigger_owner *owners;
+	unsigned int wildcard : 1;
+	char component[];
+};
+
+struct trigger_glob {
+	struct trigger_glob *next;
+	const char *glob;
+	unsigned int idx;
+};
+
+struct trigger_matcher {
+	struct apk_database *db;
+	struct apk_balloc ba;
+	struct trigger_node *root;
+	struct trigger_glob *globs;
+	struct apk_installed_package **ipkgs;
+	char *matched;
+	unsigned int num;
+	unsigned int run_all : 1;
+};
+
+static int trigger_glob_splittable(const char *glob)
+{
+	const char *p;
+
+	if (strchr(glob, '\\')) return 0;
+	for (p = glob; (p = strchr(p, '[')) != NULL; p++) {
+		const char *end = p + 1, *slash = strchr(p, '/');
+		if (*end == '!' || *end == '^') end++;
+		if (*end == ']') end++;
+		end = strchr(end, ']');
+		if (!end || (slash && slash < end)) return 0;
+	}
+	return 1;
+}
+
+static struct trigger_node *trigger_node_get(struct trigger_matcher *tm, struct trigger_node **pn, apk_blob_t comp)
+{
+	struct trigger_node *n;
+
+	for (; *pn; pn = &(*pn)->next) {
+		n = *pn;
+		if (apk_blob_compare(APK_BLOB_STR(n->component), comp) == 0) return n;
+	}
+	n = apk_balloc_new0_extra(&tm->ba, struct trigger_node, comp.len + 1);
+	if (!n) return NULL;
+	memcpy(n->component, comp.ptr, comp.len);
+	n->component[comp.len] = 0;
+	n->wildcard = strpbrk(n->component, "*?[") != NULL;
+	*pn = n;
+	return n;
+}
+
+static int trigger_matcher_add(struct trigger_matcher *tm, unsigned int idx, const char *glob)
+{
+	struct trigger_node **pn = &tm->root, *n = NULL;
+	struct trigger_owner *o;
+	struct trigger_glob *g;
+	apk_blob_t b = APK_BLOB_STR(glob + 1), comp;
+
+	if (!trigger_glob_splittable(glob)) {
+		g = apk_balloc_new(&tm->ba, struct trigger_glob);
+		if (!g) return -ENOMEM;
+		*g = (struct trigger_glob) { .next = tm->globs, .glob = glob, .idx = idx };
+		tm->globs = g;
+		return 0;
+	}
+
+	do {
+		if (!apk_blob_split(b, APK_BLOB_STRLIT("/"), &comp, &b)) {
+			comp = b;
+			b = APK_BLOB_NULL;
+		}
+		n = trigger_node_get(tm, pn, comp);
+		if (!n) return -ENOMEM;
+		pn = &n->children;
+	} while (b.ptr);
+
+	o = apk_balloc_new(&tm->ba, struct trigger_owner);
+	if (!o) return -ENOMEM;
+	*o = (struct trigger_owner) { .next = n->owners, .idx = idx };
+	n->owners = o;
+	return 0;
+}
+
+static int trigger_matcher_init(struct trigger_matcher *tm, struct apk_database *db)
 {
-	struct apk_database *db = (struct apk_database *) ctx;
-	struct apk_db_dir *dbd = (struct apk_db_dir *) item;
 	struct apk_installed_package *ipkg;
-	int i;
+	unsigned int num = 0;
+	int i, r;
+
+	*tm = (struct trigger_matcher) { .db = db };
+	apk_balloc_init(&tm->ba, 16*1024);
+
+	list_for_each_entry(ipkg, &db->installed.triggers, trigger_pkgs_list)
+		num++;
+	if (!num) return 0;
+
+	tm->ipkgs = apk_balloc_aligned(&tm->ba, num * sizeof tm->ipkgs[0], __alignof__(tm->ipkgs[0]));
+	tm->matched = apk_balloc_aligned(&tm->ba, num, 1);
+	if (!tm->ipkgs || !tm->matched) return -ENOMEM;
 
 	list_for_each_entry(ipkg, &db->installed.triggers, trigger_pkgs_list) {
-		if (!ipkg->run_all_triggers && !dbd->modified)
+		tm->ipkgs[tm->num] = ipkg;
+		if (ipkg->run_all_triggers) tm->run_all = 1;
+		for (i = 0; i < ipkg->triggers->num; i++) {
+			if (ipkg->triggers->item[i][0] != '/') continue;
+			r = trigger_matcher_add(tm, tm->num, ipkg->triggers->item[i]);
+			if (r) return r;
+		}
+		tm->num++;
+	}
+	return 0;
+}
+
+static void trigger_matcher_match(struct trigger_matcher *tm, struct trigger_node *n, char *comp, char *end)
+{
+	char *next = comp + strlen(comp) + 1;
+	struct trigger_owner *o;
+
+	for (; n; n = n->next) {
+		if (n->wildcard) {
+			if (fnmatch(n->component, comp, FNM_PATHNAME) != 0) continue;
+		} else {
+			if (strcmp(n->component, comp) != 0) continue;
+		}
+		if (next < end) {
+			trigger_matcher_match(tm, n->children, next, end);
 			continue;
+		}
+		for (o = n->owners; o; o = o->next)
+			tm->matched[o->idx] = 1;
+	}
+}
 
-		for (i = 0; i < ipkg->triggers->num; i++) {
-			if (ipkg->triggers->item[i][0] != '/')
-				continue;
+static int fire_triggers(apk_hash_item item, void *ctx)
+{
+	struct trigger_matcher *tm = ctx;
+	struct apk_database *db = tm->db;
+	struct apk_db_dir *dbd = (struct apk_db_dir *) item;
+	struct apk_installed_package *ipkg;
+	struct trigger_glob *g;
+	char buf[PATH_MAX], *p;
+	unsigned int i;
+	size_t len;
 
-			if (fnmatch(ipkg->triggers->item[i], dbd->rooted_name,
-				    FNM_PATHNAME) != 0)
-				continue;
+	if (!dbd->modified && !tm->run_all)
+		return 0;
 
-			/* And place holder for script name */
-			if (ipkg->pending_triggers->num == 0) {
-				*apk_string_array_add(&ipkg->pending_triggers) =
-					NULL;
-				db->pending_triggers++;
-			}
+	len = strlen(dbd->rooted_name);
+	if (len >= sizeof buf) return 0;
+	memcpy(buf, dbd->rooted_name, len + 1);
+	for (p = buf; (p = strchr(p, '/')) != NULL; p++)
+		*p = 0;
+
+	memset(tm->matched, 0, tm->num);
+	trigger_matcher_match(tm, tm->root, &buf[1], &buf[len + 1]);
+	for (g = tm->globs; g; g = g->next)
+		if (fnmatch(g->glob, dbd->rooted_name, FNM_PATHNAME) == 0)
+			tm->matched[g->idx] = 1;
+
+	for (i = 0; i < tm->num; i++) {
+		ipkg = tm->ipkgs[i];
+		if (!tm->matched[i])
+			continue;
+		if (!ipkg->run_all_triggers && !dbd->modified)
+			continue;
+
+		/* And place holder for script name */
+		if (ipkg->pending_triggers->num == 0) {
 			*apk_string_array_add(&ipkg->pending_triggers) =
-				dbd->rooted_name;
-			break;
+				NULL;
+			db->pending_triggers++;
 		}
+		*apk_string_array_add(&ipkg->pending_triggers) =
+			dbd->rooted_name;
 	}
 
 	return 0;
@@ -1936,7 +3728,14 @@ static int fire_triggers(apk_hash_item item, void *ctx)
 
 int apk_db_fire_triggers(struct apk_database *db)
 {
-	apk_hash_foreach(&db->installed.dirs, fire_triggers, db);
+	struct trigger_matcher tm;
+	int r;
+
+	r = trigger_matcher_init(&tm, db);
+	if (r == 0 && tm.num)
+		apk_hash_foreach(&db->installed.dirs, fire_triggers, &tm);
+	apk_balloc_destroy(&tm.ba);
+	if (r < 0) return r;
 	return db->pending_triggers;
 }
 
@@ -2119,6 +3918,8 @@ struct apk_package *apk_db_get_file_owner(struct apk_database *db,
 	struct apk_db_file *dbf;
 	struct apk_db_file_hash_key key;
 
+	apk_db_load_files(db);
+
 	if (filename.len && filename.ptr[0] == '/')
 		filename.len--, filename.ptr++;
 
@@ -2190,67 +3991,6 @@ static int apk_repository_update(struct apk_database *db, struct apk_repository
 	return r;
 }
 
-struct apkindex_ctx {
-	struct apk_database *db;
-	struct apk_extract_ctx ectx;
-	int repo, found;
-};
-
-static int load_v2index(struct apk_extract_ctx *ectx, apk_blob_t *desc, struct apk_istream *is)
-{
-	struct apkindex_ctx *ctx = container_of(ectx, struct apkindex_ctx, ectx);
-	struct apk_repository *repo = &ctx->db->repos[ctx->repo];
-
-	repo->description = *desc;
-	*desc = APK_BLOB_NULL;
-	return apk_db_index_read(ctx->db, is, ctx->repo);
-}
-
-static int load_v3index(struct apk_extract_ctx *ectx, struct adb_obj *ndx)
-{
-	struct apkindex_ctx *ctx = container_of(ectx, struct apkindex_ctx, ectx);
-	struct apk_database *db = ctx->db;
-	struct apk_repository *repo = &db->repos[ctx->repo];
-	struct apk_package *pkg;
-	struct adb_obj pkgs, pkginfo;
-	int i;
-
-	repo->description = apk_blob_dup(adb_ro_blob(ndx, ADBI_NDX_DESCRIPTION));
-	adb_ro_obj(ndx, ADBI_NDX_PACKAGES, &pkgs);
-
-	for (i = ADBI_FIRST; i <= adb_ra_num(&pkgs); i++) {
-		adb_ro_obj(&pkgs, i, &pkginfo);
-		pkg = apk_pkg_new();
-		if (!pkg) return -ENOMEM;
-		apk_pkg_from_adb(db, pkg, &pkginfo);
-		pkg->repos |= BIT(ctx->repo);
-		if (!apk_db_pkg_add(db, pkg)) return -APKE_ADB_SCHEMA;
-	}
-
-	return 0;
-}
-
-static const struct apk_extract_ops extract_index = {
-	.v2index = load_v2index,
-	.v3index = load_v3index,
-};
-
-static int load_index(struct apk_database *db, struct apk_istream *is, int repo)
-{
-	struct apkindex_ctx ctx = {
-		.db = db,
-		.repo = repo,
-	};
-	if (IS_ERR(is)) return PTR_ERR(is);
-	apk_extract_init(&ctx.ectx, db->ctx, &extract_index);
-	return apk_extract(&ctx.ectx, is);
-}
-
-int apk_db_index_read_file(struct apk_database *db, const char *file, int repo)
-{
-	return load_index(db, apk_istream_from_file(AT_FDCWD, file), repo);
-}
-
 int apk_db_add_repository(apk_database_t _db, apk_blob_t _repository)
 {
 	struct apk_database *db = _db.db;
@@ -2258,7 +3998,7 @@ int apk_db_add_repository(apk_database_t _db, apk_blob_t _repository)
 	struct apk_repository *repo;
 	struct apk_url_print urlp;
 	apk_blob_t brepo, btag;
-	int repo_num, r, tag_id = 0;
+	int repo_num, r, tag_id = 0, cached = 0;
 	char buf[PATH_MAX], *url;
 
 	brepo = _repository;
@@ -2304,23 +4044,28 @@ int apk_db_add_repository(apk_database_t _db, apk_blob_t _repository)
 		} else {
 			if (db->autoupdate) apk_repository_update(db, repo);
 			r = apk_repo_format_cache_index(APK_BLOB_BUF(buf), repo);
+			cached = 1;
 		}
 	} else {
 		db->local_repos |= BIT(repo_num);
 		db->available_repos |= BIT(repo_num);
 		r = apk_repo_format_real_url(db->arch, repo, NULL, buf, sizeof(buf), &urlp);
 	}
+	if (r == 0 && db->repo_loader) {
+		struct apk_repository_loader *rl = db->repo_loader;
+		rl->load[rl->num++] = (struct repo_index_load) {
+			.url = strdup(buf),
+			.repo = repo_num,
+			.tag_id = tag_id,
+			.prefetch = apk_url_local_file(buf) != NULL,
+			.cached = cached,
+		};
+		return 0;
+	}
 	if (r == 0) {
 		r = load_index(db, apk_istream_from_fd_url(db->cache_fd, buf, apk_db_url_since(db, 0)), repo_num);
 	}
-
-	if (r != 0) {
-		apk_url_parse(&urlp, repo->url);
-		apk_warn(out, "Ignoring " URL_FMT ": %s", URL_PRINTF(urlp), apk_error_str(r));
-		db->available_repos &= ~BIT(repo_num);
-	} else {
-		db->repo_tags[tag_id].allowed_repos |= BIT(repo_num);
-	}
+	apk_db_repository_loaded(db, repo_num, tag_id, r);
 
 	return 0;
 }
@@ -2437,6 +4182,7 @@ static int apk_db_install_v3meta(struct apk_extract_ctx *ectx, struct adb_obj *p
 		if (APK_BLOB_IS_NULL(b)) continue;
 		apk_ipkg_assign_script(ipkg, i, apk_blob_dup(b));
 		ctx->script_pending |= (i == ctx->script);
+		db->scripts_dirty = 1;
 	}
 
 	apk_string_array_resize(&ipkg->triggers, 0);
@@ -2455,6 +4201,7 @@ static int apk_db_install_script(struct apk_extract_ctx *ectx, unsigned int type
 	struct apk_package *pkg = ctx->pkg;
 	apk_ipkg_add_script(pkg->ipkg, is, type, size);
 	ctx->script_pending |= (type == ctx->script);
+	ctx->db->scripts_dirty = 1;
 	return 0;
 }
 
@@ -2596,7 +4343,7 @@ static int apk_db_install_file(struct apk_extract_ctx *ectx, const struct apk_fi
 
 		if (opkg != pkg) {
 			/* Create the file entry without adding it to hash */
-			file = apk_db_file_new(diri, bfile, &ctx->file_diri_node);
+			file = apk_db_file_new(db, diri, bfile, &ctx->file_diri_node);
 		}
 
 		apk_dbg2(out, "%s", ae->name);
@@ -2790,6 +4537,7 @@ static void apk_db_migrate_files(struct apk_database *db,
 			// Claim ownership of the file in db
 			if (ofile != file) {
 				if (ofile != NULL) {
+					ofile->diri->pkg->ipkg->db_dirty = 1;
 					hlist_del(&ofile->diri_files_list,
 						&ofile->diri->owned_files);
 					apk_hash_delete_hashed(&db->installed.files,
@@ -2867,6 +4615,7 @@ static int apk_db_unpack_pkg(struct apk_database *db,
 	};
 	apk_extract_init(&ctx.ectx, db->ctx, &extract_installer);
 	apk_extract_verify_identity(&ctx.ectx, &pkg->csum);
+	apk_extract_pipeline(&ctx.ectx);
 	r = apk_extract(&ctx.ectx, is);
 	if (need_copy && r == 0) pkg->repos |= BIT(APK_REPOSITORY_CACHED);
 	if (r != 0) goto err_msg;
@@ -2901,12 +4650,14 @@ int apk_db_install_pkg(struct apk_database *db, struct apk_package *oldpkg,
 		apk_ipkg_run_script(ipkg, db, APK_SCRIPT_PRE_DEINSTALL, script_args);
 		apk_db_purge_pkg(db, ipkg, TRUE);
 		apk_ipkg_run_script(ipkg, db, APK_SCRIPT_POST_DEINSTALL, script_args);
+		*apk_package_array_add(&db->installed.journal.removed) = oldpkg;
 		apk_pkg_uninstall(db, oldpkg);
 		goto ret_r;
 	}
 
 	/* Install the new stuff */
 	ipkg = apk_pkg_install(db, newpkg);
+	ipkg->db_dirty = 1;
 	ipkg->run_all_triggers = 1;
 	ipkg->broken_script = 0;
 	ipkg->broken_files = 0;
@@ -2923,6 +4674,7 @@ int apk_db_install_pkg(struct apk_database *db, struct apk_package *oldpkg,
 		if (r != 0) {
 			if (oldpkg != newpkg)
 				apk_db_purge_pkg(db, ipkg, FALSE);
+			*apk_package_array_add(&db->installed.journal.removed) = newpkg;
 			apk_pkg_uninstall(db, newpkg);
 			goto ret_r;
 		}
@@ -2931,6 +4683,7 @@ int apk_db_install_pkg(struct apk_database *db, struct apk_package *oldpkg,
 
 	if (oldpkg != NULL && oldpkg != newpkg && oldpkg->ipkg != NULL) {
 		apk_db_purge_pkg(db, oldpkg->ipkg, TRUE);
+		*apk_package_array_add(&db->installed.journal.removed) = oldpkg;
 		apk_pkg_uninstall(db, oldpkg);
 	}
 
@@ -0,0 +1,266 @@
+/* delta.c - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+
+#include "apk_defines.h"
+#include "apk_crypto.h"
+#include "apk_delta.h"
+
+#define DELTA_ID_BYTES		8
+#define DELTA_MIN_COPY		32
+#define DELTA_MAX_TARGET	(1024*1024*1024)
+
+/* The target size comes from a header which is verified only once the
+ * whole target is built. A delta carries the changes between two index
+ * updates, so bound the allocation by the size of the base it applies to. */
+#define DELTA_MAX_GROWTH(base_len)	(2 * (size_t)(base_len) + 1024*1024)
+
+/* zlib full flush points end with an empty stored block. Gzip streams
+ * written with flush points at content defined positions compress each
+ * chunk between them identically in all versions of the file. Splitting
+ * at the marker finds the chunks; a false match inside compressed data
+ * only makes an extra split. */
+static const char sync_marker[] = { 0x00, 0x00, 0xff, 0xff };
+
+struct delta_segment {
+	unsigned long hash;
+	size_t offset, len;
+};
+
+struct delta_writer {
+	struct apk_ostream *os;
+	apk_blob_t target;
+	struct apk_delta_op op;
+	size_t data_offset;
+};
+
+int apk_delta_format_name(apk_blob_t to, apk_blob_t base)
+{
+	struct apk_digest d;
+	int r;
+
+	/* APKINDEX.0123456789abcdef.delta */
+	r = apk_digest_calc(&d, APK_DIGEST_SHA256, base.ptr, base.len);
+	if (r < 0) return r;
+	apk_blob_push_blob(&to, APK_BLOB_STR("APKINDEX."));
+	apk_blob_push_hexdump(&to, APK_BLOB_PTR_LEN((char *) d.data, DELTA_ID_BYTES));
+	apk_blob_push_blob(&to, APK_BLOB_STR(".delta"));
+	apk_blob_push_blob(&to, APK_BLOB_PTR_LEN("", 1));
+	if (APK_BLOB_IS_NULL(to))
+		return -ENOBUFS;
+	return 0;
+}
+
+static size_t next_segment(apk_blob_t b, size_t offset)
+{
+	char *end = memmem(b.ptr + offset, b.len - offset, sync_marker, sizeof sync_marker);
+	if (!end) return b.len - offset;
+	return end + sizeof sync_marker - (b.ptr + offset);
+}
+
+static int segment_cmp(const void *p1, const void *p2)
+{
+	const struct delta_segment *s1 = p1, *s2 = p2;
+	if (s1->hash != s2->hash) return s1->hash < s2->hash ? -1 : 1;
+	if (s1->len != s2->len) return s1->len < s2->len ? -1 : 1;
+	return s1->offset < s2->offset ? -1 : (s1->offset > s2->offset);
+}
+
+static struct delta_segment *find_segment(struct delta_segment *segs, size_t num, apk_blob_t base, apk_blob_t seg)
+{
+	struct delta_segment key = { .hash = apk_blob_hash(seg), .len = seg.len };
+	size_t lo = 0, hi = num, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (segment_cmp(&segs[mid], &key) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	for (; lo < num && segs[lo].hash == key.hash && segs[lo].len == key.len; lo++)
+		if (memcmp(base.ptr + segs[lo].offset, seg.ptr, seg.len) == 0)
+			return &segs[lo];
+	return NULL;
+}
+
+static int delta_flush(struct delta_writer *w)
+{
+	struct apk_delta_op op = {
+		.type = htole32(w->op.type),
+		.len = htole32(w->op.len),
+		.offset = htole64(w->op.offset),
+	};
+	int r;
+
+	if (!w->op.len) return 0;
+	r = apk_ostream_write(w->os, &op, sizeof op);
+	if (r < 0) return r;
+	if (w->op.type == APK_DELTA_OP_DATA) {
+		r = apk_ostream_write(w->os, w->target.ptr + w->data_offset, w->op.len);
+		if (r < 0) return r;
+	}
+	w->op.len = 0;
+	return 0;
+}
+
+static int delta_emit(struct delta_writer *w, int type, size_t offset, size_t len, size_t target_offset)
+{
+	int r;
+
+	if (w->op.len && w->op.type == type && w->op.len + len <= UINT32_MAX &&
+	    (type == APK_DELTA_OP_DATA || w->op.offset + w->op.len == offset)) {
+		w->op.len += len;
+		return 0;
+	}
+	r = delta_flush(w);
+	if (r < 0) return r;
+	w->op = (struct apk_delta_op) { .type = type, .len = len, .offset = offset };
+	w->data_offset = target_offset;
+	return 0;
+}
+
+int apk_delta_create(apk_blob_t base, apk_blob_t target, struct apk_ostream *os)
+{
+	struct apk_delta_header hdr = {
+		.magic = htole32(APK_DELTA_MAGIC),
+		.version = htole32(APK_DELTA_VERSION),
+		.target_size = htole64(target.len),
+	};
+	struct delta_writer w = { .os = os, .target = target };
+	struct delta_segment *segs = NULL, *s;
+	struct apk_digest d;
+	size_t num = 0, alloc = 0, off, len;
+	int r;
+
+	if (IS_ERR(os)) return PTR_ERR(os);
+
+	/* Clients would reject it */
+	r = -EFBIG;
+	if (target.len > DELTA_MAX_TARGET || target.len > DELTA_MAX_GROWTH(base.len)) goto err;
+
+	for (off = 0; off < base.len; off += len) {
+		len = next_segment(base, off);
+		if (len < DELTA_MIN_COPY) continue;
+		if (num == alloc) {
+			alloc = alloc ? alloc * 2 : 256;
+			s = realloc(segs, alloc * sizeof *segs);
+			if (!s) {
+				r = -ENOMEM;
+				goto err;
+			}
+			segs = s;
+		}
+		segs[num++] = (struct delta_segment) {
+			.hash = apk_blob_hash(APK_BLOB_PTR_LEN(base.ptr + off, len)),
+			.offset = off,
+			.len = len,
+		};
+	}
+	qsort(segs, num, sizeof *segs, segment_cmp);
+
+	r = apk_digest_calc(&d, APK_DIGEST_SHA256, base.ptr, base.len);
+	if (r < 0) goto err;
+	memcpy(hdr.base_sha256, d.data, sizeof hdr.base_sha256);
+	r = apk_digest_calc(&d, APK_DIGEST_SHA256, target.ptr, target.len);
+	if (r < 0) goto err;
+	memcpy(hdr.target_sha256, d.data, sizeof hdr.target_sha256);
+	r = apk_ostream_write(os, &hdr, sizeof hdr);
+	if (r < 0) goto err;
+
+	for (off = 0; off < target.len; off += len) {
+		len = next_segment(target, off);
+		s = NULL;
+		if (len >= DELTA_MIN_COPY)
+			s = find_segment(segs, num, base, APK_BLOB_PTR_LEN(target.ptr + off, len));
+		if (s) r = delta_emit(&w, APK_DELTA_OP_COPY, s->offset, len, off);
+		else r = delta_emit(&w, APK_DELTA_OP_DATA, 0, len, off);
+		if (r < 0) goto err;
+	}
+	r = delta_flush(&w);
+err:
+	free(segs);
+	if (r < 0) apk_ostream_cancel(os, r);
+	return apk_ostream_close(os);
+}
+
+int apk_delta_apply(apk_blob_t base, struct apk_istream *is, apk_blob_t *target)
+{
+	struct apk_delta_header hdr;
+	struct apk_delta_op op;
+	struct apk_digest d;
+	uint8_t *buf = NULL;
+	size_t pos = 0, size, len, offset;
+	ssize_t n;
+	int r;
+
+	*target = APK_BLOB_NULL;
+	if (IS_ERR(is)) return PTR_ERR(is);
+
+	r = apk_istream_read(is, &hdr, sizeof hdr);
+	if (r < 0) goto err;
+	r = -APKE_DELTA_FORMAT;
+	if (hdr.magic != htole32(APK_DELTA_MAGIC) ||
+	    hdr.version != htole32(APK_DELTA_VERSION))
+		goto err;
+	size = le64toh(hdr.target_size);
+	r = -EFBIG;
+	if (size > DELTA_MAX_TARGET || size > DELTA_MAX_GROWTH(base.len)) goto err;
+
+	r = apk_digest_calc(&d, APK_DIGEST_SHA256, base.ptr, base.len);
+	if (r < 0) goto err;
+	r = -APKE_DELTA_FORMAT;
+	if (memcmp(d.data, hdr.base_sha256, sizeof hdr.base_sha256) != 0) goto err;
+
+	r = -ENOMEM;
+	buf = malloc(size ?: 1);
+	if (!buf) goto err;
+
+	while ((n = apk_istream_read_max(is, &op, sizeof op)) > 0) {
+		r = -APKE_DELTA_FORMAT;
+		if (n != sizeof op) goto err;
+		len = le32toh(op.len);
+		offset = le64toh(op.offset);
+		if (len > size - pos) goto err;
+		switch (le32toh(op.type)) {
+		case APK_DELTA_OP_COPY:
+			if (offset > base.len || len > base.len - offset) goto err;
+			memcpy(&buf[pos], base.ptr + offset, len);
+			break;
+		case APK_DELTA_OP_DATA:
+			r = apk_istream_read(is, &buf[pos], len);
+			if (r < 0) goto err;
+			break;
+		default:
+			goto err;
+		}
+		pos += len;
+	}
+	r = n;
+	if (r < 0) goto err;
+	r = -APKE_DELTA_FORMAT;
+	if (pos != size) goto err;
+
+	r = apk_digest_calc(&d, APK_DIGEST_SHA256, buf, size);
+	if (r < 0) goto err;
+	r = -APKE_FILE_INTEGRITY;
+	if (memcmp(d.data, hdr.target_sha256, sizeof hdr.target_sha256) != 0) goto err;
+
+	r = apk_istream_close(is);
+	if (r < 0) {
+		free(buf);
+		return r;
+	}
+	*target = APK_BLOB_PTR_LEN((char *) buf, size);
+	return 0;
+err:
+	free(buf);
+	return apk_istream_close_error(is, r);
+}
@@ -36,6 +36,7 @@ struct apk_sign_ctx {
 	struct {
 		apk_blob_t data;
 		EVP_PKEY *pkey;
+		struct apk_pkey *key;
 		char *identity;
 	} signature;
 };
@@ -166,6 +167,7 @@ static int apk_sign_ctx_process_file(struct apk_sign_ctx *ctx, const struct apk_
 	if (pkey) {
 		ctx->md = md;
 		ctx->signature.pkey = pkey->key;
+		ctx->signature.key = pkey;
 		ctx->signature.data = apk_blob_from_istream(is, fi->size);
 	}
 	return 0;
@@ -177,7 +179,9 @@ static int apk_sign_ctx_process_file(struct apk_sign_ctx *ctx, const struct apk_
 	actually select which signature is to be verified and load the corresponding
 	public key into the context object, and	apk_sign_ctx_parse_pkginfo_line()
 	needs to be called when handling the .PKGINFO file to find any applicable
-	datahash and load it into the context for this function to check against. */
+	datahash and load it into the context for this function to check against.
+	With a pipelined stream the APK_MPART_DATA parts are hashed on a helper
+	thread, so only this function may touch the digest context. */
 static int apk_sign_ctx_mpart_cb(void *ctx, int part, apk_blob_t data)
 {
 	struct apk_sign_ctx *sctx = (struct apk_sign_ctx *) ctx;
@@ -340,6 +344,7 @@ int apk_extract_v2(struct apk_extract_ctx *ectx, struct apk_istream *is)
 	struct apk_ctx *ac = ectx->ac;
 	struct apk_trust *trust = apk_ctx_get_trust(ac);
 	struct apk_sign_ctx sctx;
+	struct apk_istream *gzis;
 	int r, action;
 
 	if (ectx->generate_identity)
@@ -352,13 +357,16 @@ int apk_extract_v2(struct apk_extract_ctx *ectx, struct apk_istream *is)
 	if (!ectx->ops) ectx->ops = &extract_v2verify_ops;
 	ectx->pctx = &sctx;
 	apk_sign_ctx_init(&sctx, action, ectx->identity, trust);
-	r = apk_tar_parse(
-		apk_istream_gunzip_mpart(is, apk_sign_ctx_mpart_cb, &sctx),
-		apk_extract_v2_entry, ectx, apk_ctx_get_id_cache(ac));
+	if (ectx->pipeline)
+		gzis = apk_istream_gunzip_pipeline(is, apk_sign_ctx_mpart_cb, &sctx);
+	else
+		gzis = apk_istream_gunzip_mpart(is, apk_sign_ctx_mpart_cb, &sctx);
+	r = apk_tar_parse(gzis, apk_extract_v2_entry, ectx, apk_ctx_get_id_cache(ac));
 	if (r == -ECANCELED) r = 0;
 	if ((r == 0 || r == -APKE_EOF) && !ectx->is_package && !ectx->is_index)
 		r = ectx->ops->v2index ? -APKE_V2NDX_FORMAT : -APKE_V2PKG_FORMAT;
 	if (ectx->generate_identity) *ectx->identity = sctx.identity;
+	if (ectx->signer) *ectx->signer = (r == 0 && sctx.control_verified) ? sctx.signature.key : NULL;
 	apk_sign_ctx_free(&sctx);
 	free(ectx->desc.ptr);
 	apk_extract_reset(ectx);
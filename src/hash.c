@@ -10,55 +10,91 @@
 #include "apk_defines.h"
 #include "apk_hash.h"
 
+#define APK_HASH_MIN_BUCKETS	64
+
+static void apk_hash_rehash(struct apk_hash *h, size_t num_buckets)
+{
+	struct apk_hash_array *buckets;
+	struct hlist_head *bucket;
+	apk_hash_node *node;
+	struct hlist_node *pos, *n;
+
+	apk_hash_array_init(&buckets);
+	apk_hash_array_resize(&buckets, num_buckets);
+	foreach_array_item(bucket, h->buckets) {
+		hlist_for_each_safe(pos, n, bucket) {
+			node = container_of(pos, apk_hash_node, node);
+			hlist_add_head(pos, &buckets->item[node->hash & (num_buckets - 1)]);
+		}
+	}
+	apk_hash_array_free(&h->buckets);
+	h->buckets = buckets;
+}
+
 void apk_hash_init(struct apk_hash *h, const struct apk_hash_ops *ops,
 		   int num_buckets)
 {
+	size_t n = APK_HASH_MIN_BUCKETS;
+
+	while (n < (size_t) num_buckets) n <<= 1;
 	h->ops = ops;
 	apk_hash_array_init(&h->buckets);
-	apk_hash_array_resize(&h->buckets, num_buckets);
+	apk_hash_array_resize(&h->buckets, n);
 	h->num_items = 0;
+	h->min_buckets = n;
+	h->walking = 0;
 }
 
 void apk_hash_free(struct apk_hash *h)
 {
-	apk_hash_foreach(h, (apk_hash_enumerator_f) h->ops->delete_item, NULL);
+	if (h->ops->delete_item)
+		apk_hash_foreach(h, (apk_hash_enumerator_f) h->ops->delete_item, NULL);
 	apk_hash_array_free(&h->buckets);
 }
 
 int apk_hash_foreach(struct apk_hash *h, apk_hash_enumerator_f e, void *ctx)
 {
 	struct hlist_head *bucket;
-	apk_hash_node *pos, *n;
+	struct hlist_node *pos, *n;
 	ptrdiff_t offset = h->ops->node_offset;
-	int r;
+	int r = 0;
 
+	h->walking++;
 	foreach_array_item(bucket, h->buckets) {
 		hlist_for_each_safe(pos, n, bucket) {
 			r = e(((void *) pos) - offset, ctx);
 			if (r != 0 && ctx != NULL)
-				return r;
+				goto done;
 		}
 	}
+	r = 0;
+done:
+	h->walking--;
+	return r;
+}
 
-	return 0;
+static inline struct hlist_head *apk_hash_bucket(struct apk_hash *h, unsigned long hash)
+{
+	return &h->buckets->item[hash & (h->buckets->num - 1)];
 }
 
 apk_hash_item apk_hash_get_hashed(struct apk_hash *h, apk_blob_t key, unsigned long hash)
 {
 	ptrdiff_t offset = h->ops->node_offset;
-	apk_hash_node *pos;
+	struct hlist_node *pos;
 	apk_hash_item item;
 	apk_blob_t itemkey;
 
-	hash %= h->buckets->num;
 	if (h->ops->compare_item != NULL) {
-		hlist_for_each(pos, &h->buckets->item[hash]) {
+		hlist_for_each(pos, apk_hash_bucket(h, hash)) {
+			if (container_of(pos, apk_hash_node, node)->hash != hash) continue;
 			item = ((void *) pos) - offset;
 			if (h->ops->compare_item(item, key) == 0)
 				return item;
 		}
 	} else {
-		hlist_for_each(pos, &h->buckets->item[hash]) {
+		hlist_for_each(pos, apk_hash_bucket(h, hash)) {
+			if (container_of(pos, apk_hash_node, node)->hash != hash) continue;
 			item = ((void *) pos) - offset;
 			itemkey = h->ops->get_key(item);
 			if (h->ops->compare(key, itemkey) == 0)
@@ -73,38 +109,50 @@ void apk_hash_insert_hashed(struct apk_hash *h, apk_hash_item item, unsigned lon
 {
 	apk_hash_node *node;
 
-	hash %= h->buckets->num;
+	if (h->num_items >= h->buckets->num && !h->walking)
+		apk_hash_rehash(h, h->buckets->num * 2);
+
 	node = (apk_hash_node *) (item + h->ops->node_offset);
-	hlist_add_head(node, &h->buckets->item[hash]);
+	node->hash = hash;
+	hlist_add_head(&node->node, apk_hash_bucket(h, hash));
 	h->num_items++;
 }
 
+static void apk_hash_del_node(struct apk_hash *h, struct hlist_node *pos, struct hlist_head *bucket)
+{
+	hlist_del(pos, bucket);
+	if (h->ops->delete_item)
+		h->ops->delete_item(((void *) pos) - h->ops->node_offset);
+	h->num_items--;
+
+	if (h->num_items < h->buckets->num / 8 && h->buckets->num > h->min_buckets && !h->walking)
+		apk_hash_rehash(h, h->buckets->num / 2);
+}
+
 void apk_hash_delete_hashed(struct apk_hash *h, apk_blob_t key, unsigned long hash)
 {
 	ptrdiff_t offset = h->ops->node_offset;
-	apk_hash_node *pos;
+	struct hlist_head *bucket = apk_hash_bucket(h, hash);
+	struct hlist_node *pos;
 	apk_hash_item item;
 	apk_blob_t itemkey;
 
-	hash %= h->buckets->num;
 	if (h->ops->compare_item != NULL) {
-		hlist_for_each(pos, &h->buckets->item[hash]) {
+		hlist_for_each(pos, bucket) {
+			if (container_of(pos, apk_hash_node, node)->hash != hash) continue;
 			item = ((void *) pos) - offset;
 			if (h->ops->compare_item(item, key) == 0) {
-				hlist_del(pos, &h->buckets->item[hash]);
-				h->ops->delete_item(item);
-				h->num_items--;
+				apk_hash_del_node(h, pos, bucket);
 				break;
 			}
 		}
 	} else {
-		hlist_for_each(pos, &h->buckets->item[hash]) {
+		hlist_for_each(pos, bucket) {
+			if (container_of(pos, apk_hash_node, node)->hash != hash) continue;
 			item = ((void *) pos) - offset;
 			itemkey = h->ops->get_key(item);
 			if (h->ops->compare(key, itemkey) == 0) {
-				hlist_del(pos, &h->buckets->item[hash]);
-				h->ops->delete_item(item);
-				h->num_items--;
+				apk_hash_del_node(h, pos, bucket);
 				break;
 			}
 		}
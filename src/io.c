@@ -171,26 +171,47 @@ int apk_istream_get_max(struct apk_istream *is, size_t max, apk_blob_t *data)
 	return is->err < 0 ? is->err : -APKE_EOF;
 }
 
+/* Find the delimiter in the buffered data. The part already scanned before
+ * the buffer was refilled is skipped, so long records are not rescanned
+ * for each refill. The first delimiter byte is searched with memchr which
+ * the C library implements with vector instructions where available. */
+static char *apk_istream_find_delim(struct apk_istream *is, apk_blob_t token, size_t *scanned)
+{
+	char *start = (char *) is->ptr, *end = (char *) is->end, *pos;
+	size_t len = end - start;
+
+	if (!start || len < token.len) return NULL;
+	for (pos = start + *scanned; pos <= end - token.len; pos++) {
+		pos = memchr(pos, token.ptr[0], end - token.len + 1 - pos);
+		if (!pos) break;
+		if (token.len == 1 || memcmp(pos, token.ptr, token.len) == 0)
+			return pos;
+	}
+	*scanned = len - token.len + 1;
+	return NULL;
+}
+
 int apk_istream_get_delim(struct apk_istream *is, apk_blob_t token, apk_blob_t *data)
 {
-	apk_blob_t ret = APK_BLOB_NULL, left = APK_BLOB_NULL;
+	size_t scanned = 0;
+	char *pos;
 	int r = 0;
 
 	do {
-		if (apk_blob_split(APK_BLOB_PTR_LEN((char*)is->ptr, is->end - is->ptr), token, &ret, &left))
-			break;
+		pos = apk_istream_find_delim(is, token, &scanned);
+		if (pos) {
+			*data = APK_BLOB_PTR_PTR((char*)is->ptr, pos - 1);
+			is->ptr = (uint8_t*)pos + token.len;
+			return 0;
+		}
 		r = __apk_istream_fill(is);
 	} while (r == 0);
 
 	/* Last segment before end-of-file. Return also zero length non-null
 	 * blob if eof comes immediately after the delimiter. */
-	if (is->ptr && r > 0)
-		ret = APK_BLOB_PTR_LEN((char*)is->ptr, is->end - is->ptr);
-
-	if (!APK_BLOB_IS_NULL(ret)) {
-		is->ptr = (uint8_t*)left.ptr;
-		is->end = (uint8_t*)left.ptr + left.len;
-		*data = ret;
+	if (is->ptr && r > 0) {
+		*data = APK_BLOB_PTR_LEN((char*)is->ptr, is->end - is->ptr);
+		is->ptr = is->end = NULL;
 		return 0;
 	}
 	if (r < 0) apk_istream_error(is, r);
@@ -8,8 +8,10 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <zlib.h>
 
 #include "apk_defines.h"
@@ -85,22 +87,16 @@ static ssize_t gzi_read(struct apk_istream *is, void *ptr, size_t size)
 		r = inflate(&gis->zs, Z_NO_FLUSH);
 		switch (r) {
 		case Z_STREAM_END:
-			/* Digest the inflated bytes */
-			if (gis->zis->err && gis->zs.avail_in == 0)
-				gis->is.err = gis->zis->err;
+			/* Digest the inflated bytes. The boundary callback
+			 * is postponed until the next gzip read is started,
+			 * also at the end of the bitstream which is noticed
+			 * only then. A source already read to its end, such
+			 * as a blob, must not signal the end before the
+			 * inflated data has been consumed. */
 			if (gis->cb != NULL) {
 				gis->cbarg = APK_BLOB_PTR_LEN(gis->cbprev, (void *) gis->zs.next_in - gis->cbprev); 
 				gis->cbprev = gis->zs.next_in;
 			}
-			/* If we hit end of the bitstream (not end
-			 * of just this gzip), we need to do the
-			 * callback here, as we won't be called again.
-			 * For boundaries it should be postponed to not
-			 * be called until next gzip read is started. */
-			if (gis->is.err) {
-				gzi_boundary_change(gis);
-				goto ret;
-			}
 			inflateEnd(&gis->zs);
 			if (inflateInit2(&gis->zs, 15+32) != Z_OK)
 				return -ENOMEM;
@@ -169,24 +165,271 @@ err:
 	return ERR_PTR(apk_istream_close_error(is, -ENOMEM));
 }
 
+/* The pipelined gunzip runs the inflate, and the data digesting multipart
+ * callbacks, on a helper thread which fills a small ring of buffers ahead
+ * of the consumer. Boundary and end callbacks verify signatures against
+ * state the consumer has parsed from the stream. The helper passes them
+ * to the consumer thread and waits, so that they are called only after
+ * all data preceding the boundary has been read, exactly as in the
+ * synchronous stream. */
+#define GZP_SLOTS 4
+
+struct apk_gzip_pipe_slot {
+	uint8_t *buf;
+	size_t len, pos;
+};
+
+struct apk_gzip_pipe_istream {
+	struct apk_istream is;
+	struct apk_istream *gis;
+	apk_multipart_cb cb;
+	void *cbctx;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t produced, consumed;
+	unsigned int head, tail, count;
+	int done, stop, err;
+	int ev_part, ev_result;
+	size_t ev_len;
+	apk_blob_t ev_arg;
+	struct apk_gzip_pipe_slot slot[GZP_SLOTS];
+};
+
+static int gzp_mpart_cb(void *ctx, int part, apk_blob_t data)
+{
+	struct apk_gzip_pipe_istream *gzp = ctx;
+	struct apk_gzip_istream *gis = container_of(gzp->gis, struct apk_gzip_istream, is);
+	int r;
+
+	if (part == APK_MPART_DATA) return gzp->cb(gzp->cbctx, part, data);
+
+	pthread_mutex_lock(&gzp->mutex);
+	gzp->ev_part = part;
+	gzp->ev_arg = data;
+	gzp->ev_len = gis->zs.next_out - gzp->slot[gzp->head].buf;
+	pthread_cond_signal(&gzp->produced);
+	while (gzp->ev_part && !gzp->stop)
+		pthread_cond_wait(&gzp->consumed, &gzp->mutex);
+	r = gzp->stop ? -ECANCELED : gzp->ev_result;
+	pthread_mutex_unlock(&gzp->mutex);
+	return r;
+}
+
+static void *gzp_thread(void *ctx)
+{
+	struct apk_gzip_pipe_istream *gzp = ctx;
+	unsigned int head;
+	ssize_t r;
+	int stop;
+
+	while (1) {
+		pthread_mutex_lock(&gzp->mutex);
+		while (gzp->count == GZP_SLOTS && !gzp->stop)
+			pthread_cond_wait(&gzp->consumed, &gzp->mutex);
+		head = gzp->head;
+		stop = gzp->stop;
+		pthread_mutex_unlock(&gzp->mutex);
+		if (stop) break;
+
+		r = gzi_read(gzp->gis, gzp->slot[head].buf, apk_io_bufsize);
+
+		pthread_mutex_lock(&gzp->mutex);
+		if (r > 0) {
+			gzp->slot[head].len = r;
+			gzp->head = (head + 1) % GZP_SLOTS;
+			gzp->count++;
+		}
+		if (gzp->gis->err) {
+			gzp->err = gzp->gis->err;
+			gzp->done = 1;
+		}
+		pthread_cond_signal(&gzp->produced);
+		pthread_mutex_unlock(&gzp->mutex);
+		if (gzp->done) break;
+	}
+	return NULL;
+}
+
+static void gzp_get_meta(struct apk_istream *is, struct apk_file_meta *meta)
+{
+	struct apk_gzip_pipe_istream *gzp = container_of(is, struct apk_gzip_pipe_istream, is);
+	apk_istream_get_meta(gzp->gis, meta);
+}
+
+static ssize_t gzp_read(struct apk_istream *is, void *ptr, size_t size)
+{
+	struct apk_gzip_pipe_istream *gzp = container_of(is, struct apk_gzip_pipe_istream, is);
+	size_t n = 0;
+	int r;
+
+	pthread_mutex_lock(&gzp->mutex);
+	while (1) {
+		if (gzp->count) {
+			struct apk_gzip_pipe_slot *s = &gzp->slot[gzp->tail];
+			n = min(size, s->len - s->pos);
+			memcpy(ptr, s->buf + s->pos, n);
+			s->pos += n;
+			if (s->pos == s->len) {
+				s->pos = 0;
+				gzp->tail = (gzp->tail + 1) % GZP_SLOTS;
+				gzp->count--;
+				pthread_cond_signal(&gzp->consumed);
+			}
+			if (n) break;
+			continue;
+		}
+		if (gzp->ev_part) {
+			struct apk_gzip_pipe_slot *s = &gzp->slot[gzp->head];
+			if (s->pos < gzp->ev_len) {
+				n = min(size, gzp->ev_len - s->pos);
+				memcpy(ptr, s->buf + s->pos, n);
+				s->pos += n;
+				break;
+			}
+			/* The helper is waiting, so the callback data stays valid */
+			pthread_mutex_unlock(&gzp->mutex);
+			r = gzp->cb(gzp->cbctx, gzp->ev_part, gzp->ev_arg);
+			if (r > 0) r = -ECANCELED;
+			pthread_mutex_lock(&gzp->mutex);
+			gzp->ev_result = r;
+			gzp->ev_part = 0;
+			pthread_cond_signal(&gzp->consumed);
+			if (r != 0) {
+				apk_istream_error(is, r);
+				break;
+			}
+			continue;
+		}
+		if (gzp->done) {
+			apk_istream_error(is, gzp->err);
+			break;
+		}
+		pthread_cond_wait(&gzp->produced, &gzp->mutex);
+	}
+	pthread_mutex_unlock(&gzp->mutex);
+	return n;
+}
+
+static int gzp_close(struct apk_istream *is)
+{
+	struct apk_gzip_pipe_istream *gzp = container_of(is, struct apk_gzip_pipe_istream, is);
+	struct apk_istream *gis = gzp->gis;
+
+	pthread_mutex_lock(&gzp->mutex);
+	gzp->stop = 1;
+	pthread_cond_signal(&gzp->consumed);
+	pthread_mutex_unlock(&gzp->mutex);
+	pthread_join(gzp->thread, NULL);
+
+	pthread_cond_destroy(&gzp->consumed);
+	pthread_cond_destroy(&gzp->produced);
+	pthread_mutex_destroy(&gzp->mutex);
+
+	/* Report the error as seen by the consumer, the helper may have
+	 * been stopped in the middle of the stream. */
+	gis->err = gzp->is.err;
+	free(gzp);
+	return gzi_close(gis);
+}
+
+static const struct apk_istream_ops gunzip_pipe_istream_ops = {
+	.get_meta = gzp_get_meta,
+	.read = gzp_read,
+	.close = gzp_close,
+};
+
+struct apk_istream *apk_istream_gunzip_pipeline(struct apk_istream *is, apk_multipart_cb cb, void *ctx)
+{
+	struct apk_gzip_pipe_istream *gzp;
+	struct apk_istream *gis;
+	uint8_t *buf;
+	int i;
+
+	if (IS_ERR(is)) return ERR_CAST(is);
+
+	gzp = malloc(sizeof(*gzp) + (GZP_SLOTS + 1) * apk_io_bufsize);
+	if (!gzp) goto sync;
+
+	gis = apk_istream_zlib(is, 0, cb ? gzp_mpart_cb : NULL, gzp);
+	if (IS_ERR(gis)) {
+		free(gzp);
+		return gis;
+	}
+
+	buf = (uint8_t*)(gzp + 1);
+	*gzp = (struct apk_gzip_pipe_istream) {
+		.is.ops = &gunzip_pipe_istream_ops,
+		.is.buf = buf,
+		.is.buf_size = apk_io_bufsize,
+		.gis = gis,
+		.cb = cb,
+		.cbctx = ctx,
+	};
+	for (i = 0; i < GZP_SLOTS; i++)
+		gzp->slot[i].buf = buf + (i + 1) * apk_io_bufsize;
+
+	pthread_mutex_init(&gzp->mutex, NULL);
+	pthread_cond_init(&gzp->produced, NULL);
+	pthread_cond_init(&gzp->consumed, NULL);
+	if (pthread_create(&gzp->thread, NULL, gzp_thread, gzp) != 0) {
+		pthread_cond_destroy(&gzp->consumed);
+		pthread_cond_destroy(&gzp->produced);
+		pthread_mutex_destroy(&gzp->mutex);
+		/* Nothing has been read yet, continue synchronously */
+		container_of(gis, struct apk_gzip_istream, is)->cb = cb;
+		container_of(gis, struct apk_gzip_istream, is)->cbctx = ctx;
+		free(gzp);
+		return gis;
+	}
+	return &gzp->is;
+sync:
+	return apk_istream_zlib(is, 0, cb, ctx);
+}
+
+/* In rsyncable mode the compressor is fully flushed where a rolling gear
+ * hash of the last 64 input bytes has its top bits clear. The flush points
+ * depend only on nearby content, so an unchanged region of the input
+ * compresses to the same bytes in every version of the file. */
+#define RSYNC_BITS	15
+#define RSYNC_MASK	(~0ULL << (64 - RSYNC_BITS))
+
+static uint64_t rsync_gear[256];
+
+static void rsync_gear_init(void)
+{
+	uint64_t x = 0x9e3779b97f4a7c15ULL, z;
+	int i;
+
+	if (rsync_gear[0]) return;
+	for (i = 255; i >= 0; i--) {
+		/* splitmix64 */
+		z = (x += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		rsync_gear[i] = z ^ (z >> 31);
+	}
+}
+
 struct apk_gzip_ostream {
 	struct apk_ostream os;
 	struct apk_ostream *output;
 	z_stream zs;
+	unsigned int rsyncable : 1;
+	uint64_t rsync_hash;
 };
 
-static int gzo_write(struct apk_ostream *os, const void *ptr, size_t size)
+static int gzo_deflate(struct apk_gzip_ostream *gos, const void *ptr, size_t size, int flush)
 {
-	struct apk_gzip_ostream *gos = container_of(os, struct apk_gzip_ostream, os);
 	unsigned char buffer[1024];
 	ssize_t have, r;
 
 	gos->zs.avail_in = size;
 	gos->zs.next_in = (void *) ptr;
-	while (gos->zs.avail_in) {
+	do {
 		gos->zs.avail_out = sizeof(buffer);
 		gos->zs.next_out = buffer;
-		r = deflate(&gos->zs, Z_NO_FLUSH);
+		r = deflate(&gos->zs, flush);
 		if (r == Z_STREAM_ERROR)
 			return apk_ostream_cancel(gos->output, -EIO);
 		have = sizeof(buffer) - gos->zs.avail_out;
@@ -194,11 +437,31 @@ static int gzo_write(struct apk_ostream *os, const void *ptr, size_t size)
 			r = apk_ostream_write(gos->output, buffer, have);
 			if (r < 0) return r;
 		}
-	}
+	} while (gos->zs.avail_in || (flush != Z_NO_FLUSH && gos->zs.avail_out == 0));
 
 	return 0;
 }
 
+static int gzo_write(struct apk_ostream *os, const void *ptr, size_t size)
+{
+	struct apk_gzip_ostream *gos = container_of(os, struct apk_gzip_ostream, os);
+	const unsigned char *p = ptr, *end = p + size;
+	uint64_t hash = gos->rsync_hash;
+	int r;
+
+	if (!gos->rsyncable) return gzo_deflate(gos, ptr, size, Z_NO_FLUSH);
+
+	for (ptr = p; p < end; p++) {
+		hash = (hash << 1) + rsync_gear[*p];
+		if (hash & RSYNC_MASK) continue;
+		r = gzo_deflate(gos, ptr, p + 1 - (const unsigned char *) ptr, Z_FULL_FLUSH);
+		if (r < 0) return r;
+		ptr = p + 1;
+	}
+	gos->rsync_hash = hash;
+	return gzo_deflate(gos, ptr, end - (const unsigned char *) ptr, Z_NO_FLUSH);
+}
+
 static int gzo_close(struct apk_ostream *os)
 {
 	struct apk_gzip_ostream *gos = container_of(os, struct apk_gzip_ostream, os);
@@ -226,11 +489,12 @@ static const struct apk_ostream_ops gzip_ostream_ops = {
 	.close = gzo_close,
 };
 
-struct apk_ostream *apk_ostream_zlib(struct apk_ostream *output, int raw)
+struct apk_ostream *apk_ostream_zlib(struct apk_ostream *output, int raw, int rsyncable)
 {
 	struct apk_gzip_ostream *gos;
 
 	if (IS_ERR(output)) return ERR_CAST(output);
+	if (rsyncable) rsync_gear_init();
 
 	gos = malloc(sizeof(struct apk_gzip_ostream));
 	if (gos == NULL) goto err;
@@ -238,6 +502,7 @@ struct apk_ostream *apk_ostream_zlib(struct apk_ostream *output, int raw)
 	*gos = (struct apk_gzip_ostream) {
 		.os.ops = &gzip_ostream_ops,
 		.output = output,
+		.rsyncable = rsyncable,
 	};
 
 	if (deflateInit2(&gos->zs, 9, Z_DEFLATED, window_bits(15, raw), 8,
@@ -105,6 +105,8 @@ void apk_pkg_uninstall(struct apk_database *db, struct apk_package *pkg)
 	if (db != NULL) {
 		db->installed.stats.packages--;
 		db->installed.stats.bytes -= pkg->installed_size;
+		for (i = 0; i < APK_SCRIPT_MAX; i++)
+			if (ipkg->script[i].ptr != NULL) db->scripts_dirty = 1;
 	}
 
 	list_del(&ipkg->installed_pkgs_list);
@@ -120,7 +122,7 @@ void apk_pkg_uninstall(struct apk_database *db, struct apk_package *pkg)
 	apk_dependency_array_free(&ipkg->replaces);
 
 	for (i = 0; i < APK_SCRIPT_MAX; i++)
-		if (ipkg->script[i].ptr != NULL)
+		if (!(ipkg->script_mapped & BIT(i)))
 			free(ipkg->script[i].ptr);
 	free(ipkg);
 	pkg->ipkg = NULL;
@@ -332,7 +334,7 @@ int apk_dep_is_provided(struct apk_dependency *dep, struct apk_provider *p)
 	default:
 		if (p->version == &apk_atom_null)
 			return dep->conflict;
-		if (apk_version_compare_blob_fuzzy(*p->version, *dep->version, dep->fuzzy)
+		if (apk_version_compare_atom_fuzzy(p->version, dep->version, dep->fuzzy)
 		    & dep->result_mask)
 			return !dep->conflict;
 		return dep->conflict;
@@ -353,7 +355,7 @@ int apk_dep_is_materialized(struct apk_dependency *dep, struct apk_package *pkg)
 	case APK_DEPMASK_ANY:
 		return !dep->conflict;
 	default:
-		if (apk_version_compare_blob_fuzzy(*pkg->version, *dep->version, dep->fuzzy)
+		if (apk_version_compare_atom_fuzzy(pkg->version, dep->version, dep->fuzzy)
 		    & dep->result_mask)
 			return !dep->conflict;
 		return dep->conflict;
@@ -499,6 +501,17 @@ struct read_info_ctx {
 	int v3ok;
 };
 
+/* Packages with borrowed_info set are read from an index buffer that is
+ * kept for the lifetime of the database. Their url, description and
+ * commit point into it: the line end after the value is overwritten with
+ * the string terminator instead of making a copy. */
+static char *pkg_info_cstr(struct apk_package *pkg, apk_blob_t value)
+{
+	if (!pkg->borrowed_info) return apk_blob_cstr(value);
+	value.ptr[value.len] = 0;
+	return value.ptr;
+}
+
 int apk_pkg_add_info(struct apk_database *db, struct apk_package *pkg,
 		     char field, apk_blob_t value)
 {
@@ -510,10 +523,10 @@ int apk_pkg_add_info(struct apk_database *db, struct apk_package *pkg,
 		pkg->version = apk_atomize_dup(&db->atoms, value);
 		break;
 	case 'T':
-		pkg->description = apk_blob_cstr(value);
+		pkg->description = pkg_info_cstr(pkg, value);
 		break;
 	case 'U':
-		pkg->url = apk_blob_cstr(value);
+		pkg->url = pkg_info_cstr(pkg, value);
 		break;
 	case 'L':
 		pkg->license = apk_atomize_dup(&db->atoms, value);
@@ -549,7 +562,7 @@ int apk_pkg_add_info(struct apk_database *db, struct apk_package *pkg,
 		pkg->build_time = apk_blob_pull_uint(&value, 10);
 		break;
 	case 'c':
-		pkg->commit = apk_blob_cstr(value);
+		pkg->commit = pkg_info_cstr(pkg, value);
 		break;
 	case 'k':
 		pkg->provider_priority = apk_blob_pull_uint(&value, 10);
@@ -732,9 +745,11 @@ void apk_pkg_free(struct apk_package *pkg)
 	apk_dependency_array_free(&pkg->depends);
 	apk_dependency_array_free(&pkg->provides);
 	apk_dependency_array_free(&pkg->install_if);
-	if (pkg->url) free(pkg->url);
-	if (pkg->description) free(pkg->description);
-	if (pkg->commit) free(pkg->commit);
+	if (!pkg->borrowed_info) {
+		if (pkg->url) free(pkg->url);
+		if (pkg->description) free(pkg->description);
+		if (pkg->commit) free(pkg->commit);
+	}
 	if (pkg->filename) free(pkg->filename);
 	free(pkg);
 }
@@ -746,7 +761,19 @@ int apk_ipkg_assign_script(struct apk_installed_package *ipkg, unsigned int type
 		free(b.ptr);
 		return -1;
 	}
-	if (ipkg->script[type].ptr) free(ipkg->script[type].ptr);
+	if (!(ipkg->script_mapped & BIT(type))) free(ipkg->script[type].ptr);
+	ipkg->script_mapped &= ~BIT(type);
+	ipkg->script[type] = b;
+	return 0;
+}
+
+/* Assign a script referring to memory not owned by the package, e.g.
+ * the mapped scripts database */
+int apk_ipkg_map_script(struct apk_installed_package *ipkg, unsigned int type, apk_blob_t b)
+{
+	if (APK_BLOB_IS_NULL(b) || type >= APK_SCRIPT_MAX) return -1;
+	if (!(ipkg->script_mapped & BIT(type))) free(ipkg->script[type].ptr);
+	ipkg->script_mapped |= BIT(type);
 	ipkg->script[type] = b;
 	return 0;
 }
@@ -835,6 +862,7 @@ err_log:
 	apk_err(out, "%s: failed to execute: %s", &fn[15], apk_error_str(errno));
 err:
 	ipkg->broken_script = 1;
+	ipkg->db_dirty = 1;
 cleanup:
 	unlinkat(root_fd, fn, 0);
 }
@@ -950,7 +978,7 @@ int apk_pkg_version_compare(struct apk_package *a, struct apk_package *b)
 	if (a->version == b->version)
 		return APK_VERSION_EQUAL;
 
-	return apk_version_compare_blob(*a->version, *b->version);
+	return apk_version_compare_atom(a->version, b->version);
 }
 
 unsigned int apk_foreach_genid(void)
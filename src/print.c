@@ -61,6 +61,7 @@ const char *apk_error_str(int error)
 	case APKE_UVOL_ERROR:			return "uvol error";
 	case APKE_UVOL_ROOT:			return "uvol not supported with --root";
 	case APKE_REMOTE_IO:			return "remote server returned error (try 'apk update')";
+	case APKE_DELTA_FORMAT:		return "index delta format error";
 	default:
 		return strerror(error);
 	}
@@ -32,12 +32,17 @@ struct apk_solver_state {
 	struct apk_database *db;
 	struct apk_changeset *changeset;
 	struct list_head dirty_head;
-	struct list_head unresolved_head;
+	struct apk_name **unresolved;
+	unsigned int num_unresolved, max_unresolved, unresolved_seq;
+	struct apk_name_array *cone;
+	struct apk_solver_stats *stats;
+	uint64_t phase_start;
 	unsigned int errors;
 	unsigned int solver_flags_inherit;
 	unsigned int pinning_inherit;
 	unsigned int default_repos;
 	unsigned ignore_conflict : 1;
+	unsigned out_of_memory : 1;
 };
 
 static struct apk_provider provider_none = {
@@ -57,6 +62,8 @@ void apk_solver_set_name_flags(struct apk_name *name,
 			PKG_VER_PRINTF(pkg), solver_flags, solver_flags_inheritable);
 		pkg->ss.solver_flags |= solver_flags;
 		pkg->ss.solver_flags_inheritable |= solver_flags_inheritable;
+		pkg->ss.preset_flags |= solver_flags;
+		pkg->ss.preset_flags_inheritable |= solver_flags_inheritable;
 	}
 }
 
@@ -87,6 +94,14 @@ static void mark_error(struct apk_solver_state *ss, struct apk_package *pkg, con
 	ss->errors++;
 }
 
+static void phase_end(struct apk_solver_state *ss, uint64_t *counter)
+{
+	uint64_t now = apk_time_ns();
+
+	*counter += now - ss->phase_start;
+	ss->phase_start = now;
+}
+
 static void queue_dirty(struct apk_solver_state *ss, struct apk_name *name)
 {
 	if (list_hashed(&name->ss.dirty_list) || name->ss.locked ||
@@ -94,9 +109,107 @@ static void queue_dirty(struct apk_solver_state *ss, struct apk_name *name)
 		return;
 
 	dbg_printf("queue_dirty: %s\n", name->name);
+	ss->stats->dirty_queued++;
+	ss->stats->dirty_requeued += name->ss.reconsidered;
 	list_add_tail(&name->ss.dirty_list, &ss->dirty_head);
 }
 
+static int compare_name_dequeue(const struct apk_name *a, const struct apk_name *b)
+{
+	int r;
+
+	r = (!!a->ss.requirers) - (!!b->ss.requirers);
+	if (r) return -r;
+
+	r = (int)a->priority - (int)b->priority;
+	if (r) return r;
+
+	r = a->ss.max_dep_chain - b->ss.max_dep_chain;
+	return -r;
+}
+
+static inline int name_ready(const struct apk_name *name)
+{
+	return name->ss.reverse_deps_done && name->ss.requirers && !name->ss.has_options;
+}
+
+/* The unresolved names are kept in a binary heap. The most recently queued
+ * name that is ready is selected first. Otherwise the first name in the
+ * compare_name_dequeue() order is selected, preferring the most recently
+ * queued one on ties. */
+static int unresolved_before(const struct apk_name *a, const struct apk_name *b)
+{
+	int r;
+
+	r = name_ready(a) - name_ready(b);
+	if (r) return r > 0;
+	if (!name_ready(a)) {
+		r = compare_name_dequeue(a, b);
+		if (r) return r < 0;
+	}
+	return a->ss.unresolved_seq > b->ss.unresolved_seq;
+}
+
+static void unresolved_set(struct apk_solver_state *ss, unsigned int i, struct apk_name *name)
+{
+	ss->unresolved[i] = name;
+	name->ss.unresolved_index = i + 1;
+}
+
+static void unresolved_sift(struct apk_solver_state *ss, unsigned int i)
+{
+	struct apk_name *name = ss->unresolved[i];
+	unsigned int parent, child;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!unresolved_before(name, ss->unresolved[parent])) break;
+		unresolved_set(ss, i, ss->unresolved[parent]);
+		i = parent;
+	}
+	while ((child = 2 * i + 1) < ss->num_unresolved) {
+		if (child + 1 < ss->num_unresolved &&
+		    unresolved_before(ss->unresolved[child + 1], ss->unresolved[child]))
+			child++;
+		if (!unresolved_before(ss->unresolved[child], name)) break;
+		unresolved_set(ss, i, ss->unresolved[child]);
+		i = child;
+	}
+	unresolved_set(ss, i, name);
+}
+
+static void unresolved_add(struct apk_solver_state *ss, struct apk_name *name)
+{
+	struct apk_name **unresolved;
+	unsigned int max;
+
+	if (ss->num_unresolved == ss->max_unresolved) {
+		max = ss->max_unresolved ? ss->max_unresolved * 2 : 256;
+		unresolved = realloc(ss->unresolved, max * sizeof ss->unresolved[0]);
+		if (!unresolved) {
+			/* The name stays unresolved, and the solve fails */
+			ss->out_of_memory = 1;
+			return;
+		}
+		ss->unresolved = unresolved;
+		ss->max_unresolved = max;
+	}
+	name->ss.unresolved_seq = ++ss->unresolved_seq;
+	ss->unresolved[ss->num_unresolved] = name;
+	unresolved_sift(ss, ss->num_unresolved++);
+}
+
+static void unresolved_del(struct apk_solver_state *ss, struct apk_name *name)
+{
+	unsigned int i = name->ss.unresolved_index - 1;
+	struct apk_name *last = ss->unresolved[--ss->num_unresolved];
+
+	name->ss.unresolved_index = 0;
+	if (last == name) return;
+	ss->unresolved[i] = last;
+	unresolved_sift(ss, i);
+}
+
 static void queue_unresolved(struct apk_solver_state *ss, struct apk_name *name)
 {
 	int want;
@@ -106,10 +219,12 @@ static void queue_unresolved(struct apk_solver_state *ss, struct apk_name *name)
 
 	want = (name->ss.requirers > 0) || (name->ss.has_iif);
 	dbg_printf("queue_unresolved: %s, want=%d (requirers=%d, has_iif=%d)\n", name->name, want, name->ss.requirers, name->ss.has_iif);
-	if (want && !list_hashed(&name->ss.unresolved_list))
-		list_add(&name->ss.unresolved_list, &ss->unresolved_head);
-	else if (!want && list_hashed(&name->ss.unresolved_list))
-		list_del_init(&name->ss.unresolved_list);
+	if (want && !name->ss.unresolved_index)
+		unresolved_add(ss, name);
+	else if (!want && name->ss.unresolved_index)
+		unresolved_del(ss, name);
+	else if (name->ss.unresolved_index)
+		unresolved_sift(ss, name->ss.unresolved_index - 1);
 }
 
 static void reevaluate_reverse_deps(struct apk_solver_state *ss, struct apk_name *name)
@@ -145,6 +260,7 @@ static void disqualify_package(struct apk_solver_state *ss, struct apk_package *
 	struct apk_dependency *p;
 
 	dbg_printf("disqualify_package: " PKG_VER_FMT " (%s)\n", PKG_VER_PRINTF(pkg), reason);
+	ss->stats->disqualify_package++;
 	pkg->ss.pkg_selectable = 0;
 	reevaluate_reverse_deps(ss, pkg->name);
 	foreach_array_item(p, pkg->provides)
@@ -186,6 +302,7 @@ static void discover_name(struct apk_solver_state *ss, struct apk_name *name)
 
 	name->ss.seen = 1;
 	name->ss.no_iif = 1;
+	ss->stats->names_discovered++;
 	foreach_array_item(p, name->providers) {
 		struct apk_package *pkg = p->pkg;
 		if (!pkg->ss.seen) {
@@ -240,6 +357,7 @@ static void discover_name(struct apk_solver_state *ss, struct apk_name *name)
 		dbg_printf("discover %s: max_dep_chain=%d no_iif=%d\n",
 			name->name, name->ss.max_dep_chain, name->ss.no_iif);
 	}
+	ss->stats->max_dep_chain = max(ss->stats->max_dep_chain, name->ss.max_dep_chain);
 	foreach_array_item(pname0, name->rinstall_if)
 		discover_name(ss, *pname0);
 }
@@ -360,6 +478,8 @@ static void reconsider_name(struct apk_solver_state *ss, struct apk_name *name)
 	int num_options = 0, num_tag_not_ok = 0, has_iif = 0, no_iif = 1;
 
 	dbg_printf("reconsider_name: %s\n", name->name);
+	ss->stats->reconsider_name++;
+	name->ss.reconsidered = 1;
 
 	reevaluate_deps = name->ss.reevaluate_deps;
 	reevaluate_iif = name->ss.reevaluate_iif;
@@ -489,10 +609,19 @@ static void reconsider_name(struct apk_solver_state *ss, struct apk_name *name)
 		}
 	}
 
+	if (name->ss.unresolved_index)
+		unresolved_sift(ss, name->ss.unresolved_index - 1);
+
 	dbg_printf("reconsider_name: %s [finished], has_options=%d, reverse_deps_done=%d\n",
 		name->name, name->ss.has_options, name->ss.reverse_deps_done);
 }
 
+/* Providers of a name are ranked only once, when select_package() locks
+ * the name. The inputs are kept up to date in the package state as the
+ * solve progresses: pinning by inherit_pinning_and_flags(), errors by
+ * disqualify_package() and the versions by the keys cached with the
+ * version atoms. So there is no ranking to cache between
+ * reconsiderations. */
 static int compare_providers(struct apk_solver_state *ss,
 			     struct apk_provider *pA, struct apk_provider *pB)
 {
@@ -501,6 +630,8 @@ static int compare_providers(struct apk_solver_state *ss,
 	unsigned int solver_flags;
 	int r;
 
+	ss->stats->compare_providers++;
+
 	/* Prefer existing package */
 	if (pkgA == NULL || pkgB == NULL) {
 		dbg_printf("   prefer existing package\n");
@@ -597,7 +728,7 @@ static int compare_providers(struct apk_solver_state *ss,
 	}
 
 	/* Select latest by requested name */
-	switch (apk_version_compare_blob(*pA->version, *pB->version)) {
+	switch (apk_version_compare_atom(pA->version, pB->version)) {
 	case APK_VERSION_LESS:
 		dbg_printf("    select latest by requested name (less)\n");
 		return -1;
@@ -608,7 +739,7 @@ static int compare_providers(struct apk_solver_state *ss,
 
 	/* Select latest by principal name */
 	if (pkgA->name == pkgB->name) {
-		switch (apk_version_compare_blob(*pkgA->version, *pkgB->version)) {
+		switch (apk_version_compare_atom(pkgA->version, pkgB->version)) {
 		case APK_VERSION_LESS:
 			dbg_printf("    select latest by principal name (less)\n");
 			return -1;
@@ -666,8 +797,8 @@ static void assign_name(struct apk_solver_state *ss, struct apk_name *name, stru
 
 	name->ss.locked = 1;
 	name->ss.chosen = p;
-	if (list_hashed(&name->ss.unresolved_list))
-		list_del(&name->ss.unresolved_list);
+	if (name->ss.unresolved_index)
+		unresolved_del(ss, name);
 	if (list_hashed(&name->ss.dirty_list))
 		list_del(&name->ss.dirty_list);
 
@@ -693,6 +824,7 @@ static void select_package(struct apk_solver_state *ss, struct apk_name *name)
 	struct apk_dependency *d;
 
 	dbg_printf("select_package: %s (requirers=%d, iif=%d)\n", name->name, name->ss.requirers, name->ss.has_iif);
+	ss->stats->select_package++;
 
 	if (name->ss.requirers || name->ss.has_iif) {
 		foreach_array_item(p, name->providers) {
@@ -998,24 +1130,248 @@ static int free_package(apk_hash_item item, void *ctx)
 	return 0;
 }
 
+static int reset_package(apk_hash_item item, void *ctx)
+{
+	struct apk_package *pkg = (struct apk_package *) item;
+	unsigned int flags = pkg->ss.preset_flags;
+	unsigned int flags_inheritable = pkg->ss.preset_flags_inheritable;
+
+	memset(&pkg->ss, 0, sizeof(pkg->ss));
+	pkg->ss.solver_flags = pkg->ss.preset_flags = flags;
+	pkg->ss.solver_flags_inheritable = pkg->ss.preset_flags_inheritable = flags_inheritable;
+	return 0;
+}
+
+static void add_stats(struct apk_solver_stats *to, struct apk_solver_stats *st)
+{
+	to->solves += st->solves;
+	to->restarts += st->restarts;
+	to->names_discovered += st->names_discovered;
+	to->max_dep_chain = max(to->max_dep_chain, st->max_dep_chain);
+	to->reconsider_name += st->reconsider_name;
+	to->compare_providers += st->compare_providers;
+	to->select_package += st->select_package;
+	to->dirty_queued += st->dirty_queued;
+	to->dirty_requeued += st->dirty_requeued;
+	to->disqualify_package += st->disqualify_package;
+	to->discover_ns += st->discover_ns;
+	to->apply_ns += st->apply_ns;
+	to->resolve_ns += st->resolve_ns;
+	to->changeset_ns += st->changeset_ns;
+}
+
 static int cmp_pkgname(const void *p1, const void *p2)
 {
 	const struct apk_dependency *d1 = p1, *d2 = p2;
 	return strcmp(d1->name->name, d2->name->name);
 }
 
-static int compare_name_dequeue(const struct apk_name *a, const struct apk_name *b)
+static void solve_queued(struct apk_solver_state *ss)
 {
-	int r;
+	struct apk_name *name;
 
-	r = (!!a->ss.requirers) - (!!b->ss.requirers);
-	if (r) return -r;
+	do {
+		while (!list_empty(&ss->dirty_head)) {
+			name = list_pop(&ss->dirty_head, struct apk_name, ss.dirty_list);
+			reconsider_name(ss, name);
+		}
 
-	r = (int)a->priority - (int)b->priority;
-	if (r) return r;
+		if (!ss->num_unresolved)
+			break;
 
-	r = a->ss.max_dep_chain - b->ss.max_dep_chain;
-	return -r;
+		select_package(ss, ss->unresolved[0]);
+	} while (1);
+}
+
+static struct apk_dependency *world_dep(struct apk_dependency_array *world, struct apk_name *name)
+{
+	struct apk_dependency *d;
+
+	foreach_array_item(d, world)
+		if (d->name == name)
+			return d;
+	return NULL;
+}
+
+static int dependency_changed(struct apk_dependency *d, struct apk_dependency *d0)
+{
+	return d0 == NULL ||
+		d->version != d0->version ||
+		d->result_mask != d0->result_mask ||
+		d->conflict != d0->conflict ||
+		d->fuzzy != d0->fuzzy ||
+		d->repository_tag != d0->repository_tag;
+}
+
+static int dependencies_satisfied(struct apk_package *pkg)
+{
+	struct apk_dependency *d;
+
+	foreach_array_item(d, pkg->depends) {
+		struct apk_name *name = d->name;
+		if (!apk_dep_is_provided(d, name->ss.locked ? &name->ss.chosen : &provider_none))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void mark_required(struct apk_name *name)
+{
+	struct apk_package *pkg = name->ss.chosen.pkg;
+	struct apk_dependency *d;
+
+	if (name->ss.in_cone || pkg == NULL || pkg->ss.seen)
+		return;
+
+	pkg->ss.seen = 1;
+	foreach_array_item(d, pkg->depends)
+		if (!d->conflict)
+			mark_required(d->name);
+}
+
+static int install_if_triggered(struct apk_package *pkg)
+{
+	struct apk_dependency *d;
+
+	if (pkg->install_if->num == 0)
+		return FALSE;
+	foreach_array_item(d, pkg->install_if)
+		if (!d->name->ss.locked || !apk_dep_is_provided(d, &d->name->ss.chosen))
+			return FALSE;
+	return TRUE;
+}
+
+static void mark_cone(struct apk_solver_state *ss, struct apk_name *name)
+{
+	struct apk_name **pname;
+	struct apk_provider *p;
+	struct apk_dependency *d;
+
+	if (name->ss.in_cone)
+		return;
+
+	name->ss.in_cone = 1;
+	*apk_name_array_add(&ss->cone) = name;
+
+	foreach_array_item(p, name->providers) {
+		mark_cone(ss, p->pkg->name);
+		foreach_array_item(d, p->pkg->provides)
+			mark_cone(ss, d->name);
+		foreach_array_item(d, p->pkg->depends)
+			mark_cone(ss, d->name);
+	}
+	foreach_array_item(pname, name->rinstall_if)
+		mark_cone(ss, *pname);
+}
+
+static int lock_installed(struct apk_name *name, struct apk_provider p)
+{
+	if (name->ss.locked)
+		return !(p.version == &apk_atom_null &&
+			 name->ss.chosen.version == &apk_atom_null);
+
+	name->ss.seen = 1;
+	name->ss.locked = 1;
+	name->ss.chosen = p;
+	return 0;
+}
+
+/* Incremental mode assumes the installed packages are the solution. Only the
+ * cone of names reachable from the added or changed world dependencies is
+ * solved; installed packages outside of it are locked as they are and only
+ * contribute their constraints on the cone. Returns nonzero if this is not
+ * possible, or the result is not consistent, and a full solve is needed. */
+static int solve_incremental(struct apk_solver_state *ss, struct apk_dependency_array *world)
+{
+	struct apk_database *db = ss->db;
+	struct apk_installed_package *ipkg;
+	struct apk_package *pkg;
+	struct apk_dependency *d;
+	struct apk_name **pname;
+
+	/* removing from world can orphan anything */
+	foreach_array_item(d, db->world)
+		if (!world_dep(world, d->name))
+			return 1;
+
+	foreach_array_item(d, world)
+		if (dependency_changed(d, world_dep(db->world, d->name)))
+			mark_cone(ss, d->name);
+	if (ss->cone->num == 0)
+		return 1;
+
+	dbg_printf("incremental: %zu names in cone\n", ss->cone->num);
+
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list) {
+		pkg = ipkg->pkg;
+		if (pkg->name->ss.in_cone)
+			continue;
+		pkg->ss.pinning_allowed = BIT(ipkg->repository_tag);
+		if (lock_installed(pkg->name, APK_PROVIDER_FROM_PACKAGE(pkg)))
+			return 1;
+		foreach_array_item(d, pkg->provides)
+			if (lock_installed(d->name, APK_PROVIDER_FROM_PROVIDES(pkg, d)))
+				return 1;
+	}
+	foreach_array_item(d, world) {
+		if (d->name->ss.in_cone)
+			discover_name(ss, d->name);
+		else if (!apk_dep_is_provided(d, &d->name->ss.chosen))
+			return 1;
+	}
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list) {
+		if (ipkg->pkg->name->ss.in_cone)
+			continue;
+		foreach_array_item(d, ipkg->pkg->depends)
+			if (d->name->ss.in_cone)
+				discover_name(ss, d->name);
+	}
+
+	phase_end(ss, &ss->stats->discover_ns);
+
+	foreach_array_item(d, world) {
+		if (!d->name->ss.in_cone)
+			continue;
+		ss->pinning_inherit = BIT(d->repository_tag);
+		apply_constraint(ss, NULL, d);
+	}
+	ss->pinning_inherit = 0;
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list) {
+		pkg = ipkg->pkg;
+		if (pkg->name->ss.in_cone)
+			continue;
+		foreach_array_item(d, pkg->depends)
+			if (d->name->ss.in_cone)
+				apply_constraint(ss, pkg, d);
+	}
+	phase_end(ss, &ss->stats->apply_ns);
+
+	solve_queued(ss);
+	phase_end(ss, &ss->stats->resolve_ns);
+	if (ss->errors)
+		return 1;
+
+	foreach_array_item(pname, ss->cone) {
+		pkg = (*pname)->ss.chosen.pkg;
+		if (pkg && pkg->name == *pname && !dependencies_satisfied(pkg))
+			return 1;
+	}
+
+	/* the locked packages must be still needed */
+	foreach_array_item(d, world)
+		mark_required(d->name);
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list)
+		if (install_if_triggered(ipkg->pkg))
+			mark_required(ipkg->pkg->name);
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list) {
+		pkg = ipkg->pkg;
+		if (pkg->name->ss.in_cone)
+			continue;
+		if (!pkg->ss.seen || !dependencies_satisfied(pkg))
+			return 1;
+	}
+
+	return 0;
 }
 
 int apk_solver_solve(struct apk_database *db,
@@ -1023,21 +1379,45 @@ int apk_solver_solve(struct apk_database *db,
 		     struct apk_dependency_array *world,
 		     struct apk_changeset *changeset)
 {
-	struct apk_name *name, *name0;
+	struct apk_name *name;
 	struct apk_package *pkg;
 	struct apk_solver_state ss_data, *ss = &ss_data;
+	struct apk_solver_stats stats = { .solves = 1 };
 	struct apk_dependency *d;
+	int timing, incremental;
 
+	apk_db_calc_rdepends(db);
+	timing = apk_timing_begin(db->ctx, "solve", NULL);
 	qsort(world->item, world->num, sizeof(world->item[0]), cmp_pkgname);
 
+	incremental = !!(solver_flags & APK_SOLVERF_INCREMENTAL);
+	solver_flags &= ~APK_SOLVERF_INCREMENTAL;
+
 restart:
 	memset(ss, 0, sizeof(*ss));
 	ss->db = db;
 	ss->changeset = changeset;
 	ss->default_repos = apk_db_get_pinning_mask_repos(db, APK_DEFAULT_PINNING_MASK);
 	ss->ignore_conflict = !!(solver_flags & APK_SOLVERF_IGNORE_CONFLICT);
+	ss->stats = &stats;
+	ss->phase_start = apk_time_ns();
 	list_init(&ss->dirty_head);
-	list_init(&ss->unresolved_head);
+
+	if (incremental && solver_flags == 0) {
+		incremental = 0;
+		apk_name_array_init(&ss->cone);
+		if (solve_incremental(ss, world) == 0) {
+			apk_name_array_free(&ss->cone);
+			goto done;
+		}
+		dbg_printf("incremental solve not possible, solving everything\n");
+		apk_name_array_free(&ss->cone);
+		free(ss->unresolved);
+		apk_hash_foreach(&db->available.names, free_name, NULL);
+		apk_hash_foreach(&db->available.packages, reset_package, NULL);
+		stats.restarts++;
+		goto restart;
+	}
 
 	dbg_printf("discovering world\n");
 	ss->solver_flags_inherit = solver_flags;
@@ -1045,6 +1425,8 @@ restart:
 		if (!d->broken)
 			discover_name(ss, d->name);
 	}
+	phase_end(ss, &stats.discover_ns);
+
 	dbg_printf("applying world\n");
 	foreach_array_item(d, world) {
 		if (!d->broken) {
@@ -1055,31 +1437,16 @@ restart:
 	ss->solver_flags_inherit = 0;
 	ss->pinning_inherit = 0;
 	dbg_printf("applying world [finished]\n");
+	phase_end(ss, &stats.apply_ns);
 
-	do {
-		while (!list_empty(&ss->dirty_head)) {
-			name = list_pop(&ss->dirty_head, struct apk_name, ss.dirty_list);
-			reconsider_name(ss, name);
-		}
-
-		name = NULL;
-		list_for_each_entry(name0, &ss->unresolved_head, ss.unresolved_list) {
-			if (name0->ss.reverse_deps_done && name0->ss.requirers && !name0->ss.has_options) {
-				name = name0;
-				break;
-			}
-			if (!name || compare_name_dequeue(name0, name) < 0)
-				name = name0;
-		}
-		if (name == NULL)
-			break;
-
-		select_package(ss, name);
-	} while (1);
-
+	solve_queued(ss);
+	phase_end(ss, &stats.resolve_ns);
+done:
+	free(ss->unresolved);
 	generate_changeset(ss, world);
+	phase_end(ss, &stats.changeset_ns);
 
-	if (ss->errors && (db->ctx->force & APK_FORCE_BROKEN_WORLD)) {
+	if (ss->errors && !ss->out_of_memory && (db->ctx->force & APK_FORCE_BROKEN_WORLD)) {
 		foreach_array_item(d, world) {
 			name = d->name;
 			pkg = name->ss.chosen.pkg;
@@ -1090,12 +1457,17 @@ restart:
 		}
 		apk_hash_foreach(&db->available.names, free_name, NULL);
 		apk_hash_foreach(&db->available.packages, free_package, NULL);
+		stats.restarts++;
 		goto restart;
 	}
 
 	apk_hash_foreach(&db->available.names, free_name, NULL);
 	apk_hash_foreach(&db->available.packages, free_package, NULL);
 	dbg_printf("solver done, errors=%d\n", ss->errors);
+	if (db->ctx->flags & APK_SOLVER_STATS)
+		add_stats(&db->ctx->solver_stats, &stats);
+	apk_timing_end(db->ctx, timing, 0);
 
+	if (ss->out_of_memory) return -ENOMEM;
 	return ss->errors;
 }
@@ -79,6 +79,15 @@ struct apk_pkey *apk_trust_key_by_name(struct apk_trust *trust, const char *file
 	return NULL;
 }
 
+struct apk_pkey *apk_trust_key_by_id(struct apk_trust *trust, const uint8_t *id)
+{
+	struct apk_trust_key *tkey;
+
+	list_for_each_entry(tkey, &trust->trusted_key_list, key_node)
+		if (memcmp(tkey->key.id, id, sizeof tkey->key.id) == 0)
+			return &tkey->key;
+	return NULL;
+}
 
 /* Command group for signing */
 
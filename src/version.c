@@ -7,9 +7,11 @@
  * SPDX-License-Identifier: GPL-2.0-only
  */
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <ctype.h>
 #include "apk_defines.h"
+#include "apk_atom.h"
 #include "apk_version.h"
 
 /* Gentoo version: {digit}{.digit}...{letter}{_suf{#}}...{-r#} */
@@ -249,6 +251,115 @@ int apk_version_compare_blob_fuzzy(apk_blob_t a, apk_blob_t b, int fuzzy)
 	return APK_VERSION_EQUAL;
 }
 
+/* The comparison key is the token sequence of the version encoded so that
+ * memcmp() of two keys gives the result of apk_version_compare_blob().
+ * Each token is a class byte followed by its value as a big endian integer
+ * with the sign bit flipped. The class is derived from the token type so
+ * that when the types of two versions first differ, the class order gives
+ * the order of the versions: a pre-release suffix sorts first, otherwise
+ * the higher token type sorts lower. TOKEN_END and TOKEN_INVALID terminate
+ * the key without a value. */
+struct apk_version_key {
+	unsigned int len;
+	unsigned char data[];
+};
+
+#define KEY_CLASS_PRE_SUFFIX	0
+#define KEY_CLASS(type)		(TOKEN_END + 1 - (type))
+#define KEY_TOKEN_SIZE		(1 + sizeof(uint64_t))
+
+static struct apk_version_key *version_key_build(apk_blob_t ver)
+{
+	struct apk_version_key *key, *shrunk;
+	unsigned char *p;
+	uint64_t u;
+	int64_t v;
+	int t = TOKEN_DIGIT, tt, i;
+
+	/* every token but the first consumes at least one character,
+	 * and a digit token can be followed by an empty letter one */
+	key = malloc(sizeof *key + 2 * (ver.len + 1) * KEY_TOKEN_SIZE + 1);
+	if (!key) return NULL;
+
+	p = key->data;
+	while (t != TOKEN_END && t != TOKEN_INVALID) {
+		tt = t;
+		v = get_token(&t, &ver);
+		*p++ = (tt == TOKEN_SUFFIX && v < 0) ? KEY_CLASS_PRE_SUFFIX : KEY_CLASS(tt);
+		u = (uint64_t) v ^ (1ULL << 63);
+		for (i = 56; i >= 0; i -= 8)
+			*p++ = u >> i;
+	}
+	*p++ = KEY_CLASS(t);
+	key->len = p - key->data;
+
+	shrunk = realloc(key, sizeof *key + key->len);
+	return shrunk ?: key;
+}
+
+static const struct apk_version_key *version_key_get(apk_blob_t *atom)
+{
+	struct apk_version_key **key = apk_atom_version_key(atom);
+
+	if (!*key) *key = version_key_build(*atom);
+	return *key;
+}
+
+static int version_key_compare(const struct apk_version_key *a,
+			       const struct apk_version_key *b, int fuzzy)
+{
+	unsigned int i, ac, bc;
+	int r;
+
+	if (!fuzzy) {
+		/* equal keys end with the same terminator at the same offset,
+		 * so the shorter length covers the difference */
+		r = memcmp(a->data, b->data, min(a->len, b->len));
+		if (r < 0) return APK_VERSION_LESS;
+		if (r > 0) return APK_VERSION_GREATER;
+		return APK_VERSION_EQUAL;
+	}
+
+	for (i = 0; ; i += KEY_TOKEN_SIZE) {
+		ac = a->data[i];
+		bc = b->data[i];
+		if (ac != bc) {
+			/* pre and post release suffixes are the same token
+			 * type, so they differ by value, not in the fuzzy way */
+			if ((ac == KEY_CLASS_PRE_SUFFIX && bc == KEY_CLASS(TOKEN_SUFFIX)) ||
+			    (bc == KEY_CLASS_PRE_SUFFIX && ac == KEY_CLASS(TOKEN_SUFFIX)))
+				return ac < bc ? APK_VERSION_LESS : APK_VERSION_GREATER;
+			return APK_VERSION_EQUAL;
+		}
+		if (ac == KEY_CLASS(TOKEN_END) || ac == KEY_CLASS(TOKEN_INVALID))
+			return APK_VERSION_EQUAL;
+		r = memcmp(&a->data[i+1], &b->data[i+1], KEY_TOKEN_SIZE - 1);
+		if (r < 0) return APK_VERSION_LESS;
+		if (r > 0) return APK_VERSION_GREATER;
+	}
+}
+
+int apk_version_compare_atom_fuzzy(apk_blob_t *a, apk_blob_t *b, int fuzzy)
+{
+	const struct apk_version_key *ak, *bk;
+
+	if (APK_BLOB_IS_NULL(*a) || APK_BLOB_IS_NULL(*b))
+		return apk_version_compare_blob_fuzzy(*a, *b, fuzzy);
+	if (a == b)
+		return APK_VERSION_EQUAL;
+
+	ak = version_key_get(a);
+	bk = version_key_get(b);
+	if (!ak || !bk)
+		return apk_version_compare_blob_fuzzy(*a, *b, fuzzy);
+	return version_key_compare(ak, bk, fuzzy);
+}
+
+int apk_version_compare_atom(apk_blob_t *a, apk_blob_t *b)
+{
+	return apk_version_compare_atom_fuzzy(a, b, FALSE);
+}
+
 int apk_version_compare_blob(apk_blob_t a, apk_blob_t b)
 {
 	return apk_version_compare_blob_fuzzy(a, b, FALSE);
@@ -0,0 +1,118 @@
+#!/bin/sh
+#
+# Benchmark index loading and solving on a synthetic repository, and
+# version comparison on its versions and those of version.data.
+#
+# Usage: bench/bench.sh [-u], from the test directory
+#   -u  store the results as the new baseline
+#
+# Environment:
+#   BENCH_N          number of packages to generate (default 30000)
+#   BENCH_RUNS       runs per scenario, the best is kept (default 10)
+#   BENCH_TOLERANCE  allowed slowdown against the baseline in percent
+#                    (default 50)
+
+BENCH_DIR=$(dirname "$0")
+APK_TEST="$VALGRIND ../src/apk-test"
+N=${BENCH_N:-30000}
+RUNS=${BENCH_RUNS:-10}
+TOLERANCE=${BENCH_TOLERANCE:-50}
+BASELINE=$BENCH_DIR/baseline
+WORK=${TMPDIR:-/tmp}/apk-bench.$$
+
+mkdir -p "$WORK" || exit 1
+trap 'rm -rf "$WORK"' EXIT INT TERM
+
+awk -v N="$N" -v OUT="$WORK/bench" -f "$BENCH_DIR/genrepo.awk" || exit 1
+world="$(cat "$WORK/bench.world")"
+repos="--test-repo $WORK/bench.repo --test-repo edge:$WORK/bench-edge.repo"
+instdb="--test-instdb $WORK/bench.installed"
+
+# run SCENARIO ARGS...: print the best index loading and solve times in
+# microseconds of $RUNS runs of apk-test with ARGS
+run() {
+	scenario=$1
+	shift
+	i=0
+	while [ $i -lt "$RUNS" ]; do
+		if ! $APK_TEST --timings-file "$WORK/timings" "$@" > "$WORK/out" 2>&1 ||
+		   grep -q "^ERROR" "$WORK/out"; then
+			echo "$scenario: solving failed:" >&2
+			cat "$WORK/out" >&2
+			touch "$WORK/failed"
+			break
+		fi
+		awk -F '\t' -v s="$scenario" '
+			$1 == "index" { index_us += $4 }
+			$1 == "solve" { solve_us += $4 }
+			END { print s, "index", index_us + 0; print s, "solve", solve_us + 0 }
+			' "$WORK/timings"
+		i=$((i+1))
+	done | awk '
+		{ k = $1 " " $2; if (!(k in best) || $3 < best[k]) best[k] = $3 }
+		END { for (k in best) print k, best[k] }' | sort
+}
+
+# run_version: check that the keyed version comparison agrees with the
+# tokenizing one, and print the best times of $RUNS runs of both
+run_version() {
+	{ cut -d' ' -f1,3 version.data | tr ' ' '\n'
+	  sed -n 's/^V://p' "$WORK/bench.repo" "$WORK/bench-edge.repo"
+	} | sort -u > "$WORK/versions"
+	i=0
+	while [ $i -lt "$RUNS" ]; do
+		if ! $APK_TEST vertest --bench < "$WORK/versions" > "$WORK/out" 2>&1; then
+			echo "version: comparisons differ:" >&2
+			cat "$WORK/out" >&2
+			touch "$WORK/failed"
+			break
+		fi
+		awk '$1 == "blob_us" { print "version blob", $2 }
+		     $1 == "key_us" { print "version key", $2 }' "$WORK/out"
+		i=$((i+1))
+	done | awk '
+		{ k = $1 " " $2; if (!(k in best) || $3 < best[k]) best[k] = $3 }
+		END { for (k in best) print k, best[k] }' | sort
+}
+
+{
+	run_version &&
+	run install $repos --test-world "$world" add &&
+	run upgrade $repos $instdb --test-world "$world" upgrade &&
+	run add $repos $instdb --test-world "$world" add "$(printf 'pkg%05d' "$N")"
+} > "$WORK/results"
+[ -f "$WORK/failed" ] && exit 1
+
+if [ "$1" = "-u" ]; then
+	{ echo "# N=$N"; cat "$WORK/results"; } > "$BASELINE"
+	cat "$BASELINE"
+	exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+	echo "No baseline, run 'bench/bench.sh -u' to store one."
+	cat "$WORK/results"
+	exit 0
+fi
+if ! grep -qx "# N=$N" "$BASELINE"; then
+	echo "Baseline was made with a different BENCH_N, not comparing."
+	cat "$WORK/results"
+	exit 0
+fi
+
+awk -v tol="$TOLERANCE" '
+	NR == FNR { if ($1 !~ /^#/) base[$1 " " $2] = $3; next }
+	{
+		b = base[$1 " " $2]
+		status = ""
+		if (b && $3 > b * (100 + tol) / 100) {
+			status = "REGRESSION"
+			fail++
+		}
+		printf "%-8s %-6s %9d us  baseline %9d us  %s\n", $1, $2, $3, b, status
+	}
+	END {
+		if (fail) print "FAIL: " fail " benchmark(s) slower than the baseline"
+		else print "OK: no regressions against the baseline"
+		exit fail > 0
+	}' "$BASELINE" "$WORK/results"
@@ -0,0 +1,137 @@
+#!/usr/bin/awk -f
+#
+# Generate a synthetic repository in the format of the solver test fixtures.
+#
+# Variables (-v):
+#   N     number of packages (default 30000)
+#   SEED  random seed (default 1)
+#   OUT   output prefix (default "bench")
+#
+# Writes OUT.repo (main repository), OUT-edge.repo (newer versions of some
+# packages for a pinned tag), OUT.installed (the main repository packages
+# needed by world, resolving virtuals to their first provider) and
+# OUT.world (the world dependencies).
+#
+# Every 5th package is a library providing so:libNNNNN.so.1, every 10th
+# also provides one of the unversioned cmd: virtuals with a provider
+# priority, every 25th has a -doc companion installed by install_if, and
+# every 100th an obsolete -legacy package that a few others conflict with. Dependencies point to lower numbered
+# packages, biased towards the low ones, so the graph has deep chains and
+# popular leaves.
+
+function rnd(n) { return int(rand() * n) }
+
+function csum(	s, i) {
+	s = "Q1"
+	for (i = 0; i < 27; i++)
+		s = s substr(B64, rnd(64) + 1, 1)
+	return s "="
+}
+
+function pkgname(i) { return sprintf("pkg%05d", i) }
+
+function entry(name, ver, deps, provides, iif, prio,	s) {
+	s = sprintf("C:%s\nP:%s\nV:%s\nS:%d\nI:%d\n", csum(), name, ver, 1024 + rnd(65536), 4096 + rnd(262144))
+	if (deps != "") s = s "D:" deps "\n"
+	if (provides != "") s = s "p:" provides "\n"
+	if (iif != "") s = s "i:" iif "\n"
+	if (prio != "") s = s "k:" prio "\n"
+	return s
+}
+
+function install(name,	i, n, d) {
+	if (name in installed) return
+	installed[name] = 1
+	order[++ninstalled] = name
+	n = split(deplist[name], d, " ")
+	for (i = 1; i <= n; i++) {
+		if (substr(d[i], 1, 1) == "!") continue
+		sub(/[<>=~].*$/, "", d[i])
+		if (d[i] in provider) install(provider[d[i]])
+	}
+}
+
+BEGIN {
+	if (!N) N = 30000
+	if (!SEED) SEED = 1
+	if (OUT == "") OUT = "bench"
+	srand(SEED)
+	B64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"
+	ncmd = int(N / 50) + 1
+
+	provider["docs"] = "docs"
+	pkg["docs"] = entry("docs", "1.0-r0", "", "", "", "")
+	print pkg["docs"] > (OUT ".repo")
+
+	for (i = 1; i <= N; i++) {
+		name = pkgname(i)
+		ver = sprintf("1.%d.%d-r%d", i % 7, rnd(20), rnd(3))
+		deps = ""
+		ndeps = (i < 20) ? 0 : rnd(6)
+		for (k = 0; k < ndeps; k++) {
+			j = int((i - 1) * rand() * rand()) + 1
+			if (j % 10 == 0 && rnd(2)) dep = sprintf("cmd:tool%d", int(j / 10) % ncmd)
+			else {
+				if (j % 5 == 0) dep = sprintf("so:lib%05d.so.1", j)
+				else dep = pkgname(j)
+				if (rnd(10) == 0) dep = dep ">=1.0"
+			}
+			if (index(" " deps " ", " " dep " ")) continue
+			deps = deps (deps == "" ? "" : " ") dep
+		}
+		if (i > 100 && rnd(50) == 0)
+			deps = deps (deps == "" ? "" : " ") "!" pkgname(100 * (rnd(int(i / 100)) + 1)) "-legacy"
+
+		provides = ""; prio = ""
+		if (i % 5 == 0) {
+			provides = sprintf("so:lib%05d.so.1=1.0", i)
+			provider[sprintf("so:lib%05d.so.1", i)] = name
+		}
+		if (i % 10 == 0) {
+			cmd = sprintf("cmd:tool%d", int(i / 10) % ncmd)
+			provides = provides " " cmd
+			prio = 1 + rnd(100)
+			if (!(cmd in provider)) provider[cmd] = name
+		}
+
+		provider[name] = name
+		deplist[name] = deps
+		pkg[name] = entry(name, ver, deps, provides, "", prio)
+		print pkg[name] > (OUT ".repo")
+
+		if (i % 100 == 0) {
+			pkg[name "-legacy"] = entry(name "-legacy", "0.9-r0", "", "", "", "")
+			print pkg[name "-legacy"] > (OUT ".repo")
+		}
+		if (i % 25 == 0) {
+			doc = name "-doc"
+			pkg[doc] = entry(doc, ver, "", "", name " docs", "")
+			print pkg[doc] > (OUT ".repo")
+			iif[name] = doc
+		}
+		if (rnd(20) == 0) {
+			ever = sprintf("2.%d.0-r0", i % 7)
+			print entry(name, ever, deps, provides, "", prio) > (OUT "-edge.repo")
+			edge[++nedge] = name
+		}
+	}
+
+	world = "docs"
+	install("docs")
+	for (k = 0; k < 300; k++) {
+		name = pkgname(int(N / 2) + rnd(int(N / 2)) + 1)
+		if (index(" " world " ", " " name)) continue
+		world = world " " name
+		install(name)
+	}
+	for (k = 1; k <= nedge && k <= 10; k++)
+		world = world " " edge[k] "@edge"
+	print world > (OUT ".world")
+
+	for (k = 1; k <= ninstalled; k++) {
+		name = order[k]
+		print pkg[name] > (OUT ".installed")
+		if (name in iif)
+			print pkg[iif[name]] > (OUT ".installed")
+	}
+}
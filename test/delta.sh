@@ -0,0 +1,107 @@
+#!/bin/sh
+
+# Updates a cached index over http with deltas created by apk index.
+
+command -v python3 > /dev/null || { echo "OK: delta skipped, no python3"; exit 0; }
+
+. ./testlib.sh
+
+APK="../src/apk --allow-untrusted --force-no-chroot"
+REPO="$TMP/repo"
+LOG="$TMP/http.log"
+ARCH=$(../src/apk --print-arch)
+INDEX="$REPO/$ARCH/APKINDEX.tar.gz"
+
+# publish index $1, modified $3 seconds from now, with a delta from index $2
+# named after the base it applies to
+publish() {
+	cp "$TMP/$1.tar.gz" "$INDEX"
+	touch -d "@$(($(date +%s) + $3))" "$INDEX"
+	delta="$REPO/$ARCH/APKINDEX.$(sha256sum "$TMP/$2.tar.gz" | cut -c1-16).delta"
+	$APK index --delta-from "$TMP/$2.tar.gz" -o "$delta" "$TMP/$1.tar.gz" > /dev/null 2>&1
+}
+
+update() {
+	: > "$LOG"
+	$APK -vv --root "$ROOT" -X "http://127.0.0.1:$port" --cache-dir "$ROOT/cache" update > "$TMP/update.log" 2>&1
+}
+
+cached() {
+	cmp -s "$ROOT"/cache/APKINDEX.*.tar.gz "$TMP/$1.tar.gz" && echo $1
+}
+
+requests() {
+	grep -c "GET /$ARCH/$1 " "$LOG"
+}
+
+for p in a b c d e f g h; do
+	mkpkg $p 1.0
+	mkpkg $p 2.0
+done
+mkindex "$TMP/v1.tar.gz" --rsyncable "$TMP"/[a-g]-1.0.apk
+mkindex "$TMP/v2.tar.gz" --rsyncable "$TMP"/[a-h]-1.0.apk
+mkindex "$TMP/v3.tar.gz" --rsyncable "$TMP"/[a-g]-1.0.apk "$TMP"/h-2.0.apk
+mkindex "$TMP/v4.tar.gz" --rsyncable "$TMP"/[a-h]-2.0.apk
+
+mkdir -p "$REPO/$ARCH" "$ROOT/cache"
+$APK --root "$ROOT" --initdb add > /dev/null 2>&1
+publish v1 v1 -3600
+python3 -u -c '
+import functools, http.server, sys
+handler = functools.partial(http.server.SimpleHTTPRequestHandler, directory=sys.argv[1])
+server = http.server.HTTPServer(("127.0.0.1", 0), handler)
+print(server.server_address[1])
+server.serve_forever()' "$REPO" > "$TMP/port" 2>> "$LOG" &
+pids=$!
+wait_for -s "$TMP/port"
+port=$(cat "$TMP/port")
+
+update
+check "initial download" "$(cached v1)" "v1"
+
+# an unchanged index is not worth a delta
+update
+check "unchanged index" "$(requests 'APKINDEX.*.delta')" "0"
+touch -d "@$(($(date +%s) - 1800))" "$ROOT"/cache/APKINDEX.*.tar.gz
+$APK --root "$ROOT" -X "http://127.0.0.1:$port" --cache-dir "$ROOT/cache" \
+	--cache-max-age 1 add > /dev/null 2>&1
+check "unmodified index" "$(grep -c '" 304 ' "$LOG")" "1"
+check "unmodified index delta" "$(requests 'APKINDEX.*.delta')" "0"
+
+# a changed index is rebuilt from the delta
+publish v2 v1 60
+update
+check "delta applied" "$(cached v2)" "v2"
+check "delta fetched" "$(requests 'APKINDEX.*.delta')" "1"
+check "delta listed" "$($APK --root "$ROOT" -X "http://127.0.0.1:$port" --cache-dir "$ROOT/cache" \
+	--no-network search -e h)" "h-1.0-r0"
+
+# a truncated delta is rejected, and the full index downloaded
+publish v3 v2 120
+head -c -16 "$delta" > "$TMP/delta"
+cat "$TMP/delta" > "$delta"
+update
+check "truncated delta" "$(cached v3)" "v3"
+check "truncated delta fetched" "$(requests 'APKINDEX.*.delta')" "1"
+
+# as is a tampered one
+publish v4 v3 180
+printf 'X' | dd of="$delta" bs=1 seek=$(($(wc -c < "$delta") - 1)) conv=notrunc 2> /dev/null
+update
+check "tampered delta" "$(cached v4)" "v4"
+
+# and one building a target much larger than its base
+publish v1 v4 240
+printf '\040' | dd of="$delta" bs=1 seek=10 conv=notrunc 2> /dev/null
+update
+check "oversized delta" "$(cached v1)" "v1"
+check "oversized delta rejected" "$(grep -c 'delta not used: File too large' "$TMP/update.log")" "1"
+
+# and a missing one
+publish v2 v1 300
+rm -f "$delta"
+update
+check "missing delta" "$(cached v2)" "v2"
+check "missing delta fetched" "$(requests 'APKINDEX.*.delta')" "1"
+
+report "index deltas work"
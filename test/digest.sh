@@ -0,0 +1,53 @@
+#!/bin/sh
+
+# Pre-parsed digests of cached repository indexes are used only for an
+# index signed by a key that is still trusted.
+
+command -v openssl > /dev/null || { echo "OK: digest skipped, no openssl"; exit 0; }
+
+. ./testlib.sh
+
+APK="../src/apk --force-no-chroot --no-network"
+URL="http://127.0.0.1:1/repo"
+CACHE="$ROOT/etc/apk/cache"
+INDEX="$CACHE/APKINDEX.$(printf %s "$URL" | sha1sum | cut -c1-8)"
+
+mkpkg a 1.0
+mkindex "$TMP/index.tar.gz" "$TMP/a-1.0.apk"
+mkkey "$ROOT/etc/apk/keys"
+$APK --root "$ROOT" --initdb add > /dev/null 2>&1
+mkdir -p "$CACHE"
+sign "$TMP/index.tar.gz" | cat - "$TMP/index.tar.gz" > "$INDEX.tar.gz"
+
+search() {
+	$APK --root "$ROOT" -X "$URL" "$@" search -e a 2> /dev/null
+}
+
+# a signed index gets a digest, which is used while the key is trusted
+$APK --root "$ROOT" -X "$URL" add > /dev/null 2>&1
+check "signed index digest" "$(ls "$INDEX.adb" 2> /dev/null)" "$INDEX.adb"
+check "digest used" "$(search)" "a-1.0-r0"
+mv "$ROOT/etc/apk/keys/test.rsa.pub" "$TMP"
+check "revoked key" "$(search)" ""
+check "revoked key untrusted" "$(search --allow-untrusted)" "a-1.0-r0"
+mv "$TMP/test.rsa.pub" "$ROOT/etc/apk/keys"
+
+# an unsigned index loaded with --allow-untrusted gets none
+rm -f "$INDEX.adb"
+cp "$TMP/index.tar.gz" "$INDEX.tar.gz"
+$APK --root "$ROOT" -X "$URL" --allow-untrusted add > /dev/null 2>&1
+check "unsigned index digest" "$(ls "$INDEX.adb" 2> /dev/null)" ""
+check "unsigned index" "$(search)" ""
+
+# nor does a signed one, as the key is not checked then
+sign "$TMP/index.tar.gz" | cat - "$TMP/index.tar.gz" > "$INDEX.tar.gz"
+$APK --root "$ROOT" -X "$URL" --allow-untrusted add > /dev/null 2>&1
+check "signed index untrusted digest" "$(ls "$INDEX.adb" 2> /dev/null)" ""
+
+# a digest is tied to the index it was made from
+$APK --root "$ROOT" -X "$URL" add > /dev/null 2>&1
+cp "$TMP/index.tar.gz" "$INDEX.tar.gz"
+touch -r "$INDEX.adb" "$INDEX.tar.gz"
+check "replaced index" "$(search)" ""
+
+report "repository index digests work"
@@ -0,0 +1,61 @@
+#!/bin/sh
+
+. ./testlib.sh
+
+APK="../src/apk --allow-untrusted --force-no-chroot --no-network --no-cache"
+
+# v3 package with the files usr/share/$1/file and usr/share/$1/sub/file
+mkpkg3() {
+	mkdir -p "$TMP/$1/usr/share/$1/sub"
+	echo $1 > "$TMP/$1/usr/share/$1/file"
+	echo $1 > "$TMP/$1/usr/share/$1/sub/file"
+	$APK mkpkg --info name:$1 --info version:1.0-r0 --info arch:noarch \
+		--files "$TMP/$1" -o "$TMP/$1-1.0.apk" > /dev/null
+}
+
+mkpkg3 a
+mkpkg3 b
+$APK add --root "$ROOT" --initdb "$TMP/a-1.0.apk" "$TMP/b-1.0.apk" > /dev/null
+ln -s /usr/share/b "$ROOT/blink"
+
+batch() {
+	printf '%s\n' "$@" | $APK --root "$ROOT" info --from-stdin 2>&1
+}
+
+check "batch path" "$(batch /usr/share/a/file /usr/share/b/sub/file)" \
+"/usr/share/a/file is owned by a-1.0-r0
+/usr/share/b/sub/file is owned by b-1.0-r0"
+check "batch missing" "$(batch /usr/share/a/file /nonexistent /usr/share/b/file)" \
+"/usr/share/a/file is owned by a-1.0-r0
+ERROR: /nonexistent: Could not find owner package
+/usr/share/b/file is owned by b-1.0-r0"
+check "batch prefix" "$(batch /usr/share/a/ | sort)" \
+"/usr/share/a/file is owned by a-1.0-r0
+/usr/share/a/sub/file is owned by a-1.0-r0"
+check "batch shared prefix" "$(batch /usr/share/ | sort)" \
+"/usr/share/a/file is owned by a-1.0-r0
+/usr/share/a/sub/file is owned by a-1.0-r0
+/usr/share/b/file is owned by b-1.0-r0
+/usr/share/b/sub/file is owned by b-1.0-r0"
+check "batch symlink prefix" "$(batch /blink/ | sort)" \
+"/usr/share/b/file is owned by b-1.0-r0
+/usr/share/b/sub/file is owned by b-1.0-r0"
+check "batch partial prefix" "$(batch /usr/sh/)" \
+"ERROR: /usr/sh/: Could not find owner package"
+
+# each answer is written before the next query is read
+mkfifo "$TMP/in" "$TMP/out"
+$APK --root "$ROOT" info --from-stdin < "$TMP/in" > "$TMP/out" 2>&1 &
+out=$(timeout 10 sh -c '
+	exec 3> "$1" 4< "$2"
+	for f in /usr/share/a/file /usr/share/b/file; do
+		echo $f >&3
+		read -r line <&4 || exit 1
+		echo "$line"
+	done' - "$TMP/in" "$TMP/out")
+wait
+check "batch streaming" "$out" \
+"/usr/share/a/file is owned by a-1.0-r0
+/usr/share/b/file is owned by b-1.0-r0"
+
+report "info batch mode works"
@@ -0,0 +1,68 @@
+#!/bin/sh
+
+. ./testlib.sh
+
+APK="../src/apk --allow-untrusted --force-no-chroot --no-network --no-cache"
+DB="$ROOT/lib/apk/db"
+
+# v3 package with the file usr/share/$1/file
+mkpkg3() {
+	mkdir -p "$TMP/$1/usr/share/$1"
+	echo $1 > "$TMP/$1/usr/share/$1/file"
+	$APK mkpkg --info name:$1 --info version:1.0-r0 --info arch:noarch \
+		--files "$TMP/$1" -o "$TMP/$1-1.0.apk" > /dev/null
+}
+
+add() {
+	$APK --root "$ROOT" add "$TMP/$1-1.0.apk" > /dev/null 2>&1
+}
+
+installed() {
+	$APK --root "$ROOT" del --simulate "$@" 2>&1 | sed -n 's/.*Purging \([^ ]*\).*/\1/p' | sort | xargs
+}
+
+for p in a b c d e f g h j k l; do mkpkg3 $p; done
+$APK add --root "$ROOT" --initdb "$TMP"/[a-h]-1.0.apk > /dev/null
+
+# small transactions go to the journal, and are replayed on open
+add j
+add k
+check "journal written" "$(grep -c '^=:$' "$DB/installed.journal")" "2"
+check "text database untouched" "$(grep -c '^P:[jk]$' "$DB/installed")" "0"
+check "journal replayed" "$(installed a j k)" "a j k"
+
+# a transaction without the commit marker was interrupted, and is dropped
+head -c -3 "$DB/installed.journal" > "$TMP/journal"
+cat "$TMP/journal" > "$DB/installed.journal"
+check "incomplete transaction" "$(installed a j k)" "a j"
+sed -i '/^k>/d' "$ROOT/etc/apk/world"
+add l
+check "incomplete transaction dropped" "$(installed j k l)" "j l"
+check "incomplete transaction truncated" "$(grep -c '^P:k$' "$DB/installed.journal")" "0"
+
+# a journal for other version of the text database is ignored, and
+# restarted on the next change
+echo >> "$DB/installed"
+check "stale journal" "$(installed a j l)" "a"
+sed -i '/^[jl]>/d' "$ROOT/etc/apk/world"
+add k
+check "stale journal discarded" "$(grep -c '^P:[jkl]$' "$DB/installed.journal")" "1"
+check "stale journal state" "$(installed a j k l)" "a k"
+
+# the journal is compacted into the text database once it is too big
+mkdir -p "$TMP/big/usr/share/big"
+i=0
+while [ $i -lt 2000 ]; do
+	echo $i > "$TMP/big/usr/share/big/$i"
+	i=$((i+1))
+done
+$APK mkpkg --info name:big --info version:1.0-r0 --info arch:noarch \
+	--files "$TMP/big" -o "$TMP/big-1.0.apk" > /dev/null
+add big
+check "big transaction journaled" "$(grep -c '^P:big$' "$DB/installed.journal")" "1"
+add j
+check "journal compacted" "$(ls "$DB/installed.journal" 2>/dev/null)" ""
+check "compacted text database" "$(grep -c '^P:\(big\|j\|k\)$' "$DB/installed")" "3"
+check "compacted state" "$(installed a big j k)" "a big j k"
+
+report "installed database journal works"
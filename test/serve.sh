@@ -0,0 +1,83 @@
+#!/bin/sh
+
+. ./testlib.sh
+
+APK="../src/apk --allow-untrusted --force-no-chroot --no-network --no-cache"
+REPO="$TMP/repo"
+SOCK="$TMP/serve.sock"
+LOG="$TMP/serve.log"
+ARCH=$(../src/apk --print-arch)
+INDEX="$REPO/$ARCH/APKINDEX.tar.gz"
+
+# run a query through the daemon, and compare it to the local answer
+# which is left in $remote
+query() {
+	local=$(APK_SERVE_SOCKET= $APK --root "$ROOT" -X "$REPO" "$@")
+	answered=$(grep -c "Answering" "$LOG")
+	remote=$(APK_SERVE_SOCKET="$SOCK" $APK --root "$ROOT" -X "$REPO" "$@")
+	check "$*: served" "$(grep -c "Answering" "$LOG")" "$((answered+1))"
+	check "$*: answer" "$remote" "$local"
+}
+
+mkpkg a 1.0
+mkpkg a 2.0
+mkpkg b 1.0
+mkindex "$INDEX" "$TMP/a-1.0.apk"
+$APK add --root "$ROOT" --initdb "$TMP/a-1.0.apk" > /dev/null 2>&1
+
+APK_SERVE_SOCKET="$SOCK" $APK -vv --root "$ROOT" -X "$REPO" serve > "$LOG" 2>&1 &
+pids=$!
+wait_for -S "$SOCK"
+
+query info -W /usr/share/a/file
+query list --installed
+query policy a
+
+# the daemon reopens the database when the installed state changes
+APK_SERVE_SOCKET= $APK --root "$ROOT" add "$TMP/b-1.0.apk" > /dev/null 2>&1
+query list --installed
+check "installed changed" "$(echo "$remote" | grep -c installed)" "2"
+check "reopened" "$(grep -c "Database changed" "$LOG")" "1"
+
+# and when an index changes
+mkindex "$INDEX" "$TMP/a-1.0.apk" "$TMP/a-2.0.apk"
+query policy a
+check "index changed" "$(echo "$remote" | grep -c 2.0-r0)" "1"
+check "reopened again" "$(grep -c "Database changed" "$LOG")" "2"
+
+# peers of other users are rejected, and run the query locally
+if [ "$(id -u)" = 0 ] && command -v setpriv > /dev/null; then
+	mkdir "$TMP/bin"
+	cp ../src/apk ../src/libapk.so* "$TMP/bin"
+	chmod 755 "$TMP"
+	chmod 777 "$SOCK"
+	out=$(APK_SERVE_SOCKET="$SOCK" LD_LIBRARY_PATH="$TMP/bin" \
+		setpriv --reuid=65534 --regid=65534 --clear-groups \
+		"$TMP/bin/apk" --root "$ROOT" -X "$REPO" --allow-untrusted \
+		--no-network --no-cache info -W /usr/share/a/file 2>&1)
+	check "other uid answer" "$out" "/usr/share/a/file is owned by a-1.0-r0"
+	check "other uid rejected" "$(grep -c "Rejected peer with uid 65534" "$LOG")" "1"
+
+	# nor is a request sent to a listener of another user
+	if command -v python3 > /dev/null; then
+		python=$(python3 -c 'import sys; print(sys.executable)')
+		mkdir "$TMP/other"
+		chown 65534 "$TMP/other"
+		setpriv --reuid=65534 --regid=65534 --clear-groups "$python" -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.bind(sys.argv[1])
+s.listen(1)
+c, _ = s.accept()
+print(len(c.recv(4096)), flush=True)' "$TMP/other/serve.sock" > "$TMP/other.log" &
+		wait_for -S "$TMP/other/serve.sock"
+		out=$(APK_SERVE_SOCKET="$TMP/other/serve.sock" $APK -vv --root "$ROOT" -X "$REPO" \
+			info -W /usr/share/a/file 2>&1)
+		wait $!
+		check "other listener answer" "$(echo "$out" | tail -n 1)" "/usr/share/a/file is owned by a-1.0-r0"
+		check "other listener rejected" "$(echo "$out" | grep -c "Rejected peer with uid 65534")" "1"
+		check "other listener request" "$(cat "$TMP/other.log")" "0"
+	fi
+fi
+
+report "query daemon works"
@@ -0,0 +1,56 @@
+#!/bin/sh
+
+. ./testlib.sh
+
+APK="../src/apk --allow-untrusted --force-no-chroot --no-network --no-cache"
+DB="$ROOT/lib/apk/db"
+
+# v3 package of the files in $TMP/$1
+mkpkg3() {
+	$APK mkpkg --info name:$1 --info version:1.0-r0 --info arch:noarch \
+		--files "$TMP/$1" -o "$TMP/$1-1.0.apk" > /dev/null
+}
+
+install() {
+	rm -rf "$ROOT"
+	$APK add --root "$ROOT" --initdb "$@" 2>&1
+}
+
+purging() {
+	$APK --root "$ROOT" del --simulate a 2>&1 | sed -n 's/.*Purging //p'
+}
+
+mkdir -p "$TMP/a/usr/share/a" "$TMP/big-1.0/usr/share/big"
+echo a > "$TMP/a/usr/share/a/file"
+mkpkg3 a
+install "$TMP/a-1.0.apk" > /dev/null
+check "snapshot written" "$(ls "$DB/installed.adb" 2>&1)" "$DB/installed.adb"
+check "snapshot read" "$(purging)" "a (1.0-r0)"
+
+# a text database changed behind apk's back is not shadowed by the snapshot
+sed -i 's/^V:1.0-r0$/V:1.0-r1/' "$DB/installed"
+check "stale snapshot" "$(purging)" "a (1.0-r1)"
+
+# a corrupt snapshot with a valid stamp falls back to the text database
+install "$TMP/a-1.0.apk" > /dev/null
+../src/apk adbdump "$DB/installed.adb" |
+	sed 's/\(hash: \)\([0-9a-f]*\)$/\1\2\2\2/' > "$TMP/corrupt.yaml"
+../src/apk adbgen "$TMP/corrupt.yaml" > "$DB/installed.adb"
+out=$(purging)
+check "corrupt snapshot" "$out" "a (1.0-r0)"
+check "corrupt snapshot removed" "$(ls "$DB/installed.adb" 2>/dev/null)" ""
+
+# a package too big for the snapshot is reported and the text database used;
+# this needs a v2 package, as a v3 one has the same limits
+i=0
+while [ $i -lt 8000 ]; do
+	: > "$TMP/big-1.0/usr/share/big/$i"
+	i=$((i+1))
+done
+mkpkg big 1.0
+out=$(install "$TMP/a-1.0.apk" "$TMP/big-1.0.apk" | grep "too many")
+check "oversized package" "$out" "WARNING: big-1.0-r0: too many directories or files for the installed database snapshot"
+check "oversized snapshot" "$(ls "$DB/installed.adb" 2>/dev/null)" ""
+check "oversized read" "$(purging)" "a (1.0-r0)"
+
+report "installed database snapshot works"
@@ -0,0 +1,87 @@
+# Fixtures shared by the test scripts, sourced from the test directory.
+# The script sets APK with the options it needs after sourcing this.
+
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/apk-$(basename "$0" .sh).XXXXXX") || exit 1
+ROOT="$TMP/root"
+
+# background processes killed on exit
+pids=
+cleanup() {
+	for pid in $pids; do
+		kill $pid 2>/dev/null && wait $pid 2>/dev/null
+	done
+	rm -rf "$TMP"
+}
+trap cleanup EXIT
+
+fail=0
+
+check() {
+	if [ "$2" != "$3" ]; then
+		echo "FAIL: $1: expected '$3', got '$2'"
+		fail=$((fail+1))
+	fi
+}
+
+# print the summary, and exit with the number of failed checks
+report() {
+	if [ $fail -eq 0 ]; then
+		echo "OK: $1"
+	fi
+	exit $fail
+}
+
+# wait up to ten seconds for a test(1) condition, such as -S socket
+wait_for() {
+	i=0
+	while [ ! "$1" "$2" ] && [ $i -lt 100 ]; do
+		sleep 0.1
+		i=$((i+1))
+	done
+}
+
+# v2 streams are concatenated gzip members of tar segments without the
+# end of archive blocks
+tgz() {
+	tar -cf - "$@" | head -c $((512 + ($(cat "$@" | wc -c) + 511) / 512 * 512)) | gzip -n
+}
+
+# build v2 package $TMP/$1-$2.apk of the files in $TMP/$1-$2, which gets
+# usr/share/$1/file if it does not exist; control.tar.gz and data.tar.gz
+# are left in the directory
+mkpkg() {
+	dir="$TMP/$1-$2"
+	if [ ! -d "$dir/usr" ]; then
+		mkdir -p "$dir/usr/share/$1"
+		echo "$1-$2" > "$dir/usr/share/$1/file"
+	fi
+	(
+		cd "$dir"
+		tar -cf - usr | gzip -n > data.tar.gz
+		printf 'pkgname = %s\npkgver = %s-r0\narch = noarch\nsize = 1\ndatahash = %s\n' \
+			$1 $2 "$(sha256sum data.tar.gz | cut -d' ' -f1)" > .PKGINFO
+		tgz .PKGINFO > control.tar.gz
+		cat control.tar.gz data.tar.gz > "../$1-$2.apk"
+	)
+}
+
+# index the packages to $1
+mkindex() {
+	out="$1"
+	shift
+	mkdir -p "$(dirname "$out")"
+	$APK --allow-untrusted index -o "$out" "$@" > /dev/null 2>&1
+}
+
+# create the signing key $TMP/test.rsa, and its public key in directory $1
+mkkey() {
+	mkdir -p "$1"
+	openssl genrsa -out "$TMP/test.rsa" 2048 2> /dev/null
+	openssl rsa -in "$TMP/test.rsa" -pubout -out "$1/test.rsa.pub" 2> /dev/null
+}
+
+# print the signature segment for the file $1
+sign() {
+	openssl dgst -sha1 -sign "$TMP/test.rsa" -out "$TMP/.SIGN.RSA.test.rsa.pub" "$1"
+	(cd "$TMP" && tgz .SIGN.RSA.test.rsa.pub)
+}
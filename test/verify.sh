@@ -0,0 +1,39 @@
+#!/bin/sh
+
+# Verifies signed v2 packages and indexes with the synchronous and the
+# pipelined decompression.
+
+command -v openssl > /dev/null || { echo "OK: verify skipped, no openssl"; exit 0; }
+
+. ./testlib.sh
+
+APK="../src/apk"
+
+verify() {
+	../src/apk-test --keys-dir "$TMP/keys" --test-cpus $1 verify "$TMP/$2"
+}
+
+mkkey "$TMP/keys"
+
+mkpkg a 1.0
+mkpkg a 1.1
+sign "$TMP/a-1.0/control.tar.gz" > "$TMP/sig.tar.gz"
+cat "$TMP/sig.tar.gz" "$TMP/a-1.0/control.tar.gz" "$TMP/a-1.0/data.tar.gz" > "$TMP/a.apk"
+cat "$TMP/sig.tar.gz" "$TMP/a-1.0/control.tar.gz" "$TMP/a-1.1/data.tar.gz" > "$TMP/bad-data.apk"
+cat "$TMP/sig.tar.gz" "$TMP/a-1.1/control.tar.gz" "$TMP/a-1.0/data.tar.gz" > "$TMP/bad-control.apk"
+
+mkindex "$TMP/index.tar.gz" "$TMP/a.apk"
+mkindex "$TMP/index2.tar.gz" "$TMP/a.apk" "$TMP/a-1.1.apk"
+sign "$TMP/index.tar.gz" > "$TMP/sig.tar.gz"
+cat "$TMP/sig.tar.gz" "$TMP/index.tar.gz" > "$TMP/APKINDEX.tar.gz"
+cat "$TMP/sig.tar.gz" "$TMP/index2.tar.gz" > "$TMP/bad-APKINDEX.tar.gz"
+
+for cpus in 1 4; do
+	check "package ($cpus cpus)" "$(verify $cpus a.apk)" "$TMP/a.apk: OK"
+	check "index ($cpus cpus)" "$(verify $cpus APKINDEX.tar.gz)" "$TMP/APKINDEX.tar.gz: OK"
+	check "tampered data ($cpus cpus)" "$(verify $cpus bad-data.apk)" "$TMP/bad-data.apk: v2 package integrity error"
+	check "tampered control ($cpus cpus)" "$(verify $cpus bad-control.apk)" "$TMP/bad-control.apk: BAD signature"
+	check "tampered index ($cpus cpus)" "$(verify $cpus bad-APKINDEX.tar.gz)" "$TMP/bad-APKINDEX.tar.gz: BAD signature"
+done
+
+report "signature verification works"
@@ -9,6 +9,12 @@ cat version.data | while read a result b rest ; do
 	fi
 done
 
+# the keyed comparison of atoms must agree with the string comparison
+if ! cut -d' ' -f1,3 version.data | tr ' ' '\n' | ../src/apk vertest --bench > /dev/null; then
+	echo "keyed version comparison differs"
+	fail=$(($fail+1))
+fi
+
 if [ "$fail" = "0" ]; then
 	echo "OK: version checking works"
 fi